@@ -49,6 +49,8 @@ class _EditData:
 
     def do_edit(self, ctx, key):
         output = StringIO.StringIO()
+        # edit() also flushes ctx.key_cache, so the edited key is looked
+        # up again afterwards
         ctx.edit(key, self.callback, output)
 
     def callback(self, status, args, fd):
@@ -20,6 +20,7 @@ import unittest
 def test_suite():
     import gpgme.tests.test_context
     import gpgme.tests.test_keys
+    import gpgme.tests.test_keycache
     import gpgme.tests.test_keylist
     import gpgme.tests.test_import
     import gpgme.tests.test_export
@@ -29,9 +30,17 @@ def test_suite():
     import gpgme.tests.test_passphrase
     import gpgme.tests.test_progress
     import gpgme.tests.test_editkey
+    import gpgme.tests.test_data
+    import gpgme.tests.test_operation
+    import gpgme.tests.test_contextpool
+    import gpgme.tests.test_executor
+    import gpgme.tests.test_recipientset
+    import gpgme.tests.test_threads
+    import gpgme.tests.test_timeout
     suite = unittest.TestSuite()
     suite.addTest(gpgme.tests.test_context.test_suite())
     suite.addTest(gpgme.tests.test_keys.test_suite())
+    suite.addTest(gpgme.tests.test_keycache.test_suite())
     suite.addTest(gpgme.tests.test_keylist.test_suite())
     suite.addTest(gpgme.tests.test_import.test_suite())
     suite.addTest(gpgme.tests.test_export.test_suite())
@@ -41,4 +50,11 @@ def test_suite():
     suite.addTest(gpgme.tests.test_passphrase.test_suite())
     suite.addTest(gpgme.tests.test_progress.test_suite())
     suite.addTest(gpgme.tests.test_editkey.test_suite())
+    suite.addTest(gpgme.tests.test_data.test_suite())
+    suite.addTest(gpgme.tests.test_operation.test_suite())
+    suite.addTest(gpgme.tests.test_contextpool.test_suite())
+    suite.addTest(gpgme.tests.test_executor.test_suite())
+    suite.addTest(gpgme.tests.test_recipientset.test_suite())
+    suite.addTest(gpgme.tests.test_threads.test_suite())
+    suite.addTest(gpgme.tests.test_timeout.test_suite())
     return suite
@@ -15,6 +15,9 @@
 # License along with this library; if not, write to the Free Software
 # Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
+import os
+import shutil
+import tempfile
 import unittest
 
 import gpgme
@@ -121,6 +124,80 @@ class ContextTestCase(GpgHomeTestCase):
         del ctx.progress_cb
         self.assertEqual(ctx.progress_cb, None)
 
+    def test_write_buffer_size(self):
+        ctx = gpgme.Context()
+        self.assertEqual(ctx.write_buffer_size, 0)
+        ctx.write_buffer_size = 4096
+        self.assertEqual(ctx.write_buffer_size, 4096)
+
+        def set_write_buffer_size(ctx, value):
+            ctx.write_buffer_size = value
+        self.assertRaises(ValueError, set_write_buffer_size, ctx, -1)
+
+        def del_write_buffer_size(ctx):
+            del ctx.write_buffer_size
+        self.assertRaises(TypeError, del_write_buffer_size, ctx)
+
+    def test_collect_stats(self):
+        ctx = gpgme.Context()
+        self.assertEqual(ctx.collect_stats, False)
+        self.assertEqual(ctx.last_op_stats, None)
+        ctx.collect_stats = True
+        self.assertEqual(ctx.collect_stats, True)
+
+        def del_collect_stats(ctx):
+            del ctx.collect_stats
+        self.assertRaises(TypeError, del_collect_stats, ctx)
+
+    def test_engine_info(self):
+        ctx = gpgme.Context()
+        info = [engine for engine in ctx.get_engine_info()
+                if engine['protocol'] == gpgme.PROTOCOL_OpenPGP]
+        self.assertEqual(len(info), 1)
+        file_name = info[0]['file_name']
+
+        homedir = tempfile.mkdtemp(prefix='tmp.gpghome')
+        try:
+            ctx.set_engine_info(gpgme.PROTOCOL_OpenPGP, None, homedir)
+            info = [engine for engine in ctx.get_engine_info()
+                    if engine['protocol'] == gpgme.PROTOCOL_OpenPGP]
+            self.assertEqual(info[0]['file_name'], file_name)
+            self.assertEqual(info[0]['home_dir'], homedir)
+
+            # other contexts keep using GNUPGHOME
+            for engine in gpgme.Context().get_engine_info():
+                self.assertNotEqual(engine['home_dir'], homedir)
+        finally:
+            shutil.rmtree(homedir, ignore_errors=True)
+
+        self.assertRaises(gpgme.GpgmeError, ctx.set_engine_info, 999)
+
+    def test_engine_info_keyrings(self):
+        # two keyrings used side by side without touching GNUPGHOME
+        homedirs = [tempfile.mkdtemp(prefix='tmp.gpghome')
+                    for i in range(2)]
+        try:
+            contexts = []
+            for homedir in homedirs:
+                ctx = gpgme.Context()
+                ctx.set_engine_info(gpgme.PROTOCOL_OpenPGP, None, homedir)
+                contexts.append(ctx)
+            contexts[0].import_(self.keyfile('key1.pub'))
+            contexts[1].import_(self.keyfile('key2.pub'))
+
+            key = contexts[0].get_key(
+                'E79A842DA34A1CA383F64A1546BB55F0885C65A4')
+            self.assertEqual(key.subkeys[0].fpr,
+                             'E79A842DA34A1CA383F64A1546BB55F0885C65A4')
+            self.assertRaises(gpgme.GpgmeError, contexts[1].get_key,
+                              'E79A842DA34A1CA383F64A1546BB55F0885C65A4')
+            self.assertRaises(gpgme.GpgmeError, gpgme.Context().get_key,
+                              'E79A842DA34A1CA383F64A1546BB55F0885C65A4')
+            self.assertEqual(os.environ['GNUPGHOME'], self._gpghome)
+        finally:
+            for homedir in homedirs:
+                shutil.rmtree(homedir, ignore_errors=True)
+
 
 def test_suite():
     loader = unittest.TestLoader()
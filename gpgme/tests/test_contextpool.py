@@ -0,0 +1,127 @@
+# pygpgme - a Python wrapper for the gpgme library
+# Copyright (C) 2006  James Henstridge
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+import shutil
+import tempfile
+import threading
+import unittest
+import StringIO
+
+import gpgme
+from gpgme.tests.util import GpgHomeTestCase
+
+class ContextPoolTestCase(GpgHomeTestCase):
+
+    import_keys = ['key1.pub', 'key1.sec']
+
+    def test_settings(self):
+        pool = gpgme.ContextPool(2, armor=True, textmode=True)
+        self.assertEqual(pool.size, 2)
+        self.assertEqual(pool.available, 2)
+        with pool.lease() as ctx:
+            self.assertTrue(isinstance(ctx, gpgme.Context))
+            self.assertEqual(ctx.armor, True)
+            self.assertEqual(ctx.textmode, True)
+            self.assertEqual(pool.available, 1)
+        self.assertEqual(pool.available, 2)
+
+        self.assertRaises(AttributeError, gpgme.ContextPool, 1, colour=True)
+        self.assertRaises(ValueError, gpgme.ContextPool, 0)
+
+    def test_reset(self):
+        pool = gpgme.ContextPool(1, armor=True)
+        with pool.lease() as ctx:
+            ctx.armor = False
+            ctx.signers = [ctx.get_key('E79A842DA34A1CA383F64A1546BB55F0885C65A4')]
+            ctx.passphrase_cb = lambda *args: None
+        with pool.lease() as ctx2:
+            self.assertTrue(ctx2 is ctx)
+            self.assertEqual(ctx.armor, True)
+            self.assertEqual(ctx.signers, ())
+            self.assertEqual(ctx.passphrase_cb, None)
+
+    def test_reset_engine_info(self):
+        # a lease can't hand its keyring on to the next one
+        pool = gpgme.ContextPool(1)
+        homedir = tempfile.mkdtemp(prefix='tmp.gpghome')
+        try:
+            with pool.lease() as ctx:
+                ctx.set_engine_info(gpgme.PROTOCOL_OpenPGP, None, homedir)
+            with pool.lease() as ctx2:
+                self.assertTrue(ctx2 is ctx)
+                for engine in ctx.get_engine_info():
+                    self.assertNotEqual(engine['home_dir'], homedir)
+                ctx.get_key('E79A842DA34A1CA383F64A1546BB55F0885C65A4')
+        finally:
+            shutil.rmtree(homedir, ignore_errors=True)
+
+    def test_acquire_release(self):
+        pool = gpgme.ContextPool(1)
+        ctx = pool.acquire()
+        self.assertEqual(pool.acquire(0), None)
+        self.assertRaises(gpgme.GpgmeError, pool.lease(0.01).__enter__)
+        self.assertRaises(ValueError, pool.release, gpgme.Context())
+        pool.release(ctx)
+        self.assertRaises(ValueError, pool.release, ctx)
+
+        stats = pool.stats
+        self.assertEqual(stats['leases'], 1)
+        self.assertEqual(stats['waits'], 2)
+        self.assertEqual(stats['timeouts'], 2)
+        self.assertTrue(stats['max_wait_time'] <= stats['wait_time'])
+
+    def test_replace_busy_context(self):
+        pool = gpgme.ContextPool(1)
+        ctx = pool.acquire()
+        op = ctx.keylist_start()
+        pool.release(ctx)
+        self.assertEqual(pool.stats['replaced'], 1)
+        with pool.lease() as ctx2:
+            self.assertFalse(ctx2 is ctx)
+        op.wait()
+
+    def test_threads(self):
+        pool = gpgme.ContextPool(2)
+        errors = []
+
+        def worker(n):
+            try:
+                for i in range(5):
+                    with pool.lease() as ctx:
+                        key = ctx.get_key(
+                            'E79A842DA34A1CA383F64A1546BB55F0885C65A4')
+                        plaintext = StringIO.StringIO('message %d\n' % n)
+                        ciphertext = StringIO.StringIO()
+                        ctx.encrypt([key], gpgme.ENCRYPT_ALWAYS_TRUST,
+                                    plaintext, ciphertext)
+            except Exception, exc:
+                errors.append(exc)
+
+        threads = [threading.Thread(target=worker, args=(n,))
+                   for n in range(4)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        self.assertEqual(errors, [])
+        self.assertEqual(pool.available, 2)
+        self.assertEqual(pool.stats['leases'], 20)
+
+
+def test_suite():
+    loader = unittest.TestLoader()
+    return loader.loadTestsFromName(__name__)
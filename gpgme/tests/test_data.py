@@ -0,0 +1,165 @@
+# pygpgme - a Python wrapper for the gpgme library
+# Copyright (C) 2006  James Henstridge
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+import io
+import os
+import tempfile
+import time
+import unittest
+import StringIO
+
+import gpgme
+from gpgme.tests.util import GpgHomeTestCase
+
+class SlowStringIO(StringIO.StringIO):
+    """A stream that takes a while to produce each chunk."""
+
+    def read(self, size=-1):
+        time.sleep(0.01)
+        return StringIO.StringIO.read(self, min(size, 4096))
+
+
+class BlockedRawIO(io.RawIOBase):
+    """A non-blocking sink that never has room for more output."""
+
+    def writable(self):
+        return True
+
+    def write(self, b):
+        return None
+
+
+class DataTestCase(GpgHomeTestCase):
+
+    import_keys = ['key1.pub', 'key1.sec', 'key2.pub', 'key2.sec']
+
+    def test_memory(self):
+        data = gpgme.Data()
+        data.write('Hello World\n')
+        self.assertEqual(data.seek(0, os.SEEK_CUR), 12)
+        data.rewind()
+        self.assertEqual(data.read(5), 'Hello')
+        self.assertEqual(data.read(), ' World\n')
+        self.assertEqual(data.read(), '')
+
+    def test_attributes(self):
+        data = gpgme.Data('Hello World\n')
+        self.assertEqual(data.encoding, gpgme.DATA_ENCODING_NONE)
+        data.encoding = gpgme.DATA_ENCODING_BINARY
+        self.assertEqual(data.encoding, gpgme.DATA_ENCODING_BINARY)
+        self.assertEqual(data.file_name, None)
+        data.file_name = 'hello.txt'
+        self.assertEqual(data.file_name, 'hello.txt')
+        self.assertEqual(data.size_hint, None)
+        data.size_hint = 12
+        self.assertEqual(data.size_hint, 12)
+
+    def test_sign_verify_reuse(self):
+        ctx = gpgme.Context()
+        ctx.signers = [ctx.get_key('E79A842DA34A1CA383F64A1546BB55F0885C65A4')]
+        plaintext = gpgme.Data('Hello World\n')
+        signature = gpgme.Data()
+        ctx.sign(plaintext, signature, gpgme.SIG_MODE_DETACH)
+
+        plaintext.rewind()
+        signature.rewind()
+        sigs = ctx.verify(signature, plaintext, None)
+        self.assertEqual(len(sigs), 1)
+        self.assertEqual(sigs[0].fpr,
+                         'E79A842DA34A1CA383F64A1546BB55F0885C65A4')
+
+    def test_encrypt_fan_out(self):
+        ctx = gpgme.Context()
+        plaintext = gpgme.Data('Hello World\n')
+        for fpr in ['E79A842DA34A1CA383F64A1546BB55F0885C65A4',
+                    '93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F']:
+            plaintext.rewind()
+            ciphertext = StringIO.StringIO()
+            ctx.encrypt([ctx.get_key(fpr)], gpgme.ENCRYPT_ALWAYS_TRUST,
+                        plaintext, ciphertext)
+            self.assertEqual(ctx.decrypt_bytes(ciphertext.getvalue()),
+                             'Hello World\n')
+
+    def test_file_like(self):
+        output = StringIO.StringIO()
+        data = gpgme.Data(output)
+        data.write('Hello World\n')
+        data.flush()
+        self.assertEqual(output.getvalue(), 'Hello World\n')
+
+    def test_raw_write_blocked(self):
+        data = gpgme.Data(BlockedRawIO(), write_buffer_size=0)
+        self.assertRaises(gpgme.GpgmeError, data.write, 'Hello World\n')
+
+    def test_path(self):
+        fd, filename = tempfile.mkstemp()
+        try:
+            os.write(fd, 'Hello World\n')
+            os.close(fd)
+            data = gpgme.Data(path=filename)
+            self.assertEqual(data.read(), 'Hello World\n')
+        finally:
+            os.unlink(filename)
+
+    def test_path_fifo(self):
+        tmpdir = tempfile.mkdtemp()
+        filename = os.path.join(tmpdir, 'fifo')
+        try:
+            os.mkfifo(filename)
+            fd = os.open(filename, os.O_RDWR)
+            try:
+                os.write(fd, 'Hello World\n')
+                data = gpgme.Data(path=filename)
+                self.assertEqual(data.read(12), 'Hello World\n')
+            finally:
+                os.close(fd)
+        finally:
+            os.unlink(filename)
+            os.rmdir(tmpdir)
+
+    def test_file_dropped(self):
+        fp = tempfile.TemporaryFile()
+        fp.write('Hello World\n')
+        fp.seek(0)
+        data = gpgme.Data(fp)
+        del fp
+        # the descriptor stays open while the data object uses it
+        other = tempfile.TemporaryFile()
+        self.assertEqual(data.read(), 'Hello World\n')
+        other.close()
+
+    def test_read_ahead(self):
+        plaintext = ''.join('line %d\n' % i for i in range(10000))
+        ctx = gpgme.Context()
+        ctx.armor = True
+        source = gpgme.Data(SlowStringIO(plaintext), read_ahead=4,
+                            read_ahead_size=4096)
+        signature = ctx.sign_bytes(plaintext, gpgme.SIG_MODE_DETACH)
+        sigs = ctx.verify(gpgme.Data(signature), source, None)
+        self.assertEqual(len(sigs), 1)
+        stats = source.read_ahead_stats
+        self.assertEqual(stats['buffers'], 4)
+        self.assertEqual(stats['buffer_size'], 4096)
+        self.assertEqual(stats['bytes'], len(plaintext))
+        self.assertEqual(gpgme.Data('in memory', read_ahead=4)
+                         .read_ahead_stats, None)
+
+
+def test_suite():
+    loader = unittest.TestLoader()
+    return loader.loadTestsFromName(__name__)
@@ -15,6 +15,9 @@
 # License along with this library; if not, write to the Free Software
 # Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
+import io
+import os
+import tempfile
 import unittest
 import StringIO
 from textwrap import dedent
@@ -22,6 +25,16 @@ from textwrap import dedent
 import gpgme
 from gpgme.tests.util import GpgHomeTestCase
 
+class CountingStringIO(StringIO.StringIO):
+
+    def __init__(self, *args):
+        StringIO.StringIO.__init__(self, *args)
+        self.writes = 0
+
+    def write(self, data):
+        self.writes += 1
+        StringIO.StringIO.write(self, data)
+
 class EncryptDecryptTestCase(GpgHomeTestCase):
 
     import_keys = ['key1.pub', 'key1.sec', 'key2.pub', 'key2.sec',
@@ -106,6 +119,169 @@ class EncryptDecryptTestCase(GpgHomeTestCase):
         ctx.decrypt(ciphertext, plaintext)
         self.assertEqual(plaintext.getvalue(), 'Hello World\n')
 
+    def test_encrypt_from_string(self):
+        ciphertext = StringIO.StringIO()
+        ctx = gpgme.Context()
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        ctx.encrypt([recipient], gpgme.ENCRYPT_ALWAYS_TRUST,
+                    'Hello World\n', ciphertext)
+
+        plaintext = StringIO.StringIO()
+        ctx.decrypt(ciphertext.getvalue(), plaintext)
+        self.assertEqual(plaintext.getvalue(), 'Hello World\n')
+
+    def test_decrypt_into_string(self):
+        ciphertext = StringIO.StringIO()
+        ctx = gpgme.Context()
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        ctx.encrypt([recipient], gpgme.ENCRYPT_ALWAYS_TRUST,
+                    'Hello World\n', ciphertext)
+
+        # buffer objects can only be used as input
+        self.assertRaises(gpgme.GpgmeError, ctx.decrypt,
+                          ciphertext.getvalue(), bytearray(12))
+
+    def test_write_buffer_size(self):
+        plaintext = 'Hello World\n' * 10000
+        ctx = gpgme.Context()
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        ciphertext = StringIO.StringIO()
+        ctx.encrypt([recipient], gpgme.ENCRYPT_ALWAYS_TRUST,
+                    plaintext, ciphertext)
+
+        ctx.write_buffer_size = 0
+        unbuffered = CountingStringIO()
+        ctx.decrypt(ciphertext.getvalue(), unbuffered)
+        self.assertEqual(unbuffered.getvalue(), plaintext)
+
+        ctx.write_buffer_size = 1024 * 1024
+        buffered = CountingStringIO()
+        ctx.decrypt(ciphertext.getvalue(), buffered)
+        self.assertEqual(buffered.getvalue(), plaintext)
+        self.assertEqual(buffered.writes, 1)
+        self.assertTrue(unbuffered.writes > 1)
+
+    def test_last_op_stats(self):
+        plaintext = 'Hello World\n' * 1000
+        ctx = gpgme.Context()
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        ciphertext = ctx.encrypt_bytes([recipient],
+                                       gpgme.ENCRYPT_ALWAYS_TRUST, plaintext)
+        self.assertEqual(ctx.last_op_stats, None)
+
+        ctx.collect_stats = True
+        output = StringIO.StringIO()
+        ctx.decrypt(StringIO.StringIO(ciphertext), output)
+        stats = ctx.last_op_stats
+        self.assertEqual(stats['operation'], 'decrypt')
+        self.assertEqual(stats['bytes_read'], len(ciphertext))
+        self.assertEqual(stats['bytes_written'], len(plaintext))
+        self.assertTrue(stats['read_calls'] > 0)
+        self.assertTrue(stats['write_calls'] > 0)
+        self.assertTrue(stats['callback_time'] <= stats['total_time'])
+        self.assertTrue(stats['gil_wait_time'] >= 0)
+
+        ctx.collect_stats = False
+        ctx.decrypt(StringIO.StringIO(ciphertext), StringIO.StringIO())
+        self.assertEqual(ctx.last_op_stats, None)
+
+    def test_encrypt_decrypt_iter(self):
+        plaintext = os.urandom(1024 * 1024)
+        consumed = []
+        def chunks():
+            for i in range(0, len(plaintext), 8192):
+                consumed.append(i)
+                yield plaintext[i:i + 8192]
+
+        ctx = gpgme.Context()
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        ciphertext = ctx.encrypt_iter([recipient],
+                                      gpgme.ENCRYPT_ALWAYS_TRUST, chunks())
+        first = next(ciphertext)
+        # output arrives before the whole input has been read
+        self.assertTrue(len(consumed) < len(plaintext) // 8192)
+        ciphertext = [first] + list(ciphertext)
+
+        self.assertEqual(''.join(ctx.decrypt_iter(ciphertext)), plaintext)
+
+    def test_decrypt_iter_error(self):
+        ctx = gpgme.Context()
+        output = ctx.decrypt_iter(['not ', 'an ', 'OpenPGP ', 'message'])
+        self.assertRaises(gpgme.GpgmeError, list, output)
+
+    def test_encrypt_iter_reentry(self):
+        errors = []
+        def chunks():
+            try:
+                next(output)
+            except ValueError, exc:
+                errors.append(exc)
+            yield 'Hello World\n'
+
+        ctx = gpgme.Context()
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        output = ctx.encrypt_iter([recipient], gpgme.ENCRYPT_ALWAYS_TRUST,
+                                  chunks())
+        self.assertTrue(''.join(output))
+        self.assertEqual(len(errors), 1)
+
+    def test_encrypt_decrypt_bytesio(self):
+        plaintext = io.BytesIO('Hello World\n')
+        ciphertext = io.BytesIO()
+        ctx = gpgme.Context()
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        ctx.encrypt([recipient], gpgme.ENCRYPT_ALWAYS_TRUST,
+                    plaintext, ciphertext)
+
+        ciphertext.seek(0)
+        plaintext = io.BytesIO()
+        ctx.decrypt(ciphertext, plaintext)
+        self.assertEqual(plaintext.getvalue(), 'Hello World\n')
+
+    def test_encrypt_decrypt_bytes(self):
+        ctx = gpgme.Context()
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        ciphertext = ctx.encrypt_bytes([recipient],
+                                       gpgme.ENCRYPT_ALWAYS_TRUST,
+                                       'Hello World\n')
+        self.assertTrue(isinstance(ciphertext, str))
+        self.assertEqual(ctx.decrypt_bytes(ciphertext), 'Hello World\n')
+
+        # an empty message still produces a string
+        ciphertext = ctx.encrypt_bytes([recipient],
+                                       gpgme.ENCRYPT_ALWAYS_TRUST, '')
+        self.assertEqual(ctx.decrypt_bytes(ciphertext), '')
+
+    def test_encrypt_decrypt_file(self):
+        ciphertext = tempfile.TemporaryFile()
+        ctx = gpgme.Context()
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        ctx.encrypt([recipient], gpgme.ENCRYPT_ALWAYS_TRUST,
+                    StringIO.StringIO('Hello World\n'), ciphertext)
+
+        # the file position follows the data written by the engine
+        self.assertNotEqual(ciphertext.tell(), 0)
+        ciphertext.seek(0)
+        plaintext = StringIO.StringIO()
+        ctx.decrypt(ciphertext, plaintext)
+        self.assertEqual(plaintext.getvalue(), 'Hello World\n')
+
+    def test_decrypt_from_fd(self):
+        ciphertext = tempfile.TemporaryFile()
+        ctx = gpgme.Context()
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        ctx.encrypt([recipient], gpgme.ENCRYPT_ALWAYS_TRUST,
+                    'Hello World\n', ciphertext)
+
+        fd = os.dup(ciphertext.fileno())
+        try:
+            os.lseek(fd, 0, os.SEEK_SET)
+            plaintext = StringIO.StringIO()
+            ctx.decrypt(fd, plaintext)
+        finally:
+            os.close(fd)
+        self.assertEqual(plaintext.getvalue(), 'Hello World\n')
+
     def test_encrypt_armor(self):
         plaintext = StringIO.StringIO('Hello World\n')
         ciphertext = StringIO.StringIO()
@@ -164,7 +340,75 @@ class EncryptDecryptTestCase(GpgHomeTestCase):
             self.assertEqual(e[1], gpgme.ERR_GENERAL)
         else:
             self.fail('gpgme.GpgmeError not raised')
-        
+
+    def test_encrypt_many(self):
+        ctx = gpgme.Context()
+        recipient = [ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')]
+        signonly = [ctx.get_key('15E7CE9BF1771A4ABC550B31F540A569CB935A42')]
+        jobs = [(recipient, 'message %d\n' % i) for i in range(5)]
+        jobs.insert(2, (signonly, 'not encrypted\n'))
+        results = ctx.encrypt_many(jobs, gpgme.ENCRYPT_ALWAYS_TRUST)
+        self.assertEqual(len(results), 6)
+
+        # a failed item doesn't stop the rest of the batch
+        error = results.pop(2)
+        self.assertTrue(isinstance(error, gpgme.GpgmeError))
+        for i, ciphertext in enumerate(results):
+            self.assertEqual(ctx.decrypt_bytes(ciphertext), 'message %d\n' % i)
+
+        self.assertEqual(ctx.encrypt_many([]), [])
+        self.assertRaises(TypeError, ctx.encrypt_many, [recipient])
+        self.assertRaises(TypeError, ctx.encrypt_many,
+                          [(recipient, StringIO.StringIO('Hello\n'))])
+        self.assertRaises(TypeError, ctx.encrypt_many,
+                          [(['not a key'], 'Hello\n')])
+
+    def test_encrypt_symmetric(self):
+        ctx = gpgme.Context()
+        ctx.passphrase_cb = lambda uid_hint, info, prev_was_bad, fd: \
+            os.write(fd, 'test\n')
+        ciphertext = ctx.encrypt_bytes(None, 0, 'Hello World\n')
+        self.assertEqual(ctx.decrypt_bytes(ciphertext), 'Hello World\n')
+
+        # encrypt_many() accepts None recipients as encrypt() does
+        results = ctx.encrypt_many([(None, 'message 0\n'),
+                                    (None, 'message 1\n')])
+        for i, ciphertext in enumerate(results):
+            self.assertEqual(ctx.decrypt_bytes(ciphertext), 'message %d\n' % i)
+
+    def test_decrypt_many(self):
+        ctx = gpgme.Context()
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        ctx.signers = [ctx.get_key('E79A842DA34A1CA383F64A1546BB55F0885C65A4')]
+        ciphertexts = [
+            ctx.encrypt_bytes([recipient], gpgme.ENCRYPT_ALWAYS_TRUST,
+                              'Hello World\n'),
+            'not a message',
+            ctx.encrypt_bytes([recipient], gpgme.ENCRYPT_ALWAYS_TRUST, '')]
+        signed = StringIO.StringIO()
+        ctx.encrypt_sign([recipient], gpgme.ENCRYPT_ALWAYS_TRUST,
+                         StringIO.StringIO('Signed\n'), signed)
+        ciphertexts.append(signed.getvalue())
+
+        results = ctx.decrypt_many(ciphertexts)
+        self.assertEqual(results[0], 'Hello World\n')
+        self.assertTrue(isinstance(results[1], gpgme.GpgmeError))
+        self.assertEqual(results[2], '')
+        self.assertEqual(results[3], 'Signed\n')
+
+        results = ctx.decrypt_verify_many(ciphertexts)
+        self.assertEqual(results[0], ('Hello World\n', []))
+        self.assertTrue(isinstance(results[1], gpgme.GpgmeError))
+        self.assertEqual(results[2], ('', []))
+        plaintext, sigs = results[3]
+        self.assertEqual(plaintext, 'Signed\n')
+        self.assertEqual(len(sigs), 1)
+        self.assertEqual(sigs[0][0],
+                         'E79A842DA34A1CA383F64A1546BB55F0885C65A4')
+        self.assertEqual(sigs[0][2], 0)
+
+        self.assertRaises(TypeError, ctx.decrypt_many, [None])
+
 
 def test_suite():
     loader = unittest.TestLoader()
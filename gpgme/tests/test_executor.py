@@ -0,0 +1,243 @@
+# pygpgme - a Python wrapper for the gpgme library
+# Copyright (C) 2006  James Henstridge
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import unittest
+
+import gpgme
+from gpgme.tests.util import GpgHomeTestCase
+
+class ExecutorTestCase(GpgHomeTestCase):
+
+    import_keys = ['key1.pub', 'key1.sec', 'key2.pub', 'key2.sec']
+
+    def test_encrypt_decrypt(self):
+        ctx = gpgme.Context()
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        with gpgme.Executor(3) as executor:
+            self.assertEqual(executor.workers, 3)
+            futures = [executor.encrypt([recipient],
+                                        gpgme.ENCRYPT_ALWAYS_TRUST,
+                                        'message %d\n' % i)
+                       for i in range(10)]
+            ciphertexts = [future.wait() for future in futures]
+            futures = [executor.decrypt(ciphertext)
+                       for ciphertext in ciphertexts]
+            for i, future in enumerate(futures):
+                self.assertEqual(future.wait(), 'message %d\n' % i)
+                self.assertEqual(future.done(), True)
+
+        stats = executor.stats
+        self.assertEqual(len(stats), 3)
+        self.assertEqual(sum(worker['completed'] for worker in stats), 20)
+        self.assertRaises(ValueError, executor.decrypt, ciphertexts[0])
+
+    def test_sign_verify(self):
+        ctx = gpgme.Context()
+        key = ctx.get_key('E79A842DA34A1CA383F64A1546BB55F0885C65A4')
+        executor = gpgme.Executor(2, signers=[key])
+        try:
+            signature = executor.sign('Hello World\n',
+                                      gpgme.SIG_MODE_DETACH).wait()
+            plaintext, sigs = executor.verify(signature,
+                                              'Hello World\n').wait()
+            self.assertEqual(plaintext, None)
+            self.assertEqual(len(sigs), 1)
+            self.assertEqual(sigs[0][0],
+                             'E79A842DA34A1CA383F64A1546BB55F0885C65A4')
+            self.assertEqual(sigs[0][2], 0)
+        finally:
+            executor.shutdown()
+
+    def test_error(self):
+        executor = gpgme.Executor(1)
+        try:
+            future = executor.decrypt('not a message')
+            self.assertRaises(gpgme.GpgmeError, future.wait)
+            self.assertRaises(gpgme.GpgmeError, future.result)
+        finally:
+            executor.shutdown()
+
+    def test_done_callback(self):
+        ctx = gpgme.Context()
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        finished = []
+        with gpgme.Executor(2) as executor:
+            future = executor.encrypt([recipient],
+                                      gpgme.ENCRYPT_ALWAYS_TRUST, 'Hello\n')
+            future.add_done_callback(finished.append)
+        self.assertEqual(finished, [future])
+        self.assertTrue(isinstance(future.result(), str))
+
+        # callbacks added once the job has finished run immediately
+        future.add_done_callback(finished.append)
+        self.assertEqual(finished, [future, future])
+
+    def test_invalid_input(self):
+        with gpgme.Executor(1) as executor:
+            self.assertRaises(TypeError, executor.decrypt, None)
+            self.assertRaises(TypeError, executor.encrypt,
+                              ['not a key'], 0, 'Hello\n')
+        self.assertRaises(ValueError, gpgme.Executor, 0)
+        self.assertRaises(AttributeError, gpgme.Executor, 1, colour=True)
+
+    def test_priorities(self):
+        ctx = gpgme.Context()
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        finished = []
+        with gpgme.Executor(1) as executor:
+            for i in range(5):
+                future = executor.encrypt(
+                    [recipient], gpgme.ENCRYPT_ALWAYS_TRUST, 'bulk\n',
+                    priority=gpgme.PRIORITY_BULK)
+                future.add_done_callback(
+                    lambda future, i=i: finished.append('bulk %d' % i))
+            future = executor.encrypt(
+                [recipient], gpgme.ENCRYPT_ALWAYS_TRUST, 'interactive\n',
+                priority=gpgme.PRIORITY_INTERACTIVE)
+            future.add_done_callback(
+                lambda future: finished.append('interactive'))
+        # at most the bulk job already running finishes first
+        self.assertTrue(finished.index('interactive') <= 1)
+        self.assertEqual(finished[2:],
+                         sorted(item for item in finished[2:]))
+
+        stats = executor.queue_stats
+        self.assertEqual(len(stats), 3)
+        self.assertEqual(stats[gpgme.PRIORITY_BULK]['submitted'], 5)
+        self.assertEqual(stats[gpgme.PRIORITY_INTERACTIVE]['submitted'], 1)
+        self.assertEqual(stats[gpgme.PRIORITY_NORMAL]['submitted'], 0)
+        for stat in stats:
+            self.assertEqual(stat['queued'], 0)
+            self.assertTrue(stat['max_wait_time'] <= stat['wait_time'] or
+                            stat['submitted'] == 0)
+
+    def test_deadline(self):
+        ctx = gpgme.Context()
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        with gpgme.Executor(1) as executor:
+            futures = [executor.encrypt([recipient],
+                                        gpgme.ENCRYPT_ALWAYS_TRUST, 'first\n')
+                       for i in range(3)]
+            late = executor.encrypt([recipient], gpgme.ENCRYPT_ALWAYS_TRUST,
+                                    'late\n', priority=gpgme.PRIORITY_BULK,
+                                    deadline=0.001)
+            # jobs with a deadline go ahead of the others in their class
+            urgent = executor.encrypt([recipient],
+                                      gpgme.ENCRYPT_ALWAYS_TRUST, 'urgent\n',
+                                      deadline=60)
+            urgent.wait()
+            self.assertEqual(futures[2].done(), False)
+            for future in futures:
+                future.wait()
+            try:
+                late.wait()
+            except gpgme.GpgmeError, exc:
+                self.assertEqual(exc.code, gpgme.ERR_TIMEOUT)
+            else:
+                self.fail('gpgme.GpgmeError not raised')
+        stats = executor.queue_stats
+        self.assertEqual(stats[gpgme.PRIORITY_BULK]['expired'], 1)
+        self.assertEqual(stats[gpgme.PRIORITY_NORMAL]['expired'], 0)
+
+    def test_queue_limit(self):
+        ctx = gpgme.Context()
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        rejected = 0
+        with gpgme.Executor(1, queue_limits={gpgme.PRIORITY_BULK: 2}) \
+                as executor:
+            for i in range(10):
+                try:
+                    executor.encrypt([recipient], gpgme.ENCRYPT_ALWAYS_TRUST,
+                                     'bulk\n', priority=gpgme.PRIORITY_BULK)
+                except gpgme.GpgmeError, exc:
+                    self.assertEqual(exc.code, gpgme.ERR_RESOURCE_LIMIT)
+                    rejected += 1
+            # other classes aren't limited
+            for i in range(5):
+                executor.encrypt([recipient], gpgme.ENCRYPT_ALWAYS_TRUST,
+                                 'normal\n')
+        self.assertTrue(rejected > 0)
+        stats = executor.queue_stats
+        self.assertEqual(stats[gpgme.PRIORITY_BULK]['limit'], 2)
+        self.assertEqual(stats[gpgme.PRIORITY_BULK]['rejected'], rejected)
+        self.assertEqual(stats[gpgme.PRIORITY_BULK]['submitted'],
+                         10 - rejected)
+        self.assertEqual(stats[gpgme.PRIORITY_NORMAL]['rejected'], 0)
+
+    def test_reserved_workers(self):
+        ctx = gpgme.Context()
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        with gpgme.Executor(2, reserved=1) as executor:
+            bulk = [executor.encrypt([recipient], gpgme.ENCRYPT_ALWAYS_TRUST,
+                                     'bulk\n', priority=gpgme.PRIORITY_BULK)
+                    for i in range(4)]
+            interactive = executor.encrypt(
+                [recipient], gpgme.ENCRYPT_ALWAYS_TRUST, 'interactive\n',
+                priority=gpgme.PRIORITY_INTERACTIVE)
+            interactive.wait()
+            for future in bulk:
+                future.wait()
+        # the reserved worker only ran the interactive job
+        self.assertEqual(executor.stats[0]['completed'], 1)
+        self.assertEqual(executor.stats[1]['completed'], 4)
+        self.assertRaises(ValueError, gpgme.Executor, 1, reserved=1)
+
+    def test_homedir(self):
+        ctx = gpgme.Context()
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        ciphertext = ctx.encrypt_bytes([recipient],
+                                       gpgme.ENCRYPT_ALWAYS_TRUST,
+                                       'Hello World\n')
+        # the workers use a keyring without the secret key
+        homedir = tempfile.mkdtemp(prefix='tmp.gpghome')
+        try:
+            with gpgme.Executor(1, homedir=homedir) as executor:
+                self.assertRaises(gpgme.GpgmeError,
+                                  executor.decrypt(ciphertext).wait)
+        finally:
+            shutil.rmtree(homedir, ignore_errors=True)
+
+
+    def test_uninitialised(self):
+        executor = gpgme.Executor.__new__(gpgme.Executor)
+        self.assertRaises(ValueError, executor.decrypt, 'ciphertext')
+
+    def test_shutdown_at_exit(self):
+        # the workers finish their jobs before the interpreter goes away
+        script = (
+            'import gpgme\n'
+            'ctx = gpgme.Context()\n'
+            "key = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')\n"
+            'executor = gpgme.Executor(2)\n'
+            'for i in range(10):\n'
+            '    executor.encrypt([key], gpgme.ENCRYPT_ALWAYS_TRUST, "x")\n')
+        env = dict(os.environ, PYTHONPATH=os.pathsep.join(sys.path))
+        proc = subprocess.Popen([sys.executable, '-c', script], env=env,
+                                stderr=subprocess.PIPE)
+        stderr = proc.communicate()[1]
+        self.assertEqual(proc.returncode, 0, stderr)
+        self.assertEqual(stderr, '')
+
+
+def test_suite():
+    loader = unittest.TestLoader()
+    return loader.loadTestsFromName(__name__)
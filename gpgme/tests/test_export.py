@@ -53,6 +53,14 @@ class ExportTestCase(GpgHomeTestCase):
         self.assertTrue(keydata.getvalue().startswith(
             '-----BEGIN PGP PUBLIC KEY BLOCK-----\n'))
 
+    def test_export_bytes(self):
+        ctx = gpgme.Context()
+        ctx.armor = True
+        keydata = ctx.export_bytes('15E7CE9BF1771A4ABC550B31F540A569CB935A42')
+
+        self.assertTrue(keydata.startswith(
+            '-----BEGIN PGP PUBLIC KEY BLOCK-----\n'))
+
 
 def test_suite():
     loader = unittest.TestLoader()
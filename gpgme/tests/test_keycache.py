@@ -0,0 +1,149 @@
+# pygpgme - a Python wrapper for the gpgme library
+# Copyright (C) 2006  James Henstridge
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+import shutil
+import tempfile
+import unittest
+
+import gpgme
+import gpgme.editutil
+from gpgme.tests.util import GpgHomeTestCase
+
+key1 = 'E79A842DA34A1CA383F64A1546BB55F0885C65A4'
+key2 = '93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F'
+
+class KeyCacheTestCase(GpgHomeTestCase):
+
+    import_keys = ['key1.pub', 'key1.sec', 'key2.pub']
+
+    def make_context(self, cache):
+        ctx = gpgme.Context()
+        ctx.key_cache = cache
+        return ctx
+
+    def test_constructor(self):
+        cache = gpgme.KeyCache()
+        self.assertEqual(cache.size, 1024)
+        self.assertEqual(len(cache), 0)
+        self.assertEqual(gpgme.KeyCache(size=10).size, 10)
+        self.assertRaises(ValueError, gpgme.KeyCache, 0)
+
+        ctx = gpgme.Context()
+        self.assertEqual(ctx.key_cache, None)
+        ctx.key_cache = cache
+        self.assertEqual(ctx.key_cache, cache)
+        ctx.key_cache = None
+        self.assertEqual(ctx.key_cache, None)
+        self.assertRaises(TypeError, setattr, ctx, 'key_cache', {})
+
+    def test_get_key(self):
+        cache = gpgme.KeyCache()
+        ctx = self.make_context(cache)
+        self.assertEqual(ctx.get_key(key1).subkeys[0].fpr, key1)
+        self.assertEqual(ctx.get_key(key1.lower()).subkeys[0].fpr, key1)
+        self.assertEqual(len(cache), 1)
+        stats = cache.stats
+        self.assertEqual(stats['hits'], 1)
+        self.assertEqual(stats['misses'], 1)
+
+        # secret keys are cached separately
+        key = ctx.get_key(key1, True)
+        self.assertEqual(key.secret, True)
+        self.assertEqual(ctx.get_key(key1).secret, False)
+        self.assertEqual(len(cache), 2)
+        self.assertEqual(cache.stats['misses'], 2)
+
+        # missing keys aren't cached
+        self.assertRaises(gpgme.GpgmeError, ctx.get_key, key2, True)
+        self.assertEqual(len(cache), 2)
+
+    def test_keylist(self):
+        cache = gpgme.KeyCache()
+        ctx = self.make_context(cache)
+        self.assertEqual(len(list(ctx.keylist())), 2)
+        self.assertEqual(len(cache), 2)
+        ctx.get_key(key1)
+        ctx.get_key(key2)
+        self.assertEqual(cache.stats['hits'], 2)
+        self.assertEqual(cache.stats['misses'], 0)
+
+    def test_eviction(self):
+        cache = gpgme.KeyCache(1)
+        ctx = self.make_context(cache)
+        ctx.get_key(key1)
+        ctx.get_key(key2)
+        ctx.get_key(key1)
+        self.assertEqual(len(cache), 1)
+        stats = cache.stats
+        self.assertEqual(stats['misses'], 3)
+        self.assertEqual(stats['evictions'], 2)
+
+    def test_flush(self):
+        cache = gpgme.KeyCache()
+        ctx = self.make_context(cache)
+        ctx.get_key(key1)
+        cache.flush()
+        self.assertEqual(len(cache), 0)
+        self.assertEqual(cache.stats['flushes'], 1)
+
+    def test_invalidation(self):
+        cache = gpgme.KeyCache()
+        ctx = self.make_context(cache)
+        key = ctx.get_key(key2)
+        self.assertEqual(key.owner_trust, gpgme.VALIDITY_UNKNOWN)
+        gpgme.editutil.edit_trust(ctx, key, gpgme.VALIDITY_FULL)
+        self.assertEqual(len(cache), 0)
+        key = ctx.get_key(key2)
+        self.assertEqual(key.owner_trust, gpgme.VALIDITY_FULL)
+
+        ctx.delete(key)
+        self.assertEqual(len(cache), 0)
+        self.assertRaises(gpgme.GpgmeError, ctx.get_key, key2)
+
+        ctx.get_key(key1)
+        ctx.import_(self.keyfile('key2.pub'))
+        self.assertEqual(len(cache), 0)
+        self.assertEqual(ctx.get_key(key2).subkeys[0].fpr, key2)
+        self.assertEqual(cache.stats['flushes'], 3)
+
+    def test_shared(self):
+        cache = gpgme.KeyCache()
+        ctx1 = self.make_context(cache)
+        ctx2 = self.make_context(cache)
+        ctx1.get_key(key1)
+        ctx2.get_key(key1)
+        self.assertEqual(cache.stats['hits'], 1)
+
+        # a context using another keyring doesn't see the cached key
+        homedir = tempfile.mkdtemp(prefix='tmp.gpghome')
+        try:
+            ctx3 = self.make_context(cache)
+            ctx3.set_engine_info(gpgme.PROTOCOL_OpenPGP, None, homedir)
+            self.assertRaises(gpgme.GpgmeError, ctx3.get_key, key1)
+        finally:
+            shutil.rmtree(homedir, ignore_errors=True)
+
+        # changes made through one context flush the shared cache
+        ctx2.delete(ctx2.get_key(key2))
+        self.assertEqual(len(cache), 0)
+        self.assertRaises(gpgme.GpgmeError, ctx1.get_key, key2)
+
+
+def test_suite():
+    loader = unittest.TestLoader()
+    return loader.loadTestsFromName(__name__)
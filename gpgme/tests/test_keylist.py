@@ -64,6 +64,122 @@ class KeylistTestCase(GpgHomeTestCase):
                      for key in ctx.keylist(None, True))
         self.assertTrue(keyids, set(['46BB55F0885C65A4']))
 
+    def test_next_batch(self):
+        ctx = gpgme.Context()
+        keyiter = ctx.keylist()
+        batch = keyiter.next_batch(3)
+        self.assertEqual(len(batch), 3)
+        rest = keyiter.next_batch(10)
+        self.assertEqual(len(rest), 1)
+        self.assertEqual(keyiter.next_batch(10), [])
+        self.assertRaises(StopIteration, keyiter.next)
+        self.assertEqual(set(key.subkeys[0].keyid for key in batch + rest),
+                         set(['46BB55F0885C65A4',
+                              '2CF46B7FC97E6B0F',
+                              'F540A569CB935A42',
+                              '2EF658C987754368']))
+        self.assertRaises(ValueError, ctx.keylist().next_batch, 0)
+
+    def test_prefetch(self):
+        ctx = gpgme.Context()
+        keyids = set(key.subkeys[0].keyid
+                     for key in ctx.keylist(prefetch=2))
+        self.assertEqual(keyids, set(['46BB55F0885C65A4',
+                                      '2CF46B7FC97E6B0F',
+                                      'F540A569CB935A42',
+                                      '2EF658C987754368']))
+
+        keyiter = ctx.keylist(None, prefetch=1)
+        self.assertEqual(len(keyiter.next_batch(2)), 2)
+        self.assertEqual(len(keyiter.next_batch(2)), 2)
+        self.assertEqual(keyiter.next_batch(2), [])
+
+        # abandoning the iterator stops the helper thread
+        keyiter = ctx.keylist(prefetch=1)
+        keyiter.next()
+        del keyiter
+        self.assertEqual(len(list(ctx.keylist(None, True))), 1)
+        self.assertRaises(ValueError, ctx.keylist, prefetch=-1)
+
+    def test_get_keys(self):
+        ctx = gpgme.Context()
+        fprs = ['E79A842DA34A1CA383F64A1546BB55F0885C65A4',
+                '93c2240d6b8aa10ab28f701d2cf46b7fc97e6b0f',
+                '0x2EF658C987754368',
+                '0000000000000000000000000000000000000000']
+        keys, missing = ctx.get_keys(fprs)
+        self.assertEqual(sorted(keys.keys()), sorted(fprs[:3]))
+        self.assertEqual(keys[fprs[0]].subkeys[0].keyid, '46BB55F0885C65A4')
+        self.assertEqual(keys[fprs[1]].subkeys[0].keyid, '2CF46B7FC97E6B0F')
+        self.assertEqual(keys[fprs[2]].subkeys[0].keyid, '2EF658C987754368')
+        self.assertEqual(missing, [fprs[3]])
+
+        keys, missing = ctx.get_keys(fprs[:2], True)
+        self.assertEqual(keys.keys(), [fprs[0]])
+        self.assertEqual(keys[fprs[0]].secret, True)
+        self.assertEqual(missing, [fprs[1]])
+
+        self.assertEqual(ctx.get_keys([]), ({}, []))
+        self.assertRaises(TypeError, ctx.get_keys, [42])
+
+    def test_get_keys_cached(self):
+        cache = gpgme.KeyCache()
+        ctx = gpgme.Context()
+        ctx.key_cache = cache
+        ctx.get_key('E79A842DA34A1CA383F64A1546BB55F0885C65A4')
+        keys, missing = ctx.get_keys([
+            'E79A842DA34A1CA383F64A1546BB55F0885C65A4',
+            '93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F'])
+        self.assertEqual(len(keys), 2)
+        self.assertEqual(missing, [])
+        self.assertEqual(cache.stats['hits'], 1)
+        self.assertEqual(len(cache), 2)
+
+    def test_keylist_table(self):
+        ctx = gpgme.Context()
+        keys = list(ctx.keylist())
+        table = ctx.keylist_table(
+            fields=['fpr', 'uid', 'timestamp', 'expires', 'algo', 'flags'])
+        self.assertEqual(sorted(table.keys()),
+                         ['algo', 'expires', 'flags', 'fpr', 'timestamp',
+                          'uid'])
+        fprs, offsets = table['fpr']
+        uids, uid_offsets = table['uid']
+        self.assertEqual(len(offsets), len(keys) + 1)
+        self.assertEqual(offsets[0], 0)
+        self.assertEqual(offsets[-1], len(fprs))
+        self.assertEqual(table['timestamp'].typecode, 'l')
+        self.assertEqual(table['algo'].typecode, 'H')
+        self.assertEqual(table['flags'].typecode, 'B')
+        for i, key in enumerate(keys):
+            self.assertEqual(fprs[offsets[i]:offsets[i+1]],
+                             key.subkeys[0].fpr)
+            self.assertEqual(uids[uid_offsets[i]:uid_offsets[i+1]],
+                             key.uids[0].uid)
+            self.assertEqual(table['timestamp'][i], key.subkeys[0].timestamp)
+            self.assertEqual(table['expires'][i], key.subkeys[0].expires)
+            self.assertEqual(table['algo'][i], key.subkeys[0].pubkey_algo)
+            self.assertEqual(bool(table['flags'][i] & gpgme.KEY_FLAG_REVOKED),
+                             key.revoked)
+            self.assertEqual(
+                bool(table['flags'][i] & gpgme.KEY_FLAG_CAN_ENCRYPT),
+                key.can_encrypt)
+
+    def test_keylist_table_pattern(self):
+        ctx = gpgme.Context()
+        table = ctx.keylist_table('key1@example.org', ['keyid', 'flags'])
+        self.assertEqual(table['keyid'][0], '46BB55F0885C65A4')
+        table = ctx.keylist_table(None, ['keyid', 'flags'], True)
+        self.assertEqual(table['keyid'][0], '46BB55F0885C65A4')
+        self.assertTrue(table['flags'][0] & gpgme.KEY_FLAG_SECRET)
+        table = ctx.keylist_table(['key1@example.org',
+                                   'signonly@example.com'])
+        self.assertEqual(sorted(table.keys()),
+                         ['algo', 'expires', 'flags', 'fpr', 'timestamp'])
+        self.assertEqual(len(table['timestamp']), 2)
+        self.assertRaises(ValueError, ctx.keylist_table, fields=['bogus'])
+        self.assertRaises(TypeError, ctx.keylist_table, fields=[42])
+
 
 def test_suite():
     loader = unittest.TestLoader()
@@ -0,0 +1,204 @@
+# pygpgme - a Python wrapper for the gpgme library
+# Copyright (C) 2006  James Henstridge
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+import select
+import unittest
+import StringIO
+
+import gpgme
+from gpgme.tests.util import GpgHomeTestCase
+
+
+class SelectLoop(object):
+    """A minimal event loop with the io_handler interface."""
+
+    def __init__(self):
+        self.readers = {}
+        self.writers = {}
+
+    def add_reader(self, fd, callback):
+        self.readers[fd] = callback
+
+    def add_writer(self, fd, callback):
+        self.writers[fd] = callback
+
+    def remove_reader(self, fd):
+        del self.readers[fd]
+
+    def remove_writer(self, fd):
+        del self.writers[fd]
+
+    def run_until_done(self, *ops):
+        while not all(op.done() for op in ops):
+            assert self.readers or self.writers, 'nothing to wait for'
+            readable, writable, _ = select.select(
+                list(self.readers), list(self.writers), [])
+            for fd in readable:
+                if fd in self.readers:
+                    self.readers[fd]()
+            for fd in writable:
+                if fd in self.writers:
+                    self.writers[fd]()
+
+
+class OperationTestCase(GpgHomeTestCase):
+
+    import_keys = ['key1.pub', 'key1.sec', 'key2.pub', 'key2.sec']
+
+    def test_wait(self):
+        ctx = gpgme.Context()
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        ciphertext = StringIO.StringIO()
+        op = ctx.encrypt_start([recipient], gpgme.ENCRYPT_ALWAYS_TRUST,
+                               'Hello World\n', ciphertext)
+        self.assertEqual(op.context, ctx)
+        self.assertEqual(op.wait(), None)
+        self.assertTrue(op.done())
+
+        plaintext = StringIO.StringIO()
+        op = ctx.decrypt_start(ciphertext.getvalue(), plaintext)
+        op.wait()
+        self.assertEqual(plaintext.getvalue(), 'Hello World\n')
+
+    def test_io_handler(self):
+        loop = SelectLoop()
+        ctx = gpgme.Context()
+        ctx.io_handler = loop
+        self.assertEqual(ctx.io_handler, loop)
+        ctx.signers = [ctx.get_key('E79A842DA34A1CA383F64A1546BB55F0885C65A4')]
+
+        finished = []
+        signature = StringIO.StringIO()
+        op = ctx.sign_start('Hello World\n', signature,
+                            gpgme.SIG_MODE_DETACH)
+        op.add_done_callback(finished.append)
+        self.assertRaises(ValueError, op.result)
+        self.assertRaises(ValueError, op.wait)
+        loop.run_until_done(op)
+        self.assertEqual(finished, [op])
+        self.assertEqual(len(op.result()), 1)
+        self.assertEqual(loop.readers, {})
+        self.assertEqual(loop.writers, {})
+
+        op = ctx.verify_start(signature.getvalue(), 'Hello World\n', None)
+        loop.run_until_done(op)
+        sigs = op.result()
+        self.assertEqual(len(sigs), 1)
+        self.assertEqual(sigs[0].fpr,
+                         'E79A842DA34A1CA383F64A1546BB55F0885C65A4')
+
+    def test_io_handler_many_contexts(self):
+        loop = SelectLoop()
+        ops = []
+        outputs = []
+        for i in range(4):
+            ctx = gpgme.Context()
+            ctx.io_handler = loop
+            recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+            output = StringIO.StringIO()
+            ops.append(ctx.encrypt_start([recipient],
+                                         gpgme.ENCRYPT_ALWAYS_TRUST,
+                                         'message %d\n' % i, output))
+            outputs.append(output)
+        loop.run_until_done(*ops)
+
+        ctx = gpgme.Context()
+        for i, output in enumerate(outputs):
+            self.assertEqual(ctx.decrypt_bytes(output.getvalue()),
+                             'message %d\n' % i)
+
+    def test_keylist(self):
+        loop = SelectLoop()
+        ctx = gpgme.Context()
+        ctx.io_handler = loop
+        op = ctx.keylist_start('key1@example.org')
+        loop.run_until_done(op)
+        keys = op.result()
+        self.assertEqual([key.subkeys[0].keyid for key in keys],
+                         ['46BB55F0885C65A4'])
+
+        ctx.io_handler = None
+        op = ctx.keylist_start('key1@example.org')
+        self.assertEqual(len(op.wait()), 1)
+
+    def test_error(self):
+        loop = SelectLoop()
+        ctx = gpgme.Context()
+        ctx.io_handler = loop
+        op = ctx.decrypt_start('not an OpenPGP message', StringIO.StringIO())
+        loop.run_until_done(op)
+        self.assertRaises(gpgme.GpgmeError, op.result)
+
+    def test_multiplexer(self):
+        mux = gpgme.Multiplexer()
+        self.assertEqual(len(mux), 0)
+        self.assertEqual(mux.wait(), None)
+
+        outputs = {}
+        for i in range(4):
+            ctx = gpgme.Context()
+            recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+            output = StringIO.StringIO()
+            op = ctx.encrypt_start([recipient], gpgme.ENCRYPT_ALWAYS_TRUST,
+                                   'message %d\n' % i, output)
+            mux.add(op)
+            outputs[op] = (i, output)
+        self.assertRaises(ValueError, mux.add, op)
+        self.assertEqual(len(mux), 4)
+
+        finished = list(mux)
+        self.assertEqual(len(mux), 0)
+        self.assertEqual(sorted(finished), sorted(outputs))
+        ctx = gpgme.Context()
+        for op in finished:
+            self.assertEqual(op.result(), None)
+            i, output = outputs[op]
+            self.assertEqual(ctx.decrypt_bytes(output.getvalue()),
+                             'message %d\n' % i)
+
+    def test_multiplexer_keylist(self):
+        mux = gpgme.Multiplexer()
+        ctx = gpgme.Context()
+        mux.add(ctx.keylist_start('key1@example.org'))
+        op = mux.wait()
+        self.assertEqual([key.subkeys[0].keyid for key in op.result()],
+                         ['46BB55F0885C65A4'])
+
+    def test_multiplexer_io_handler(self):
+        mux = gpgme.Multiplexer()
+        ctx = gpgme.Context()
+        ctx.io_handler = SelectLoop()
+        op = ctx.keylist_start()
+        self.assertRaises(ValueError, mux.add, op)
+        ctx.io_handler.run_until_done(op)
+
+    def test_one_operation_at_a_time(self):
+        ctx = gpgme.Context()
+        op = ctx.keylist_start()
+        self.assertRaises(ValueError, ctx.keylist_start)
+
+        def set_io_handler(ctx, value):
+            ctx.io_handler = value
+        self.assertRaises(ValueError, set_io_handler, ctx, SelectLoop())
+        op.wait()
+        ctx.keylist_start().wait()
+
+
+def test_suite():
+    loader = unittest.TestLoader()
+    return loader.loadTestsFromName(__name__)
@@ -0,0 +1,113 @@
+# pygpgme - a Python wrapper for the gpgme library
+# Copyright (C) 2006  James Henstridge
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+import unittest
+import StringIO
+
+import gpgme
+from gpgme.tests.util import GpgHomeTestCase
+
+KEY1 = 'E79A842DA34A1CA383F64A1546BB55F0885C65A4'
+KEY2 = '93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F'
+SIGNONLY = '15E7CE9BF1771A4ABC550B31F540A569CB935A42'
+REVOKED = 'B6525A39EB81F88B4D2CFB3E2EF658C987754368'
+
+class RecipientSetTestCase(GpgHomeTestCase):
+
+    import_keys = ['key1.pub', 'key1.sec', 'key2.pub', 'key2.sec',
+                   'signonly.pub', 'revoked.pub']
+
+    def test_from_keys(self):
+        ctx = gpgme.Context()
+        keys = [ctx.get_key(KEY1), ctx.get_key(KEY2)]
+        recipients = gpgme.RecipientSet(keys)
+        self.assertEqual(len(recipients), 2)
+        self.assertEqual(recipients.fingerprints, [KEY1, KEY2])
+        self.assertEqual(recipients[1].subkeys[0].fpr, KEY2)
+        self.assertEqual([key.subkeys[0].fpr for key in recipients],
+                         [KEY1, KEY2])
+
+    def test_from_fingerprints(self):
+        ctx = gpgme.Context()
+        recipients = gpgme.RecipientSet([KEY2, ctx.get_key(KEY1), KEY2],
+                                        ctx=ctx)
+        # duplicates are only included once
+        self.assertEqual(recipients.fingerprints, [KEY2, KEY1])
+
+        recipients = gpgme.RecipientSet([KEY1])
+        self.assertEqual(recipients.fingerprints, [KEY1])
+
+    def test_unusable_keys(self):
+        try:
+            gpgme.RecipientSet([KEY1, SIGNONLY, REVOKED])
+        except gpgme.GpgmeError, exc:
+            self.assertEqual(exc.code, gpgme.ERR_UNUSABLE_PUBKEY)
+            invalid = dict(exc.invalid_recipients)
+            self.assertEqual(sorted(invalid.keys()), [SIGNONLY, REVOKED])
+            self.assertEqual(invalid[SIGNONLY].code,
+                             gpgme.ERR_WRONG_KEY_USAGE)
+            self.assertEqual(invalid[REVOKED].code, gpgme.ERR_CERT_REVOKED)
+        else:
+            self.fail('gpgme.GpgmeError not raised')
+
+        self.assertRaises(TypeError, gpgme.RecipientSet, [42])
+        self.assertRaises(gpgme.GpgmeError, gpgme.RecipientSet,
+                          ['0000000000000000000000000000000000000000'])
+
+    def test_immutable(self):
+        recipients = gpgme.RecipientSet([KEY1])
+        self.assertRaises(ValueError, recipients.__init__, [KEY2])
+        self.assertEqual(recipients.fingerprints, [KEY1])
+
+    def test_encrypt(self):
+        ctx = gpgme.Context()
+        recipients = gpgme.RecipientSet([KEY1, KEY2])
+
+        ciphertext = StringIO.StringIO()
+        ctx.encrypt(recipients, gpgme.ENCRYPT_ALWAYS_TRUST,
+                    StringIO.StringIO('Hello World\n'), ciphertext)
+        self.assertEqual(ctx.decrypt_bytes(ciphertext.getvalue()),
+                         'Hello World\n')
+
+        ciphertext = ctx.encrypt_bytes(recipients,
+                                       gpgme.ENCRYPT_ALWAYS_TRUST, 'Hello\n')
+        self.assertEqual(ctx.decrypt_bytes(ciphertext), 'Hello\n')
+
+        results = ctx.encrypt_many([(recipients, 'message %d\n' % i)
+                                    for i in range(3)],
+                                   gpgme.ENCRYPT_ALWAYS_TRUST)
+        for i, ciphertext in enumerate(results):
+            self.assertEqual(ctx.decrypt_bytes(ciphertext),
+                             'message %d\n' % i)
+
+        with gpgme.Executor(2) as executor:
+            ciphertext = executor.encrypt(recipients,
+                                          gpgme.ENCRYPT_ALWAYS_TRUST,
+                                          'Hello\n').wait()
+        self.assertEqual(ctx.decrypt_bytes(ciphertext), 'Hello\n')
+
+    def test_uninitialised(self):
+        ctx = gpgme.Context()
+        recipients = gpgme.RecipientSet.__new__(gpgme.RecipientSet)
+        self.assertEqual(len(recipients), 0)
+        self.assertRaises(ValueError, ctx.encrypt_bytes, recipients,
+                          gpgme.ENCRYPT_ALWAYS_TRUST, 'Hello\n')
+
+
+def test_suite():
+    loader = unittest.TestLoader()
+    return loader.loadTestsFromName(__name__)
@@ -15,6 +15,8 @@
 # License along with this library; if not, write to the Free Software
 # Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
+import os
+import tempfile
 import unittest
 import StringIO
 from textwrap import dedent
@@ -81,6 +83,26 @@ class SignVerifyTestCase(GpgHomeTestCase):
         self.assertEqual(sigs[0].validity, gpgme.VALIDITY_UNKNOWN)
         self.assertEqual(sigs[0].validity_reason, None)
 
+    def test_verify_detached_from_buffers(self):
+        signature = dedent('''
+            -----BEGIN PGP SIGNATURE-----
+            Version: GnuPG v1.4.1 (GNU/Linux)
+
+            iD8DBQBDz7ReRrtV8IhcZaQRAtuUAJwMiJeS5QPohToxA3+vp+z5c3jr1wCdHhGP
+            hhSTiguzgSYNwKSuV6SLGOM=
+            =dyZS
+            -----END PGP SIGNATURE-----
+            ''')
+        signed_text = bytearray('Hello World\n')
+        ctx = gpgme.Context()
+        sigs = ctx.verify(signature, signed_text, None)
+
+        self.assertEqual(len(sigs), 1)
+        self.assertEqual(sigs[0].summary, 0)
+        self.assertEqual(sigs[0].fpr,
+                         'E79A842DA34A1CA383F64A1546BB55F0885C65A4')
+        self.assertEqual(sigs[0].timestamp, 1137685598)
+
     def test_verify_clearsign(self):
         signature = StringIO.StringIO(dedent('''
             -----BEGIN PGP SIGNED MESSAGE-----
@@ -379,6 +401,124 @@ class SignVerifyTestCase(GpgHomeTestCase):
         self.assertEqual(sigs[0].validity, gpgme.VALIDITY_UNKNOWN)
         self.assertEqual(sigs[0].validity_reason, None)
 
+    def test_sign_bytes(self):
+        ctx = gpgme.Context()
+        ctx.armor = True
+        key = ctx.get_key('E79A842DA34A1CA383F64A1546BB55F0885C65A4')
+        ctx.signers = [key]
+
+        signature = ctx.sign_bytes('Hello World\n', gpgme.SIG_MODE_DETACH)
+        self.assertTrue(signature.startswith(
+            '-----BEGIN PGP SIGNATURE-----\n'))
+        sigs = ctx.verify(signature, 'Hello World\n', None)
+        self.assertEqual(len(sigs), 1)
+        self.assertEqual(sigs[0].summary, 0)
+        self.assertEqual(sigs[0].fpr,
+                         'E79A842DA34A1CA383F64A1546BB55F0885C65A4')
+
+    def test_sign_verify_mapped_file(self):
+        ctx = gpgme.Context()
+        key = ctx.get_key('E79A842DA34A1CA383F64A1546BB55F0885C65A4')
+        ctx.signers = [key]
+        fd, filename = tempfile.mkstemp()
+        try:
+            os.write(fd, 'Hello World\n' * 1000)
+            os.close(fd)
+
+            signed_text = gpgme.MappedFile(filename)
+            self.assertEqual(signed_text.mapped, True)
+            self.assertEqual(signed_text.size, 12000)
+            signature = StringIO.StringIO()
+            new_sigs = ctx.sign(signed_text, signature, gpgme.SIG_MODE_DETACH)
+            self.assertEqual(len(new_sigs), 1)
+
+            sigs = ctx.verify(signature.getvalue(),
+                              gpgme.MappedFile(open(filename, 'rb')), None)
+            self.assertEqual(len(sigs), 1)
+            self.assertEqual(sigs[0].summary, 0)
+            self.assertEqual(sigs[0].fpr,
+                             'E79A842DA34A1CA383F64A1546BB55F0885C65A4')
+        finally:
+            os.unlink(filename)
+
+    def test_sign_mapped_pipe(self):
+        ctx = gpgme.Context()
+        key = ctx.get_key('E79A842DA34A1CA383F64A1546BB55F0885C65A4')
+        ctx.signers = [key]
+        read_fd, write_fd = os.pipe()
+        os.write(write_fd, 'Hello World\n')
+        os.close(write_fd)
+        try:
+            # pipes can't be mapped, so are streamed instead
+            plaintext = gpgme.MappedFile(read_fd)
+            self.assertEqual(plaintext.mapped, False)
+            self.assertEqual(plaintext.size, None)
+            signature = StringIO.StringIO()
+            ctx.sign(plaintext, signature, gpgme.SIG_MODE_NORMAL)
+        finally:
+            os.close(read_fd)
+
+        plaintext = StringIO.StringIO()
+        sigs = ctx.verify(signature.getvalue(), None, plaintext)
+        self.assertEqual(plaintext.getvalue(), 'Hello World\n')
+        self.assertEqual(len(sigs), 1)
+
+    def test_mapped_file_uninitialised(self):
+        # descriptor 0 is left open by objects that were never set up
+        self.assertRaises(TypeError, gpgme.MappedFile)
+        gpgme.MappedFile.__new__(gpgme.MappedFile)
+        os.fstat(0)
+
+    def test_verify_many(self):
+        detached = dedent('''
+            -----BEGIN PGP SIGNATURE-----
+            Version: GnuPG v1.4.1 (GNU/Linux)
+
+            iD8DBQBDz7ReRrtV8IhcZaQRAtuUAJwMiJeS5QPohToxA3+vp+z5c3jr1wCdHhGP
+            hhSTiguzgSYNwKSuV6SLGOM=
+            =dyZS
+            -----END PGP SIGNATURE-----
+            ''')
+        normal = dedent('''
+            -----BEGIN PGP MESSAGE-----
+            Version: GnuPG v1.4.1 (GNU/Linux)
+
+            owGbwMvMwCTotjv0Q0dM6hLG00JJDM7nNx31SM3JyVcIzy/KSeHqsGdmBQvCVAky
+            pR9hmGfw0qo3bfpWZwun5euYAsUcVkyZMJlhfvkU6UBjD8WF9RfeND05zC/TK+H+
+            EQA=
+            =HCW0
+            -----END PGP MESSAGE-----
+            ''')
+        ctx = gpgme.Context()
+        results = ctx.verify_many([(detached, 'Hello World\n'),
+                                   ('not a signature', None),
+                                   (normal, None),
+                                   (detached, 'Goodbye World\n')])
+        self.assertEqual(len(results), 4)
+
+        plaintext, sigs = results[0]
+        self.assertEqual(plaintext, None)
+        self.assertEqual(sigs, [('E79A842DA34A1CA383F64A1546BB55F0885C65A4',
+                                 0, 0, 1137685598, gpgme.VALIDITY_UNKNOWN)])
+
+        # a failed item doesn't stop the rest of the batch
+        self.assertTrue(isinstance(results[1], gpgme.GpgmeError))
+        self.assertEqual(results[1].code, gpgme.ERR_NO_DATA)
+
+        plaintext, sigs = results[2]
+        self.assertEqual(plaintext, 'Hello World\n')
+        self.assertEqual(sigs, [('E79A842DA34A1CA383F64A1546BB55F0885C65A4',
+                                 0, 0, 1137685189, gpgme.VALIDITY_UNKNOWN)])
+
+        plaintext, sigs = results[3]
+        self.assertEqual(len(sigs), 1)
+        self.assertEqual(sigs[0][1], gpgme.SIGSUM_RED)
+        self.assertEqual(sigs[0][2], gpgme.ERR_BAD_SIGNATURE)
+
+        self.assertRaises(TypeError, ctx.verify_many, [detached])
+        self.assertRaises(TypeError, ctx.verify_many,
+                          [(StringIO.StringIO(detached), None)])
+
 def test_suite():
     loader = unittest.TestLoader()
     return loader.loadTestsFromName(__name__)
@@ -0,0 +1,166 @@
+# pygpgme - a Python wrapper for the gpgme library
+# Copyright (C) 2006  James Henstridge
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+import threading
+import time
+import unittest
+import weakref
+
+import gpgme
+from gpgme.tests.util import GpgHomeTestCase
+
+class ThreadsTestCase(GpgHomeTestCase):
+
+    import_keys = ['key1.pub', 'key1.sec', 'key2.pub', 'key2.sec']
+
+    def run_threads(self, func, count=4):
+        errors = []
+        def run(i):
+            try:
+                func(i)
+            except Exception, exc:
+                errors.append(exc)
+        threads = [threading.Thread(target=run, args=(i,))
+                   for i in range(count)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        self.assertEqual(errors, [])
+
+    def test_shared_context(self):
+        ctx = gpgme.Context()
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        def work(i):
+            for j in range(5):
+                plaintext = 'message %d.%d\n' % (i, j)
+                ciphertext = ctx.encrypt_bytes(
+                    [recipient], gpgme.ENCRYPT_ALWAYS_TRUST, plaintext)
+                self.assertEqual(ctx.decrypt_bytes(ciphertext), plaintext)
+        self.run_threads(work)
+
+    def test_shared_keylist(self):
+        ctx = gpgme.Context()
+        def work(i):
+            for j in range(3):
+                fprs = set(key.subkeys[0].fpr for key in ctx.keylist())
+                self.assertEqual(fprs, set([
+                    'E79A842DA34A1CA383F64A1546BB55F0885C65A4',
+                    '93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F']))
+        self.run_threads(work)
+
+    def test_same_thread(self):
+        # the thread holding the context can still use it
+        ctx = gpgme.Context()
+        for key in ctx.keylist():
+            ctx.armor = True
+            self.assertEqual(ctx.get_key(key.subkeys[0].fpr).subkeys[0].fpr,
+                             key.subkeys[0].fpr)
+        # an abandoned iterator lets the context go
+        iterator = ctx.keylist()
+        iterator.next()
+        del iterator
+        self.run_threads(lambda i: list(ctx.keylist()), count=1)
+
+    def test_iterator_other_thread(self):
+        # an iterator can be used from a thread other than the one that
+        # started it
+        ctx = gpgme.Context()
+        iterator = ctx.keylist()
+        fprs = []
+        self.run_threads(
+            lambda i: fprs.extend(key.subkeys[0].fpr for key in iterator),
+            count=1)
+        self.assertEqual(set(fprs), set([
+            'E79A842DA34A1CA383F64A1546BB55F0885C65A4',
+            '93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F']))
+        self.assertEqual(len(list(ctx.keylist())), 2)
+
+    def test_busy_in_helper_thread(self):
+        # while gpgme may be running in a helper thread, the thread that
+        # started it can't use the context
+        ctx = gpgme.Context()
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        iterator = ctx.keylist(prefetch=1)
+        iterator.next()
+        self.assertRaises(ValueError, ctx.encrypt_bytes, [recipient],
+                          gpgme.ENCRYPT_ALWAYS_TRUST, 'Hello World\n')
+        list(iterator)
+
+        stream = ctx.encrypt_iter([recipient], gpgme.ENCRYPT_ALWAYS_TRUST,
+                                  ['Hello World\n'])
+        self.assertRaises(ValueError, ctx.sign_bytes, 'Hello World\n',
+                          gpgme.SIG_MODE_DETACH)
+        ciphertext = ''.join(stream)
+        self.assertEqual(ctx.decrypt_bytes(ciphertext), 'Hello World\n')
+
+    def test_affinity(self):
+        self.assertEqual(gpgme.Context().affinity, False)
+        ctx = gpgme.Context(affinity=True)
+        self.assertEqual(ctx.affinity, True)
+        ctx.armor = True
+        recipient = ctx.get_key('93C2240D6B8AA10AB28F701D2CF46B7FC97E6B0F')
+        def work(i):
+            child = ctx.encrypt_bytes.__self__
+            self.assertNotEqual(child, ctx)
+            self.assertEqual(child.armor, True)
+            ciphertext = ctx.encrypt_bytes(
+                [recipient], gpgme.ENCRYPT_ALWAYS_TRUST, 'Hello World\n')
+            self.assertTrue(
+                ciphertext.startswith('-----BEGIN PGP MESSAGE-----'))
+            self.assertEqual(ctx.decrypt_bytes(ciphertext), 'Hello World\n')
+        self.run_threads(work)
+
+        # later changes reach the thread's context too
+        child = ctx.encrypt_bytes.__self__
+        self.assertEqual(ctx.encrypt_bytes.__self__, child)
+        ctx.armor = False
+        ctx.collect_stats = True
+        ciphertext = ctx.encrypt_bytes([recipient], gpgme.ENCRYPT_ALWAYS_TRUST,
+                                       'Hello World\n')
+        self.assertFalse(ciphertext.startswith('-----BEGIN'))
+        self.assertEqual(child.armor, False)
+        self.assertEqual(ctx.last_op_stats['operation'], 'encrypt')
+        self.assertEqual(ctx.cancel(), False)
+
+    def test_affinity_io_handler(self):
+        ctx = gpgme.Context(affinity=True)
+        handler = object()
+        ctx.io_handler = handler
+        self.assertTrue(ctx.encrypt_bytes.__self__.io_handler is handler)
+        ctx.io_handler = None
+        self.assertEqual(ctx.encrypt_bytes.__self__.io_handler, None)
+
+    def test_affinity_thread_exit(self):
+        # each thread's context is freed once the thread has exited
+        ctx = gpgme.Context(affinity=True)
+        refs = []
+        self.run_threads(
+            lambda i: refs.append(weakref.ref(ctx.encrypt_bytes.__self__)))
+        self.assertEqual(len(refs), 4)
+        for i in range(50):
+            if all(ref() is None for ref in refs):
+                break
+            time.sleep(0.1)
+        self.assertEqual([ref() for ref in refs], [None] * 4)
+        self.assertEqual(ctx.cancel(), False)
+
+
+def test_suite():
+    loader = unittest.TestLoader()
+    return loader.loadTestsFromName(__name__)
@@ -0,0 +1,187 @@
+# pygpgme - a Python wrapper for the gpgme library
+# Copyright (C) 2006  James Henstridge
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+import unittest
+import os
+import signal
+import threading
+import time
+import StringIO
+
+import gpgme
+from gpgme.tests.util import GpgHomeTestCase
+
+class TimeoutTestCase(GpgHomeTestCase):
+
+    import_keys = ['passphrase.pub', 'passphrase.sec']
+
+    def slow_passphrase_cb(self, uid_hint, passphrase_info, prev_was_bad, fd):
+        # stands in for a stuck pinentry
+        time.sleep(1.5)
+        os.write(fd, 'test\n')
+
+    def make_context(self):
+        ctx = gpgme.Context()
+        key = ctx.get_key('EFB052B4230BBBC51914BCBB54DCBBC8DBFB9EB3')
+        ctx.signers = [key]
+        ctx.passphrase_cb = self.slow_passphrase_cb
+        return ctx
+
+    def assertRaisesCode(self, code, func, *args):
+        try:
+            func(*args)
+        except gpgme.GpgmeError, exc:
+            self.assertEqual(exc.code, code)
+        else:
+            self.fail('gpgme.GpgmeError not raised')
+
+    def test_timeout_attribute(self):
+        ctx = gpgme.Context()
+        self.assertEqual(ctx.timeout, None)
+        ctx.timeout = 2.5
+        self.assertEqual(ctx.timeout, 2.5)
+        ctx.timeout = None
+        self.assertEqual(ctx.timeout, None)
+        self.assertRaises(ValueError, setattr, ctx, 'timeout', -1)
+
+    def test_catch_signals_attribute(self):
+        ctx = gpgme.Context()
+        self.assertEqual(ctx.catch_signals, False)
+        ctx.catch_signals = True
+        self.assertEqual(ctx.catch_signals, True)
+
+    def test_signal_handler_changed_during_operation(self):
+        # a handler installed while the operation runs is kept
+        def passphrase_cb(uid_hint, passphrase_info, prev_was_bad, fd):
+            signal.signal(signal.SIGINT, signal.SIG_IGN)
+            os.write(fd, 'test\n')
+
+        old_handler = signal.getsignal(signal.SIGINT)
+        try:
+            ctx = self.make_context()
+            ctx.catch_signals = True
+            ctx.passphrase_cb = passphrase_cb
+            ctx.sign(StringIO.StringIO('Hello World\n'), StringIO.StringIO(),
+                     gpgme.SIG_MODE_CLEAR)
+            os.kill(os.getpid(), signal.SIGINT)
+            time.sleep(0.1)
+        finally:
+            signal.signal(signal.SIGINT, old_handler)
+
+    def test_context_timeout(self):
+        ctx = self.make_context()
+        ctx.timeout = 0.2
+        self.assertRaisesCode(gpgme.ERR_TIMEOUT, ctx.sign,
+                              StringIO.StringIO('Hello World\n'),
+                              StringIO.StringIO(), gpgme.SIG_MODE_CLEAR)
+
+        # the next operation gets a new deadline
+        ctx.timeout = 30
+        ctx.passphrase_cb = lambda hint, info, prev_was_bad, fd: \
+            os.write(fd, 'test\n')
+        signature = StringIO.StringIO()
+        ctx.sign(StringIO.StringIO('Hello World\n'), signature,
+                 gpgme.SIG_MODE_CLEAR)
+        self.assertTrue(signature.getvalue())
+
+    def test_call_timeout(self):
+        ctx = self.make_context()
+        self.assertRaisesCode(gpgme.ERR_TIMEOUT, ctx.sign,
+                              StringIO.StringIO('Hello World\n'),
+                              StringIO.StringIO(), gpgme.SIG_MODE_CLEAR,
+                              timeout=0.2)
+        # the context's own timeout is untouched
+        self.assertEqual(ctx.timeout, None)
+
+        ctx.timeout = 0.2
+        ctx.passphrase_cb = self.slow_passphrase_cb
+        signature = StringIO.StringIO()
+        ctx.sign(StringIO.StringIO('Hello World\n'), signature,
+                 gpgme.SIG_MODE_CLEAR, timeout=None)
+        self.assertTrue(signature.getvalue())
+        self.assertEqual(ctx.timeout, 0.2)
+
+        self.assertRaises(ValueError, ctx.get_key,
+                          'EFB052B4230BBBC51914BCBB54DCBBC8DBFB9EB3',
+                          timeout=-1)
+        self.assertRaises(TypeError, ctx.get_key,
+                          'EFB052B4230BBBC51914BCBB54DCBBC8DBFB9EB3',
+                          colour=True)
+        key = ctx.get_key('EFB052B4230BBBC51914BCBB54DCBBC8DBFB9EB3',
+                          timeout=30)
+        self.assertEqual(key.subkeys[0].fpr,
+                         'EFB052B4230BBBC51914BCBB54DCBBC8DBFB9EB3')
+
+    def test_stream_timeout(self):
+        # the stream's operation runs in a helper thread, but its timeout
+        # is still reported to the thread reading the output
+        def chunks():
+            time.sleep(1.5)
+            yield 'Hello World\n'
+
+        ctx = gpgme.Context()
+        ctx.timeout = 0.2
+        recipient = ctx.get_key('EFB052B4230BBBC51914BCBB54DCBBC8DBFB9EB3')
+        output = ctx.encrypt_iter([recipient], gpgme.ENCRYPT_ALWAYS_TRUST,
+                                  chunks())
+        self.assertRaisesCode(gpgme.ERR_TIMEOUT, list, output)
+
+    def test_keylist_stats(self):
+        ctx = gpgme.Context()
+        ctx.collect_stats = True
+        list(ctx.keylist())
+        self.assertEqual(ctx.last_op_stats['operation'], 'keylist_next')
+        ctx.get_key('EFB052B4230BBBC51914BCBB54DCBBC8DBFB9EB3')
+        self.assertEqual(ctx.last_op_stats['operation'], 'get_key')
+
+    def test_wait_timeout(self):
+        ctx = self.make_context()
+        op = ctx.sign_start('Hello World\n', StringIO.StringIO(),
+                            gpgme.SIG_MODE_CLEAR)
+        self.assertRaisesCode(gpgme.ERR_TIMEOUT, op.wait, 0.2)
+        self.assertEqual(op.done(), True)
+        self.assertRaisesCode(gpgme.ERR_TIMEOUT, op.result)
+
+    def test_cancel(self):
+        ctx = self.make_context()
+        self.assertEqual(ctx.cancel(), False)
+
+        cancelled = []
+        def cancel():
+            time.sleep(0.2)
+            cancelled.append(ctx.cancel())
+        thread = threading.Thread(target=cancel)
+        thread.start()
+        try:
+            self.assertRaisesCode(gpgme.ERR_CANCELED, ctx.sign,
+                                  StringIO.StringIO('Hello World\n'),
+                                  StringIO.StringIO(), gpgme.SIG_MODE_CLEAR)
+        finally:
+            thread.join()
+        self.assertEqual(cancelled, [True])
+
+    def test_cancel_started(self):
+        ctx = self.make_context()
+        op = ctx.sign_start('Hello World\n', StringIO.StringIO(),
+                            gpgme.SIG_MODE_CLEAR)
+        self.assertEqual(ctx.cancel(), True)
+        self.assertRaisesCode(gpgme.ERR_CANCELED, op.wait)
+
+
+def test_suite():
+    loader = unittest.TestLoader()
+    return loader.loadTestsFromName(__name__)
@@ -6,15 +6,28 @@ gpgme = Extension(
     'gpgme._gpgme',
     ['src/gpgme.c',
      'src/pygpgme-error.c',
+     'src/pygpgme-batch.c',
      'src/pygpgme-data.c',
+     'src/pygpgme-dataobject.c',
      'src/pygpgme-context.c',
+     'src/pygpgme-contextpool.c',
+     'src/pygpgme-executor.c',
      'src/pygpgme-key.c',
+     'src/pygpgme-keycache.c',
      'src/pygpgme-signature.c',
      'src/pygpgme-import.c',
      'src/pygpgme-keyiter.c',
+     'src/pygpgme-keytable.c',
+     'src/pygpgme-mappedfile.c',
+     'src/pygpgme-multiplexer.c',
+     'src/pygpgme-operation.c',
+     'src/pygpgme-recipientset.c',
+     'src/pygpgme-stats.c',
+     'src/pygpgme-stream.c',
+     'src/pygpgme-watchdog.c',
      'src/pygpgme-constants.c',
      ],
-    libraries=['gpgme'])
+    libraries=['gpgme', 'pthread'])
 
 setup(name='pygpgme',
       version='0.1',
@@ -50,6 +50,8 @@ init_gpgme(void)
 
     INIT_TYPE(PyGpgmeContext_Type);
     INIT_TYPE(PyGpgmeKey_Type);
+    INIT_TYPE(PyGpgmeKeyCache_Type);
+    INIT_TYPE(PyGpgmeRecipientSet_Type);
     INIT_TYPE(PyGpgmeSubkey_Type);
     INIT_TYPE(PyGpgmeUserId_Type);
     INIT_TYPE(PyGpgmeKeySig_Type);
@@ -57,11 +59,24 @@ init_gpgme(void)
     INIT_TYPE(PyGpgmeSignature_Type);
     INIT_TYPE(PyGpgmeImportResult_Type);
     INIT_TYPE(PyGpgmeKeyIter_Type);
+    INIT_TYPE(PyGpgmeMappedFile_Type);
+    INIT_TYPE(PyGpgmeData_Type);
+    INIT_TYPE(PyGpgmeStream_Type);
+    INIT_TYPE(PyGpgmeOperation_Type);
+    INIT_TYPE(PyGpgmeIOWatch_Type);
+    INIT_TYPE(PyGpgmeMultiplexer_Type);
+    INIT_TYPE(PyGpgmeContextPool_Type);
+    INIT_TYPE(PyGpgmeContextLease_Type);
+    INIT_TYPE(PyGpgmeExecutor_Type);
+    INIT_TYPE(PyGpgmeFuture_Type);
 
     mod = Py_InitModule("gpgme._gpgme", pygpgme_functions);
+    pygpgme_watchdog_init();
 
     ADD_TYPE(Context);
     ADD_TYPE(Key);
+    ADD_TYPE(KeyCache);
+    ADD_TYPE(RecipientSet);
     ADD_TYPE(Subkey);
     ADD_TYPE(UserId);
     ADD_TYPE(KeySig);
@@ -69,6 +84,14 @@ init_gpgme(void)
     ADD_TYPE(Signature);
     ADD_TYPE(ImportResult);
     ADD_TYPE(KeyIter);
+    ADD_TYPE(MappedFile);
+    ADD_TYPE(Data);
+    ADD_TYPE(Stream);
+    ADD_TYPE(Operation);
+    ADD_TYPE(Multiplexer);
+    ADD_TYPE(ContextPool);
+    ADD_TYPE(Executor);
+    ADD_TYPE(Future);
 
     Py_INCREF(pygpgme_error);
     PyModule_AddObject(mod, "GpgmeError", pygpgme_error);
@@ -0,0 +1,566 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+    pygpgme - a Python wrapper for the gpgme library
+    Copyright (C) 2006  James Henstridge
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "pygpgme.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The *_many() methods run a whole batch of small operations on one
+ * context in a single call.  Every Python object is checked and
+ * converted before the batch starts, and the results are only turned
+ * into Python objects once it has finished, so the GIL is released for
+ * the whole batch rather than once per item.  That means inputs have to
+ * be strings or other buffers: file objects can't be read without the
+ * GIL.  A failing item doesn't stop the batch; its result is the
+ * gpgme.GpgmeError it raised.
+ *
+ * The same jobs are run by the worker threads of gpgme.Executor. */
+
+/* release everything held by a job, which needs the GIL */
+void
+pygpgme_batch_job_clear(PyGpgmeBatchJob *job)
+{
+    int i;
+
+    if (job->py_recp != NULL)
+        pygpgme_recipients_free(job->recp, job->py_recp);
+    job->recp = NULL;
+    job->py_recp = NULL;
+    if (job->have_input)
+        PyBuffer_Release(&job->input);
+    job->have_input = 0;
+    if (job->have_signed_text)
+        PyBuffer_Release(&job->signed_text);
+    job->have_signed_text = 0;
+    if (job->output != NULL)
+        gpgme_free(job->output);
+    job->output = NULL;
+    for (i = 0; i < job->ninvalid; i++)
+        free(job->invalid[i].fpr);
+    free(job->invalid);
+    job->invalid = NULL;
+    job->ninvalid = 0;
+    for (i = 0; i < job->nsigs; i++)
+        free(job->sigs[i].fpr);
+    free(job->sigs);
+    job->sigs = NULL;
+    job->nsigs = 0;
+}
+
+static void
+batch_free(PyGpgmeBatchJob *jobs, Py_ssize_t njobs)
+{
+    Py_ssize_t i;
+
+    for (i = 0; i < njobs; i++)
+        pygpgme_batch_job_clear(&jobs[i]);
+    free(jobs);
+}
+
+static PyGpgmeBatchJob *
+batch_new(Py_ssize_t njobs, PyGpgmeBatchOp op, int flags)
+{
+    PyGpgmeBatchJob *jobs;
+    Py_ssize_t i;
+
+    jobs = calloc(njobs > 0 ? njobs : 1, sizeof(PyGpgmeBatchJob));
+    if (jobs == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    for (i = 0; i < njobs; i++) {
+        jobs[i].op = op;
+        jobs[i].flags = flags;
+    }
+    return jobs;
+}
+
+/* unpack a job given as a tuple of n items */
+static int
+batch_unpack(PyObject *item, int n, PyObject **items, const char *message)
+{
+    int i;
+
+    if (!PyTuple_Check(item) || PyTuple_GET_SIZE(item) != n) {
+        PyErr_SetString(PyExc_TypeError, message);
+        return -1;
+    }
+    for (i = 0; i < n; i++)
+        items[i] = PyTuple_GET_ITEM(item, i);
+    return 0;
+}
+
+int
+pygpgme_batch_get_buffer(PyObject *obj, Py_buffer *view, int *have_view)
+{
+    if (PyObject_GetBuffer(obj, view, PyBUF_SIMPLE) < 0) {
+        PyErr_SetString(PyExc_TypeError,
+                        "batch inputs must be strings or buffers");
+        return -1;
+    }
+    *have_view = 1;
+    return 0;
+}
+
+/* copy the invalid recipients or signers out of the operation result,
+ * which is only valid until the next operation on the context */
+static void
+batch_save_invalid_keys(PyGpgmeBatchJob *job, gpgme_invalid_key_t keys)
+{
+    gpgme_invalid_key_t key;
+    int n = 0;
+
+    for (key = keys; key != NULL; key = key->next)
+        n++;
+    if (n == 0)
+        return;
+    job->invalid = calloc(n, sizeof(PyGpgmeBatchInvalidKey));
+    if (job->invalid == NULL)
+        return;
+    for (key = keys; key != NULL; key = key->next) {
+        job->invalid[job->ninvalid].fpr = key->fpr ? strdup(key->fpr) : NULL;
+        job->invalid[job->ninvalid].reason = key->reason;
+        job->ninvalid++;
+    }
+}
+
+/* copy the signatures out of the verify result */
+static void
+batch_save_signatures(PyGpgmeBatchJob *job, gpgme_ctx_t ctx)
+{
+    gpgme_verify_result_t res;
+    gpgme_signature_t sig;
+    int n = 0;
+
+    res = gpgme_op_verify_result(ctx);
+    if (res == NULL)
+        return;
+    for (sig = res->signatures; sig != NULL; sig = sig->next)
+        n++;
+    if (n == 0)
+        return;
+    job->sigs = calloc(n, sizeof(PyGpgmeBatchSignature));
+    if (job->sigs == NULL)
+        return;
+    for (sig = res->signatures; sig != NULL; sig = sig->next) {
+        PyGpgmeBatchSignature *item = &job->sigs[job->nsigs++];
+
+        item->fpr = sig->fpr ? strdup(sig->fpr) : NULL;
+        item->summary = sig->summary;
+        item->status = sig->status;
+        item->timestamp = sig->timestamp;
+        item->validity = sig->validity;
+    }
+}
+
+/* the signatures as a list of (fpr, summary, status, timestamp,
+ * validity) tuples, where status is the error code, or 0 for a good
+ * signature */
+static PyObject *
+batch_signatures(PyGpgmeBatchJob *job)
+{
+    PyObject *list, *item;
+    int i;
+
+    list = PyList_New(job->nsigs);
+    if (list == NULL)
+        return NULL;
+    for (i = 0; i < job->nsigs; i++) {
+        item = Py_BuildValue("(zllkl)", job->sigs[i].fpr,
+                             (long)job->sigs[i].summary,
+                             (long)gpgme_err_code(job->sigs[i].status),
+                             job->sigs[i].timestamp,
+                             (long)job->sigs[i].validity);
+        if (item == NULL) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, i, item);
+    }
+    return list;
+}
+
+/* the error for a failed job, with the same annotations the single
+ * operation methods add */
+static PyObject *
+batch_error(PyGpgmeBatchJob *job)
+{
+    PyObject *exc, *list, *item;
+    int i;
+
+    exc = pygpgme_error_object(job->err);
+    if (exc == NULL)
+        return NULL;
+    if (job->sigs != NULL) {
+        list = batch_signatures(job);
+        if (list == NULL) {
+            Py_DECREF(exc);
+            return NULL;
+        }
+        PyObject_SetAttrString(exc, "signatures", list);
+        Py_DECREF(list);
+    }
+    if (job->invalid == NULL)
+        return exc;
+
+    list = PyList_New(0);
+    if (list == NULL) {
+        Py_DECREF(exc);
+        return NULL;
+    }
+    for (i = 0; i < job->ninvalid; i++) {
+        item = Py_BuildValue("(zN)", job->invalid[i].fpr,
+                             pygpgme_error_object(job->invalid[i].reason));
+        if (item == NULL || PyList_Append(list, item) < 0) {
+            Py_XDECREF(item);
+            Py_DECREF(list);
+            Py_DECREF(exc);
+            return NULL;
+        }
+        Py_DECREF(item);
+    }
+    PyObject_SetAttrString(exc, job->op == PYGPGME_BATCH_SIGN ?
+                           "invalid_signers" : "invalid_recipients", list);
+    Py_DECREF(list);
+    return exc;
+}
+
+/* the result for a job: its error, or its output as a string.  The
+ * results of verifying jobs are (output, signatures) tuples, with None
+ * as the output for detached signatures. */
+PyObject *
+pygpgme_batch_result(PyGpgmeBatchJob *job)
+{
+    if (job->err != GPG_ERR_NO_ERROR)
+        return batch_error(job);
+
+    switch (job->op) {
+    case PYGPGME_BATCH_VERIFY:
+        if (job->have_signed_text)
+            return Py_BuildValue("(ON)", Py_None, batch_signatures(job));
+        /* fall through */
+    case PYGPGME_BATCH_DECRYPT_VERIFY:
+        return Py_BuildValue("(NN)", PyString_FromStringAndSize(
+                                 job->output, job->output_len),
+                             batch_signatures(job));
+    default:
+        return PyString_FromStringAndSize(job->output, job->output_len);
+    }
+}
+
+static PyObject *
+batch_results(PyGpgmeBatchJob *jobs, Py_ssize_t njobs)
+{
+    PyObject *results, *item;
+    Py_ssize_t i;
+
+    results = PyList_New(njobs);
+    if (results == NULL)
+        return NULL;
+    for (i = 0; i < njobs; i++) {
+        item = pygpgme_batch_result(&jobs[i]);
+        if (item == NULL) {
+            Py_DECREF(results);
+            return NULL;
+        }
+        PyList_SET_ITEM(results, i, item);
+    }
+    return results;
+}
+
+/* keep the contents of a memory data object as the job's output */
+static gpgme_error_t
+batch_take_output(PyGpgmeBatchJob *job, gpgme_data_t data)
+{
+    job->output = gpgme_data_release_and_get_mem(data, &job->output_len);
+    if (job->output == NULL && job->output_len != 0)
+        return gpgme_error_from_errno(ENOMEM);
+    return GPG_ERR_NO_ERROR;
+}
+
+/* encrypt or sign the input into a new memory buffer, keeping the
+ * buffer's contents as the job's output */
+static gpgme_error_t
+batch_encrypt_sign(gpgme_ctx_t ctx, PyGpgmeBatchJob *job)
+{
+    gpgme_data_t plain, output;
+    gpgme_error_t err;
+    gpgme_sign_result_t sign_result;
+    gpgme_encrypt_result_t encrypt_result;
+
+    err = gpgme_data_new_from_mem(&plain, job->input.buf, job->input.len, 0);
+    if (err != GPG_ERR_NO_ERROR)
+        return err;
+    err = gpgme_data_new(&output);
+    if (err != GPG_ERR_NO_ERROR) {
+        gpgme_data_release(plain);
+        return err;
+    }
+
+    if (job->op == PYGPGME_BATCH_SIGN)
+        err = gpgme_op_sign(ctx, plain, output, job->flags);
+    else
+        err = gpgme_op_encrypt(ctx, job->recp, job->flags, plain, output);
+    gpgme_data_release(plain);
+    if (err == GPG_ERR_NO_ERROR)
+        return batch_take_output(job, output);
+
+    gpgme_data_release(output);
+    if (job->op == PYGPGME_BATCH_SIGN) {
+        sign_result = gpgme_op_sign_result(ctx);
+        if (sign_result != NULL)
+            batch_save_invalid_keys(job, sign_result->invalid_signers);
+    } else {
+        encrypt_result = gpgme_op_encrypt_result(ctx);
+        if (encrypt_result != NULL)
+            batch_save_invalid_keys(job,
+                                    encrypt_result->invalid_recipients);
+    }
+    return err;
+}
+
+static gpgme_error_t
+batch_decrypt(gpgme_ctx_t ctx, PyGpgmeBatchJob *job)
+{
+    gpgme_data_t cipher, plain;
+    gpgme_error_t err;
+    int verify = job->op == PYGPGME_BATCH_DECRYPT_VERIFY;
+
+    err = gpgme_data_new_from_mem(&cipher, job->input.buf, job->input.len, 0);
+    if (err != GPG_ERR_NO_ERROR)
+        return err;
+    err = gpgme_data_new(&plain);
+    if (err != GPG_ERR_NO_ERROR) {
+        gpgme_data_release(cipher);
+        return err;
+    }
+
+    if (verify)
+        err = gpgme_op_decrypt_verify(ctx, cipher, plain);
+    else
+        err = gpgme_op_decrypt(ctx, cipher, plain);
+    gpgme_data_release(cipher);
+    if (verify)
+        batch_save_signatures(job, ctx);
+    if (err != GPG_ERR_NO_ERROR) {
+        gpgme_data_release(plain);
+        return err;
+    }
+    return batch_take_output(job, plain);
+}
+
+/* verify a detached signature against the signed text, or an opaque or
+ * clearsigned message, keeping its plaintext */
+static gpgme_error_t
+batch_verify(gpgme_ctx_t ctx, PyGpgmeBatchJob *job)
+{
+    gpgme_data_t sig, signed_text = NULL, plain = NULL;
+    gpgme_error_t err;
+
+    err = gpgme_data_new_from_mem(&sig, job->input.buf, job->input.len, 0);
+    if (err != GPG_ERR_NO_ERROR)
+        return err;
+    if (job->have_signed_text)
+        err = gpgme_data_new_from_mem(&signed_text, job->signed_text.buf,
+                                      job->signed_text.len, 0);
+    else
+        err = gpgme_data_new(&plain);
+    if (err != GPG_ERR_NO_ERROR) {
+        gpgme_data_release(sig);
+        return err;
+    }
+
+    err = gpgme_op_verify(ctx, sig, signed_text, plain);
+    gpgme_data_release(sig);
+    if (signed_text != NULL)
+        gpgme_data_release(signed_text);
+    batch_save_signatures(job, ctx);
+    if (err != GPG_ERR_NO_ERROR) {
+        if (plain != NULL)
+            gpgme_data_release(plain);
+        return err;
+    }
+    if (plain != NULL)
+        return batch_take_output(job, plain);
+    return GPG_ERR_NO_ERROR;
+}
+
+/* run a job on the context, storing its error.  Called without the
+ * GIL. */
+void
+pygpgme_batch_run(gpgme_ctx_t ctx, PyGpgmeBatchJob *job)
+{
+    switch (job->op) {
+    case PYGPGME_BATCH_ENCRYPT:
+    case PYGPGME_BATCH_SIGN:
+        job->err = batch_encrypt_sign(ctx, job);
+        break;
+    case PYGPGME_BATCH_DECRYPT:
+    case PYGPGME_BATCH_DECRYPT_VERIFY:
+        job->err = batch_decrypt(ctx, job);
+        break;
+    case PYGPGME_BATCH_VERIFY:
+        job->err = batch_verify(ctx, job);
+        break;
+    }
+}
+
+/* run the jobs with the GIL released and collect their results */
+static PyObject *
+batch_run_all(PyGpgmeContext *self, PyGpgmeBatchJob *jobs, Py_ssize_t njobs,
+              const char *operation)
+{
+    gpgme_error_t err;
+    Py_ssize_t i;
+
+    Py_BEGIN_ALLOW_THREADS;
+    pygpgme_op_begin(self, operation);
+    for (i = 0; i < njobs; i++) {
+        /* a timeout or cancel() applies to the rest of the batch */
+        err = pygpgme_watchdog_status(self);
+        if (err != GPG_ERR_NO_ERROR) {
+            jobs[i].err = err;
+            continue;
+        }
+        pygpgme_batch_run(self->ctx, &jobs[i]);
+        if (gpgme_err_code(jobs[i].err) == GPG_ERR_CANCELED &&
+            (err = pygpgme_watchdog_status(self)) != GPG_ERR_NO_ERROR)
+            jobs[i].err = err;
+    }
+    pygpgme_op_end(self, GPG_ERR_NO_ERROR);
+    Py_END_ALLOW_THREADS;
+
+    return batch_results(jobs, njobs);
+}
+
+PyObject *
+pygpgme_encrypt_many(PyGpgmeContext *self, PyObject *py_jobs, int flags)
+{
+    PyObject *seq, *args[2], *last_recp = NULL;
+    PyObject *results = NULL;
+    PyGpgmeBatchJob *jobs;
+    Py_ssize_t njobs, i;
+
+    seq = PySequence_Fast(py_jobs, "jobs must be a sequence");
+    if (seq == NULL)
+        return NULL;
+    njobs = PySequence_Fast_GET_SIZE(seq);
+    jobs = batch_new(njobs, PYGPGME_BATCH_ENCRYPT, flags);
+    if (jobs == NULL) {
+        Py_DECREF(seq);
+        return NULL;
+    }
+
+    for (i = 0; i < njobs; i++) {
+        if (batch_unpack(PySequence_Fast_GET_ITEM(seq, i), 2, args,
+                         "jobs must be (recipients, plaintext) tuples") < 0)
+            goto end;
+
+        /* jobs usually share one recipient list */
+        if (args[0] == last_recp) {
+            jobs[i].recp = jobs[i - 1].recp;
+        } else {
+            if (pygpgme_recipients(args[0], &jobs[i].recp,
+                                   &jobs[i].py_recp) < 0)
+                goto end;
+            last_recp = args[0];
+        }
+        if (pygpgme_batch_get_buffer(args[1], &jobs[i].input,
+                                     &jobs[i].have_input) < 0)
+            goto end;
+    }
+
+    results = batch_run_all(self, jobs, njobs, "encrypt_many");
+
+ end:
+    batch_free(jobs, njobs);
+    Py_DECREF(seq);
+    return results;
+}
+
+PyObject *
+pygpgme_decrypt_many(PyGpgmeContext *self, PyObject *py_ciphers, int verify)
+{
+    PyObject *seq, *results = NULL;
+    PyGpgmeBatchJob *jobs;
+    Py_ssize_t njobs, i;
+
+    seq = PySequence_Fast(py_ciphers, "ciphertexts must be a sequence");
+    if (seq == NULL)
+        return NULL;
+    njobs = PySequence_Fast_GET_SIZE(seq);
+    jobs = batch_new(njobs, verify ? PYGPGME_BATCH_DECRYPT_VERIFY :
+                     PYGPGME_BATCH_DECRYPT, 0);
+    if (jobs == NULL) {
+        Py_DECREF(seq);
+        return NULL;
+    }
+
+    for (i = 0; i < njobs; i++) {
+        if (pygpgme_batch_get_buffer(PySequence_Fast_GET_ITEM(seq, i),
+                                     &jobs[i].input, &jobs[i].have_input) < 0)
+            goto end;
+    }
+
+    results = batch_run_all(self, jobs, njobs,
+                            verify ? "decrypt_verify_many" : "decrypt_many");
+
+ end:
+    batch_free(jobs, njobs);
+    Py_DECREF(seq);
+    return results;
+}
+
+PyObject *
+pygpgme_verify_many(PyGpgmeContext *self, PyObject *py_jobs)
+{
+    PyObject *seq, *args[2], *results = NULL;
+    PyGpgmeBatchJob *jobs;
+    Py_ssize_t njobs, i;
+
+    seq = PySequence_Fast(py_jobs, "jobs must be a sequence");
+    if (seq == NULL)
+        return NULL;
+    njobs = PySequence_Fast_GET_SIZE(seq);
+    jobs = batch_new(njobs, PYGPGME_BATCH_VERIFY, 0);
+    if (jobs == NULL) {
+        Py_DECREF(seq);
+        return NULL;
+    }
+
+    for (i = 0; i < njobs; i++) {
+        if (batch_unpack(PySequence_Fast_GET_ITEM(seq, i), 2, args,
+                         "jobs must be (signature, signed_text) tuples") < 0 ||
+            pygpgme_batch_get_buffer(args[0], &jobs[i].input,
+                                     &jobs[i].have_input) < 0)
+            goto end;
+        if (args[1] != Py_None &&
+            pygpgme_batch_get_buffer(args[1], &jobs[i].signed_text,
+                                     &jobs[i].have_signed_text) < 0)
+            goto end;
+    }
+
+    results = batch_run_all(self, jobs, njobs, "verify_many");
+
+ end:
+    batch_free(jobs, njobs);
+    Py_DECREF(seq);
+    return results;
+}
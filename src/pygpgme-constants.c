@@ -178,6 +178,23 @@ static const struct pygpgme_constant constants[] = {
   CONST(IMPORT_SUBKEY),
   CONST(IMPORT_SECRET),
 
+  /* gpgme.Executor priority classes */
+#undef CONST
+#define CONST(name) { #name, PYGPGME_##name }
+  CONST(PRIORITY_INTERACTIVE),
+  CONST(PRIORITY_NORMAL),
+  CONST(PRIORITY_BULK),
+
+  /* Context.keylist_table() flags bits */
+  CONST(KEY_FLAG_REVOKED),
+  CONST(KEY_FLAG_EXPIRED),
+  CONST(KEY_FLAG_DISABLED),
+  CONST(KEY_FLAG_INVALID),
+  CONST(KEY_FLAG_CAN_ENCRYPT),
+  CONST(KEY_FLAG_CAN_SIGN),
+  CONST(KEY_FLAG_CAN_CERTIFY),
+  CONST(KEY_FLAG_SECRET),
+
   /* gpg-error.h constants */
 #undef CONST
 #define CONST(name) { #name, GPG_##name }
@@ -18,6 +18,11 @@
     Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 #include "pygpgme.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <pythread.h>
 
 static gpgme_error_t
 pygpgme_passphrase_cb(void *hook, const char *uid_hint,
@@ -27,14 +32,16 @@ pygpgme_passphrase_cb(void *hook, const char *uid_hint,
     PyObject *callback, *ret;
     PyGILState_STATE state;
     gpgme_error_t err;
+    double start;
 
-    state = PyGILState_Ensure();
+    PYGPGME_STATS_ADD(passphrase_calls, 1);
+    state = pygpgme_callback_enter(&start);
     callback = (PyObject *)hook;
     ret = PyObject_CallFunction(callback, "zzii", uid_hint, passphrase_info,
                                 prev_was_bad, fd);
     err = pygpgme_check_pyerror();
     Py_XDECREF(ret);
-    PyGILState_Release(state);
+    pygpgme_callback_leave(state, start);
     return err;
 }
 
@@ -44,13 +51,15 @@ pygpgme_progress_cb(void *hook, const char *what, int type,
 {
     PyObject *callback, *ret;
     PyGILState_STATE state;
+    double start;
 
-    state = PyGILState_Ensure();
+    PYGPGME_STATS_ADD(progress_calls, 1);
+    state = pygpgme_callback_enter(&start);
     callback = (PyObject *)hook;
     ret = PyObject_CallFunction(callback, "ziii", what, type, current, total);
     PyErr_Clear();
     Py_XDECREF(ret);
-    PyGILState_Release(state);
+    pygpgme_callback_leave(state, start);
 }
 
 static void
@@ -60,6 +69,9 @@ pygpgme_context_dealloc(PyGpgmeContext *self)
     gpgme_progress_cb_t progress_cb;
     PyObject *callback;
 
+    if (self->weakreflist != NULL)
+        PyObject_ClearWeakRefs((PyObject *)self);
+
     if (self->ctx) {
         /* free the passphrase callback */
         gpgme_get_passphrase_cb(self->ctx, &passphrase_cb, (void **)&callback);
@@ -74,17 +86,28 @@ pygpgme_context_dealloc(PyGpgmeContext *self)
         }
 
         gpgme_release(self->ctx);
+        pthread_mutex_destroy(&self->lock);
+        pthread_cond_destroy(&self->idle);
     }
     self->ctx = NULL;
+    Py_XDECREF(self->io_handler);
+    self->io_handler = NULL;
+    Py_XDECREF(self->local);
+    self->local = NULL;
+    Py_XDECREF(self->children);
+    self->children = NULL;
+    Py_XDECREF(self->key_cache);
+    self->key_cache = NULL;
     PyObject_Del(self);
 }
 
 static int
 pygpgme_context_init(PyGpgmeContext *self, PyObject *args, PyObject *kwargs)
 {
-    static char *kwlist[] = { NULL };
+    static char *kwlist[] = { "affinity", NULL };
+    int affinity = 0;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "", kwlist))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", kwlist, &affinity))
         return -1;
 
     if (self->ctx != NULL) {
@@ -92,12 +115,252 @@ pygpgme_context_init(PyGpgmeContext *self, PyObject *args, PyObject *kwargs)
         return -1;
     }
 
-    if (pygpgme_check_error(gpgme_new(&self->ctx)))
+    if (affinity) {
+        PyObject *thread = PyImport_ImportModule("thread");
+
+        if (thread == NULL)
+            return -1;
+        self->local = PyObject_CallMethod(thread, "_local", NULL);
+        Py_DECREF(thread);
+        self->children = PyDict_New();
+        if (self->local == NULL || self->children == NULL) {
+            Py_CLEAR(self->local);
+            Py_CLEAR(self->children);
+            return -1;
+        }
+    }
+
+    if (pygpgme_check_error(gpgme_new(&self->ctx))) {
+        Py_CLEAR(self->local);
+        Py_CLEAR(self->children);
+        return -1;
+    }
+
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->idle, NULL);
+    self->write_buffer_size = PYGPGME_DEFAULT_WRITE_BUFFER_SIZE;
+    return 0;
+}
+
+/* Every method that uses the gpgme context holds it while it runs, so
+ * that operations started from different threads don't interleave:
+ * other threads wait, without the GIL, until it is released.  The
+ * thread holding the context may take it again, so callbacks can still
+ * use the context as they could before.
+ *
+ * Started operations, streams and keylist() iterators go on holding the
+ * context until they finish, whichever thread uses them.  Other threads
+ * wait for them as they would for a method.  Operations, streams and
+ * prefetching iterators may have gpgme busy at any time, so the thread
+ * that started one gets an error rather than using the context, as it
+ * would otherwise be waiting for itself.  A plain keylist() iterator
+ * only uses gpgme while it lists keys, so the thread that started it
+ * can still use the context between keys, as it always could. */
+
+/* whether thread may take the context.  held_ok is set when the caller
+ * is the object holding it. */
+static int
+context_available(PyGpgmeContext *self, pthread_t thread, int held_ok)
+{
+    if (self->depth > 0 && !pthread_equal(self->owner, thread))
+        return 0;
+    return !self->held || held_ok ||
+        (self->held_reentrant && pthread_equal(self->holder, thread));
+}
+
+/* take the context, waiting without the GIL until it is available.
+ * Called with self->lock locked, which is unlocked on return. */
+static void
+context_take(PyGpgmeContext *self, int held_ok)
+{
+    pthread_t thread = pthread_self();
+
+    if (!context_available(self, thread, held_ok)) {
+        /* the GIL must not be taken back while holding the lock */
+        pthread_mutex_unlock(&self->lock);
+        Py_BEGIN_ALLOW_THREADS;
+        pthread_mutex_lock(&self->lock);
+        while (!context_available(self, thread, held_ok))
+            pthread_cond_wait(&self->idle, &self->lock);
+        self->owner = thread;
+        self->depth++;
+        pthread_mutex_unlock(&self->lock);
+        Py_END_ALLOW_THREADS;
+        return;
+    }
+    self->owner = thread;
+    self->depth++;
+    pthread_mutex_unlock(&self->lock);
+}
+
+/* Called with the GIL held.  Returns -1 with an exception set if the
+ * calling thread can't use the context. */
+int
+pygpgme_context_acquire(PyGpgmeContext *self)
+{
+    pthread_mutex_lock(&self->lock);
+    if (self->held && !self->held_reentrant &&
+        pthread_equal(self->holder, pthread_self())) {
+        pthread_mutex_unlock(&self->lock);
+        PyErr_SetString(PyExc_ValueError, "the context is in use by an "
+                        "unfinished operation, stream or keylist");
         return -1;
+    }
+    context_take(self, 0);
+    return 0;
+}
+
+/* take the context on behalf of the object holding it, from any
+ * thread.  Called with the GIL held. */
+void
+pygpgme_context_acquire_held(PyGpgmeContext *self)
+{
+    pthread_mutex_lock(&self->lock);
+    context_take(self, 1);
+}
+
+/* may be called from any thread, with or without the GIL */
+void
+pygpgme_context_release(PyGpgmeContext *self)
+{
+    pthread_mutex_lock(&self->lock);
+    if (--self->depth == 0)
+        pthread_cond_broadcast(&self->idle);
+    pthread_mutex_unlock(&self->lock);
+}
+
+/* keep the context held for an operation, stream or iterator until
+ * pygpgme_context_unhold().  With reentrant set, the calling thread may
+ * still use it meanwhile.  Called by a method holding the context. */
+void
+pygpgme_context_hold(PyGpgmeContext *self, int reentrant)
+{
+    pthread_mutex_lock(&self->lock);
+    self->held = 1;
+    self->held_reentrant = reentrant;
+    self->holder = pthread_self();
+    pthread_mutex_unlock(&self->lock);
+}
 
+/* may be called from any thread, with or without the GIL */
+void
+pygpgme_context_unhold(PyGpgmeContext *self)
+{
+    pthread_mutex_lock(&self->lock);
+    self->held = 0;
+    pthread_cond_broadcast(&self->idle);
+    pthread_mutex_unlock(&self->lock);
+}
+
+/* the attributes each thread's context copies in affinity mode */
+static const char *const affinity_attrs[] = {
+    "protocol", "armor", "textmode", "include_certs", "keylist_mode",
+    "passphrase_cb", "progress_cb", "signers", "write_buffer_size",
+    "collect_stats", "timeout", "catch_signals", "key_cache", "io_handler",
+    NULL
+};
+
+/* configure child like self, if self has changed since it last was */
+static int
+context_configure_child(PyGpgmeContext *self, PyGpgmeContext *child)
+{
+    gpgme_engine_info_t info;
+    PyObject *value;
+    int i, held;
+
+    if (child->generation == self->generation)
+        return 0;
+    /* not while the thread's operation, stream or iterator is running;
+     * the child is configured once that has finished */
+    pthread_mutex_lock(&child->lock);
+    held = child->held;
+    pthread_mutex_unlock(&child->lock);
+    if (held)
+        return 0;
+    for (i = 0; affinity_attrs[i] != NULL; i++) {
+        value = PyObject_GetAttrString((PyObject *)self, affinity_attrs[i]);
+        if (value == NULL)
+            return -1;
+        if (PyObject_SetAttrString((PyObject *)child, affinity_attrs[i],
+                                   value) < 0) {
+            Py_DECREF(value);
+            return -1;
+        }
+        Py_DECREF(value);
+    }
+    for (info = gpgme_ctx_get_engine_info(self->ctx); info != NULL;
+         info = info->next) {
+        if (pygpgme_check_error(gpgme_ctx_set_engine_info(
+                child->ctx, info->protocol, info->file_name, info->home_dir)))
+            return -1;
+    }
+    child->generation = self->generation;
     return 0;
 }
 
+/* remember the calling thread's new context, so cancel() can reach it,
+ * and forget those of threads that have exited */
+static int
+context_add_child(PyGpgmeContext *self, PyObject *child)
+{
+    PyObject *key, *ref, *dead;
+    Py_ssize_t pos = 0, i;
+    int ret = -1;
+
+    dead = PyList_New(0);
+    if (dead == NULL)
+        return -1;
+    while (PyDict_Next(self->children, &pos, &key, &ref))
+        if (PyWeakref_GET_OBJECT(ref) == Py_None &&
+            PyList_Append(dead, key) < 0)
+            goto end;
+    for (i = 0; i < PyList_GET_SIZE(dead); i++)
+        if (PyDict_DelItem(self->children, PyList_GET_ITEM(dead, i)) < 0)
+            goto end;
+
+    key = PyInt_FromLong(PyThread_get_thread_ident());
+    ref = PyWeakref_NewRef(child, NULL);
+    if (key != NULL && ref != NULL &&
+        PyDict_SetItem(self->children, key, ref) == 0)
+        ret = 0;
+    Py_XDECREF(key);
+    Py_XDECREF(ref);
+
+ end:
+    Py_DECREF(dead);
+    return ret;
+}
+
+/* the context the calling thread uses in affinity mode, created the
+ * first time the thread needs one */
+static PyGpgmeContext *
+context_thread_child(PyGpgmeContext *self)
+{
+    PyObject *child;
+
+    child = PyObject_GetAttrString(self->local, "context");
+    if (child == NULL) {
+        if (!PyErr_ExceptionMatches(PyExc_AttributeError))
+            return NULL;
+        PyErr_Clear();
+        child = PyObject_CallObject((PyObject *)&PyGpgmeContext_Type, NULL);
+        if (child == NULL ||
+            PyObject_SetAttrString(self->local, "context", child) < 0 ||
+            context_add_child(self, child) < 0) {
+            Py_XDECREF(child);
+            return NULL;
+        }
+        /* force it to be configured */
+        ((PyGpgmeContext *)child)->generation = self->generation - 1;
+    }
+
+    if (context_configure_child(self, (PyGpgmeContext *)child) < 0) {
+        Py_DECREF(child);
+        return NULL;
+    }
+    return (PyGpgmeContext *)child;
+}
+
 static PyObject *
 pygpgme_context_get_protocol(PyGpgmeContext *self)
 {
@@ -336,6 +599,187 @@ pygpgme_context_set_signers(PyGpgmeContext *self, PyObject *value)
     return ret;
 }
 
+static PyObject *
+pygpgme_context_get_write_buffer_size(PyGpgmeContext *self)
+{
+    return PyInt_FromSsize_t(self->write_buffer_size);
+}
+
+static int
+pygpgme_context_set_write_buffer_size(PyGpgmeContext *self, PyObject *value)
+{
+    Py_ssize_t write_buffer_size;
+
+    if (value == NULL) {
+        PyErr_SetString(PyExc_TypeError, "can not delete write_buffer_size");
+        return -1;
+    }
+
+    write_buffer_size = PyInt_AsSsize_t(value);
+    if (PyErr_Occurred())
+        return -1;
+
+    if (write_buffer_size < 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "write_buffer_size must be non-negative");
+        return -1;
+    }
+
+    self->write_buffer_size = write_buffer_size;
+    return 0;
+}
+
+static PyObject *
+pygpgme_context_get_collect_stats(PyGpgmeContext *self)
+{
+    return PyBool_FromLong(self->collect_stats);
+}
+
+static int
+pygpgme_context_set_collect_stats(PyGpgmeContext *self, PyObject *value)
+{
+    int collect_stats;
+
+    if (value == NULL) {
+        PyErr_SetString(PyExc_TypeError, "can not delete collect_stats");
+        return -1;
+    }
+
+    collect_stats = PyObject_IsTrue(value);
+    if (collect_stats < 0)
+        return -1;
+
+    self->collect_stats = collect_stats;
+    return 0;
+}
+
+/* callback counts and timings for the last operation, if it was run with
+ * collect_stats set */
+static PyObject *
+pygpgme_context_get_last_op_stats(PyGpgmeContext *self)
+{
+    if (!self->stats.valid)
+        Py_RETURN_NONE;
+    return pygpgme_op_stats_dict(&self->stats);
+}
+
+static PyObject *
+pygpgme_context_get_io_handler(PyGpgmeContext *self)
+{
+    if (self->io_handler == NULL)
+        Py_RETURN_NONE;
+    Py_INCREF(self->io_handler);
+    return self->io_handler;
+}
+
+static int
+pygpgme_context_set_io_handler(PyGpgmeContext *self, PyObject *value)
+{
+    return pygpgme_set_io_handler(self, value);
+}
+
+/* None, or the seconds an operation may run before it is cancelled */
+static PyObject *
+pygpgme_context_get_timeout(PyGpgmeContext *self)
+{
+    if (self->timeout <= 0)
+        Py_RETURN_NONE;
+    return PyFloat_FromDouble(self->timeout);
+}
+
+/* convert None or a number of seconds to a timeout, 0 meaning none */
+static int
+parse_timeout(PyObject *value, double *timeout)
+{
+    *timeout = 0;
+    if (value != Py_None) {
+        *timeout = PyFloat_AsDouble(value);
+        if (PyErr_Occurred())
+            return -1;
+        if (*timeout < 0) {
+            PyErr_SetString(PyExc_ValueError,
+                            "timeout must not be negative");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+pygpgme_context_set_timeout(PyGpgmeContext *self, PyObject *value)
+{
+    double timeout;
+
+    if (value == NULL) {
+        PyErr_SetString(PyExc_TypeError, "can not delete timeout");
+        return -1;
+    }
+    if (parse_timeout(value, &timeout) < 0)
+        return -1;
+    self->timeout = timeout;
+    return 0;
+}
+
+static PyObject *
+pygpgme_context_get_catch_signals(PyGpgmeContext *self)
+{
+    return PyBool_FromLong(self->catch_signals);
+}
+
+static int
+pygpgme_context_set_catch_signals(PyGpgmeContext *self, PyObject *value)
+{
+    int catch_signals;
+
+    if (value == NULL) {
+        PyErr_SetString(PyExc_TypeError, "can not delete catch_signals");
+        return -1;
+    }
+
+    catch_signals = PyObject_IsTrue(value);
+    if (catch_signals < 0)
+        return -1;
+
+    self->catch_signals = catch_signals;
+    return 0;
+}
+
+static PyObject *
+pygpgme_context_get_key_cache(PyGpgmeContext *self)
+{
+    if (self->key_cache == NULL)
+        Py_RETURN_NONE;
+    Py_INCREF(self->key_cache);
+    return self->key_cache;
+}
+
+static int
+pygpgme_context_set_key_cache(PyGpgmeContext *self, PyObject *value)
+{
+    if (value == NULL) {
+        PyErr_SetString(PyExc_TypeError, "can not delete key_cache");
+        return -1;
+    }
+    if (value != Py_None &&
+        !PyObject_TypeCheck(value, &PyGpgmeKeyCache_Type)) {
+        PyErr_SetString(PyExc_TypeError,
+                        "key_cache must be a gpgme.KeyCache or None");
+        return -1;
+    }
+    if (value == Py_None)
+        value = NULL;
+    Py_XINCREF(value);
+    Py_XDECREF(self->key_cache);
+    self->key_cache = value;
+    return 0;
+}
+
+static PyObject *
+pygpgme_context_get_affinity(PyGpgmeContext *self)
+{
+    return PyBool_FromLong(self->children != NULL);
+}
+
 static PyGetSetDef pygpgme_context_getsets[] = {
     { "protocol", (getter)pygpgme_context_get_protocol,
       (setter)pygpgme_context_set_protocol },
@@ -353,6 +797,20 @@ static PyGetSetDef pygpgme_context_getsets[] = {
       (setter)pygpgme_context_set_progress_cb },
     { "signers", (getter)pygpgme_context_get_signers,
       (setter)pygpgme_context_set_signers },
+    { "write_buffer_size", (getter)pygpgme_context_get_write_buffer_size,
+      (setter)pygpgme_context_set_write_buffer_size },
+    { "collect_stats", (getter)pygpgme_context_get_collect_stats,
+      (setter)pygpgme_context_set_collect_stats },
+    { "last_op_stats", (getter)pygpgme_context_get_last_op_stats },
+    { "io_handler", (getter)pygpgme_context_get_io_handler,
+      (setter)pygpgme_context_set_io_handler },
+    { "timeout", (getter)pygpgme_context_get_timeout,
+      (setter)pygpgme_context_set_timeout },
+    { "catch_signals", (getter)pygpgme_context_get_catch_signals,
+      (setter)pygpgme_context_set_catch_signals },
+    { "key_cache", (getter)pygpgme_context_get_key_cache,
+      (setter)pygpgme_context_set_key_cache },
+    { "affinity", (getter)pygpgme_context_get_affinity },
     { NULL, (getter)0, (setter)0 }
 };
 
@@ -372,6 +830,53 @@ pygpgme_context_set_locale(PyGpgmeContext *self, PyObject *args)
     Py_RETURN_NONE;
 }
 
+/* point the context at its own engine and home directory, so contexts
+ * for different keyrings can be used at once without changing
+ * GNUPGHOME.  None leaves the engine's default in place. */
+static PyObject *
+pygpgme_context_set_engine_info(PyGpgmeContext *self, PyObject *args)
+{
+    int protocol;
+    const char *file_name = NULL, *home_dir = NULL;
+
+    if (!PyArg_ParseTuple(args, "i|zz", &protocol, &file_name, &home_dir))
+        return NULL;
+
+    if (pygpgme_check_error(gpgme_ctx_set_engine_info(self->ctx, protocol,
+                                                      file_name, home_dir)))
+        return NULL;
+
+    self->generation++;
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+pygpgme_context_get_engine_info(PyGpgmeContext *self)
+{
+    gpgme_engine_info_t info;
+    PyObject *list, *item;
+
+    list = PyList_New(0);
+    if (list == NULL)
+        return NULL;
+    for (info = gpgme_ctx_get_engine_info(self->ctx); info != NULL;
+         info = info->next) {
+        item = Py_BuildValue("{s:i,s:z,s:z,s:z,s:z}",
+                             "protocol", info->protocol,
+                             "file_name", info->file_name,
+                             "home_dir", info->home_dir,
+                             "version", info->version,
+                             "req_version", info->req_version);
+        if (item == NULL || PyList_Append(list, item) < 0) {
+            Py_XDECREF(item);
+            Py_DECREF(list);
+            return NULL;
+        }
+        Py_DECREF(item);
+    }
+    return list;
+}
+
 /* the following don't seem to be used */
 /* XXX: signers_clear */
 /* XXX: signers_add */
@@ -389,123 +894,501 @@ pygpgme_context_get_key(PyGpgmeContext *self, PyObject *args)
     if (!PyArg_ParseTuple(args, "s|i", &fpr, &secret))
         return NULL;
 
-    Py_BEGIN_ALLOW_THREADS;
-    err = gpgme_get_key(self->ctx, fpr, &key, secret);
-    Py_END_ALLOW_THREADS;
+    key = pygpgme_keycache_lookup(self, fpr, secret);
+    if (key == NULL) {
+        Py_BEGIN_ALLOW_THREADS;
+        pygpgme_op_begin(self, "get_key");
+        err = gpgme_get_key(self->ctx, fpr, &key, secret);
+        err = pygpgme_op_end(self, err);
+        Py_END_ALLOW_THREADS;
 
-    if (pygpgme_check_error(err))
-        return NULL;
+        if (pygpgme_check_error(err))
+            return NULL;
+        pygpgme_keycache_insert(self, key, secret);
+    }
 
     ret = pygpgme_key_new(key);
     gpgme_key_unref(key);
     return ret;
 }
 
-/* XXX: cancel -- not needed unless we wrap the async calls */
-
-/* annotate exception with encrypt_result data */
-static void
-decode_encrypt_result(PyGpgmeContext *self)
+/* the name a key is looked up by in get_keys(): a fingerprint or key ID
+ * in upper case, without any 0x prefix */
+static PyObject *
+get_keys_name(const char *str)
 {
-    PyObject *err_type, *err_value, *err_traceback;
-    gpgme_encrypt_result_t res;
-    gpgme_invalid_key_t key;
-    PyObject *list;
-
-    PyErr_Fetch(&err_type, &err_value, &err_traceback);
-    PyErr_NormalizeException(&err_type, &err_value, &err_traceback);
-
-    if (!PyErr_GivenExceptionMatches(err_type, pygpgme_error))
-        goto end;
-
-    res = gpgme_op_encrypt_result(self->ctx);
-    if (res == NULL)
-        goto end;
+    PyObject *name;
+    char *p;
 
-    list = PyList_New(0);
-    for (key = res->invalid_recipients; key != NULL; key = key->next) {
-        PyObject *item, *err;
+    if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X'))
+        str += 2;
+    name = PyString_FromString(str);
+    if (name == NULL)
+        return NULL;
+    for (p = PyString_AS_STRING(name); *p != '\0'; p++)
+        *p = toupper((unsigned char)*p);
+    return name;
+}
 
-        err = pygpgme_error_object(key->reason);
-        item = Py_BuildValue("(zN)", key->fpr, err);
-        PyList_Append(list, item);
-        Py_DECREF(item);
+/* index the keys by the fingerprints and long and short key IDs of
+ * their subkeys */
+static PyObject *
+get_keys_index(gpgme_key_t *keys, Py_ssize_t nkeys)
+{
+    PyObject *index, *name, *py_key;
+    gpgme_subkey_t subkey;
+    const char *ids[3];
+    size_t length;
+    Py_ssize_t i;
+    int j;
+
+    index = PyDict_New();
+    if (index == NULL)
+        return NULL;
+    for (i = 0; i < nkeys; i++) {
+        py_key = pygpgme_key_new(keys[i]);
+        if (py_key == NULL)
+            goto error;
+        for (subkey = keys[i]->subkeys; subkey != NULL;
+             subkey = subkey->next) {
+            ids[0] = subkey->fpr;
+            ids[1] = subkey->keyid;
+            ids[2] = NULL;
+            if (subkey->keyid != NULL &&
+                (length = strlen(subkey->keyid)) > 8)
+                ids[2] = subkey->keyid + length - 8;
+            for (j = 0; j < 3; j++) {
+                if (ids[j] == NULL)
+                    continue;
+                name = get_keys_name(ids[j]);
+                /* the first key listed wins */
+                if (name == NULL ||
+                    (PyDict_GetItem(index, name) == NULL &&
+                     PyDict_SetItem(index, name, py_key) < 0)) {
+                    Py_XDECREF(name);
+                    Py_DECREF(py_key);
+                    goto error;
+                }
+                Py_DECREF(name);
+            }
+        }
+        Py_DECREF(py_key);
     }
+    return index;
 
-    PyObject_SetAttrString(err_value, "invalid_recipients", list);
-    Py_DECREF(list);
-
- end:
-    PyErr_Restore(err_type, err_value, err_traceback);
+ error:
+    Py_DECREF(index);
+    return NULL;
 }
 
+/* look up many keys by fingerprint or key ID with a single keylist
+ * operation, rather than running the engine for each.  Returns a dict
+ * of the keys found, by the strings they were asked for, and a list of
+ * the strings no key was found for. */
 static PyObject *
-pygpgme_context_encrypt(PyGpgmeContext *self, PyObject *args)
+pygpgme_context_get_keys(PyGpgmeContext *self, PyObject *args)
 {
-    PyObject *py_recp, *py_plain, *py_cipher;
-    int flags, i, length;
-    gpgme_key_t *recp;
-    gpgme_data_t plain, cipher;
-    gpgme_error_t err;
+    PyObject *py_fprs, *seq, *found = NULL, *missing = NULL, *index = NULL;
+    PyObject *ret = NULL;
+    const char **patterns = NULL;
+    gpgme_key_t key, *keys = NULL, *grown;
+    Py_ssize_t length, npatterns = 0, nkeys = 0, allocated = 0, i;
+    gpgme_error_t err = GPG_ERR_NO_ERROR;
+    int secret = 0;
 
-    if (!PyArg_ParseTuple(args, "OiOO", &py_recp, &flags,
-                          &py_plain, &py_cipher))
+    if (!PyArg_ParseTuple(args, "O|i", &py_fprs, &secret))
         return NULL;
 
-    py_recp = PySequence_Fast(py_recp, "first argument must be a sequence");
-    if (py_recp == NULL)
+    seq = PySequence_Fast(py_fprs, "fingerprints must be a sequence");
+    if (seq == NULL)
         return NULL;
+    length = PySequence_Fast_GET_SIZE(seq);
+    found = PyDict_New();
+    missing = PyList_New(0);
+    patterns = malloc((length + 1) * sizeof(const char *));
+    if (found == NULL || missing == NULL)
+        goto end;
+    if (patterns == NULL) {
+        PyErr_NoMemory();
+        goto end;
+    }
 
-    length = PySequence_Fast_GET_SIZE(py_recp);
-    recp = malloc((length + 1) * sizeof (gpgme_key_t));
+    /* only keys that aren't cached are listed */
     for (i = 0; i < length; i++) {
-        PyObject *item = PySequence_Fast_GET_ITEM(py_recp, i);
+        PyObject *item = PySequence_Fast_GET_ITEM(seq, i), *py_key;
 
-        if (!PyObject_TypeCheck(item, &PyGpgmeKey_Type)) {
-            free(recp);
-            Py_DECREF(py_recp);
-            PyErr_SetString(PyExc_TypeError, "items in first argument must "
-                            "be gpgme.Key objects");
-            return NULL;
-        }
-        recp[i] = ((PyGpgmeKey *)item)->key;
+        if (!PyString_Check(item)) {
+            PyErr_SetString(PyExc_TypeError,
+                            "fingerprints must be strings");
+            goto end;
+        }
+        key = pygpgme_keycache_lookup(self, PyString_AS_STRING(item),
+                                      secret);
+        if (key == NULL) {
+            patterns[npatterns++] = PyString_AS_STRING(item);
+            continue;
+        }
+        py_key = pygpgme_key_new(key);
+        gpgme_key_unref(key);
+        if (py_key == NULL || PyDict_SetItem(found, item, py_key) < 0) {
+            Py_XDECREF(py_key);
+            goto end;
+        }
+        Py_DECREF(py_key);
     }
-    recp[i] = NULL;
+    patterns[npatterns] = NULL;
+
+    /* an empty pattern list would list every key */
+    if (npatterns > 0) {
+        Py_BEGIN_ALLOW_THREADS;
+        pygpgme_op_begin(self, "get_keys");
+        err = gpgme_op_keylist_ext_start(self->ctx, patterns, secret, 0);
+        while (err == GPG_ERR_NO_ERROR &&
+               (err = gpgme_op_keylist_next(self->ctx, &key)) ==
+               GPG_ERR_NO_ERROR) {
+            if (nkeys == allocated) {
+                allocated = allocated ? 2 * allocated : 16;
+                grown = realloc(keys, allocated * sizeof(gpgme_key_t));
+                if (grown == NULL) {
+                    gpgme_key_unref(key);
+                    err = gpgme_error_from_errno(ENOMEM);
+                    gpgme_op_keylist_end(self->ctx);
+                    break;
+                }
+                keys = grown;
+            }
+            keys[nkeys++] = key;
+        }
+        if (gpgme_err_code(err) == GPG_ERR_EOF)
+            err = GPG_ERR_NO_ERROR;
+        err = pygpgme_op_end(self, err);
+        Py_END_ALLOW_THREADS;
 
-    if (pygpgme_data_new(&plain, py_plain)) {
-        free(recp);
+        if (pygpgme_check_error(err))
+            goto end;
+    }
+
+    for (i = 0; i < nkeys; i++)
+        pygpgme_keycache_insert(self, keys[i], secret);
+    index = get_keys_index(keys, nkeys);
+    if (index == NULL)
+        goto end;
+    for (i = 0; i < npatterns; i++) {
+        PyObject *name, *item, *py_key;
+
+        item = PyString_FromString(patterns[i]);
+        name = get_keys_name(patterns[i]);
+        if (item == NULL || name == NULL) {
+            Py_XDECREF(item);
+            Py_XDECREF(name);
+            goto end;
+        }
+        py_key = PyDict_GetItem(index, name);
+        Py_DECREF(name);
+        if ((py_key != NULL && PyDict_SetItem(found, item, py_key) < 0) ||
+            (py_key == NULL && !PyDict_Contains(found, item) &&
+             PyList_Append(missing, item) < 0)) {
+            Py_DECREF(item);
+            goto end;
+        }
+        Py_DECREF(item);
+    }
+    ret = Py_BuildValue("(OO)", found, missing);
+
+ end:
+    for (i = 0; i < nkeys; i++)
+        gpgme_key_unref(keys[i]);
+    free(keys);
+    free(patterns);
+    Py_XDECREF(index);
+    Py_XDECREF(found);
+    Py_XDECREF(missing);
+    Py_DECREF(seq);
+    return ret;
+}
+
+/* cancel the operation running on the context, which may be in another
+ * thread.  Returns whether there was one to cancel. */
+static PyObject *
+pygpgme_context_cancel(PyGpgmeContext *self)
+{
+    PyGpgmeOperation *op = self->op;
+    PyObject *ref, *child, *children, *ret;
+    Py_ssize_t pos = 0, i;
+    int cancelled;
+
+    /* in affinity mode, cancel the operations of every thread.  The
+     * children are kept alive, and the dict unchanged, by taking them
+     * out first: cancelling releases the GIL, during which their
+     * threads may exit and others may add theirs */
+    if (self->children != NULL) {
+        children = PyList_New(0);
+        if (children == NULL)
+            return NULL;
+        while (PyDict_Next(self->children, &pos, NULL, &ref)) {
+            child = PyWeakref_GET_OBJECT(ref);
+            if (child != Py_None && PyList_Append(children, child) < 0) {
+                Py_DECREF(children);
+                return NULL;
+            }
+        }
+        cancelled = 0;
+        for (i = 0; i < PyList_GET_SIZE(children); i++) {
+            ret = pygpgme_context_cancel(
+                (PyGpgmeContext *)PyList_GET_ITEM(children, i));
+            if (ret == NULL) {
+                Py_DECREF(children);
+                return NULL;
+            }
+            if (ret == Py_True)
+                cancelled = 1;
+            Py_DECREF(ret);
+        }
+        Py_DECREF(children);
+        return PyBool_FromLong(cancelled);
+    }
+
+    /* io_handler callbacks run with the GIL held, so the operation can
+     * be cancelled, and finished, from here */
+    if (op != NULL && op->started && !op->done && self->io_handler != NULL) {
+        if (pygpgme_check_error(gpgme_cancel(self->ctx)))
+            return NULL;
+        Py_RETURN_TRUE;
+    }
+
+    Py_BEGIN_ALLOW_THREADS;
+    cancelled = pygpgme_watchdog_cancel(self);
+    /* a started operation nobody is waiting for yet fails once it is */
+    if (!cancelled && op != NULL && op->started && !op->done) {
+        gpgme_cancel_async(self->ctx);
+        cancelled = 1;
+    }
+    Py_END_ALLOW_THREADS;
+
+    return PyBool_FromLong(cancelled);
+}
+
+/* annotate exception with encrypt_result data */
+void
+pygpgme_decode_encrypt_result(PyGpgmeContext *self)
+{
+    PyObject *err_type, *err_value, *err_traceback;
+    gpgme_encrypt_result_t res;
+    gpgme_invalid_key_t key;
+    PyObject *list;
+
+    PyErr_Fetch(&err_type, &err_value, &err_traceback);
+    PyErr_NormalizeException(&err_type, &err_value, &err_traceback);
+
+    if (!PyErr_GivenExceptionMatches(err_type, pygpgme_error))
+        goto end;
+
+    res = gpgme_op_encrypt_result(self->ctx);
+    if (res == NULL)
+        goto end;
+
+    list = PyList_New(0);
+    for (key = res->invalid_recipients; key != NULL; key = key->next) {
+        PyObject *item, *err;
+
+        err = pygpgme_error_object(key->reason);
+        item = Py_BuildValue("(zN)", key->fpr, err);
+        PyList_Append(list, item);
+        Py_DECREF(item);
+    }
+
+    PyObject_SetAttrString(err_value, "invalid_recipients", list);
+    Py_DECREF(list);
+
+ end:
+    PyErr_Restore(err_type, err_value, err_traceback);
+}
+
+/* build the NULL terminated recipient array for a sequence of keys, or
+ * use the array of a gpgme.RecipientSet as it is.  None gives a NULL
+ * array, which gpgme takes as a request for symmetric encryption.
+ * *py_keys is set to a new reference that keeps the keys alive for as
+ * long as the array is in use, or NULL; both are released with
+ * pygpgme_recipients_free().  Returns -1 on error. */
+int
+pygpgme_recipients(PyObject *py_recp, gpgme_key_t **recp, PyObject **py_keys)
+{
+    int i, length;
+
+    *recp = NULL;
+    *py_keys = NULL;
+    if (py_recp == Py_None)
+        return 0;
+
+    if (PyObject_TypeCheck(py_recp, &PyGpgmeRecipientSet_Type)) {
+        if (((PyGpgmeRecipientSet *)py_recp)->keys == NULL) {
+            PyErr_SetString(PyExc_ValueError,
+                            "RecipientSet has not been initialised");
+            return -1;
+        }
+        Py_INCREF(py_recp);
+        *py_keys = py_recp;
+        *recp = ((PyGpgmeRecipientSet *)py_recp)->keys;
+        return 0;
+    }
+
+    py_recp = PySequence_Fast(py_recp,
+                              "first argument must be a sequence or None");
+    if (py_recp == NULL)
+        return -1;
+
+    length = PySequence_Fast_GET_SIZE(py_recp);
+    *recp = malloc((length + 1) * sizeof (gpgme_key_t));
+    if (*recp == NULL) {
         Py_DECREF(py_recp);
-        return NULL;    
+        PyErr_NoMemory();
+        return -1;
     }
-    if (pygpgme_data_new(&cipher, py_cipher)) {
+    for (i = 0; i < length; i++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(py_recp, i);
+
+        if (!PyObject_TypeCheck(item, &PyGpgmeKey_Type)) {
+            free(*recp);
+            *recp = NULL;
+            Py_DECREF(py_recp);
+            PyErr_SetString(PyExc_TypeError, "items in first argument must "
+                            "be gpgme.Key objects");
+            return -1;
+        }
+        (*recp)[i] = ((PyGpgmeKey *)item)->key;
+    }
+    (*recp)[i] = NULL;
+
+    *py_keys = py_recp;
+    return 0;
+}
+
+void
+pygpgme_recipients_free(gpgme_key_t *recp, PyObject *py_keys)
+{
+    if (py_keys == NULL ||
+        !PyObject_TypeCheck(py_keys, &PyGpgmeRecipientSet_Type))
         free(recp);
-        Py_DECREF(py_recp);
-        gpgme_data_release(plain);
-        return NULL;    
+    Py_XDECREF(py_keys);
+}
+
+/* encrypt py_plain to the given recipients, writing to cipher */
+static int
+context_encrypt(PyGpgmeContext *self, PyObject *py_recp, int flags,
+                PyObject *py_plain, gpgme_data_t cipher)
+{
+    gpgme_key_t *recp;
+    gpgme_data_t plain;
+    gpgme_error_t err;
+
+    if (pygpgme_recipients(py_recp, &recp, &py_recp) < 0)
+        return -1;
+
+    if (pygpgme_data_new(&plain, py_plain)) {
+        pygpgme_recipients_free(recp, py_recp);
+        return -1;
     }
 
     Py_BEGIN_ALLOW_THREADS;
+    pygpgme_op_begin(self, "encrypt");
     err = gpgme_op_encrypt(self->ctx, recp, flags, plain, cipher);
+    if (err == GPG_ERR_NO_ERROR)
+        err = pygpgme_data_flush(cipher);
+    err = pygpgme_op_end(self, err);
     Py_END_ALLOW_THREADS;
 
-    free(recp);
-    Py_DECREF(py_recp);
-    gpgme_data_release(plain);
-    gpgme_data_release(cipher);
+    pygpgme_recipients_free(recp, py_recp);
+    pygpgme_data_release(plain, py_plain);
 
     if (pygpgme_check_error(err)) {
-        decode_encrypt_result(self);
-        return NULL;
+        pygpgme_decode_encrypt_result(self);
+        return -1;
     }
 
+    return 0;
+}
+
+static PyObject *
+pygpgme_context_encrypt(PyGpgmeContext *self, PyObject *args)
+{
+    PyObject *py_recp, *py_plain, *py_cipher;
+    int flags, ret;
+    gpgme_data_t cipher;
+
+    if (!PyArg_ParseTuple(args, "OiOO", &py_recp, &flags,
+                          &py_plain, &py_cipher))
+        return NULL;
+
+    if (pygpgme_data_new_output(&cipher, py_cipher, self->write_buffer_size))
+        return NULL;
+
+    ret = context_encrypt(self, py_recp, flags, py_plain, cipher);
+    pygpgme_data_release(cipher, py_cipher);
+    if (ret < 0)
+        return NULL;
+
     Py_RETURN_NONE;
 }
 
+static PyObject *
+pygpgme_context_encrypt_bytes(PyGpgmeContext *self, PyObject *args)
+{
+    PyObject *py_recp, *py_plain;
+    int flags;
+    gpgme_data_t cipher;
+
+    if (!PyArg_ParseTuple(args, "OiO", &py_recp, &flags, &py_plain))
+        return NULL;
+
+    if (pygpgme_check_error(gpgme_data_new(&cipher)))
+        return NULL;
+
+    if (context_encrypt(self, py_recp, flags, py_plain, cipher) < 0) {
+        gpgme_data_release(cipher);
+        return NULL;
+    }
+
+    return pygpgme_data_release_and_get_string(cipher);
+}
+
+/* encrypt an iterable of chunks, returning an iterator over the chunks
+ * of ciphertext */
+static PyObject *
+pygpgme_context_encrypt_iter(PyGpgmeContext *self, PyObject *args)
+{
+    PyObject *py_recp, *py_chunks;
+    gpgme_key_t *recp;
+    int flags;
+
+    if (!PyArg_ParseTuple(args, "OiO", &py_recp, &flags, &py_chunks))
+        return NULL;
+
+    if (pygpgme_recipients(py_recp, &recp, &py_recp) < 0)
+        return NULL;
+
+    return pygpgme_stream_new(self, PYGPGME_STREAM_ENCRYPT, recp, py_recp,
+                              flags, py_chunks);
+}
+
+/* encrypt a list of (recipients, plaintext) jobs, returning a list of
+ * ciphertexts and errors */
+static PyObject *
+pygpgme_context_encrypt_many(PyGpgmeContext *self, PyObject *args)
+{
+    PyObject *py_jobs;
+    int flags = 0;
+
+    if (!PyArg_ParseTuple(args, "O|i", &py_jobs, &flags))
+        return NULL;
+
+    return pygpgme_encrypt_many(self, py_jobs, flags);
+}
+
 static PyObject *
 pygpgme_context_encrypt_sign(PyGpgmeContext *self, PyObject *args)
 {
     PyObject *py_recp, *py_plain, *py_cipher;
-    int flags, i, length;
+    int flags;
     gpgme_key_t *recp;
     gpgme_data_t plain, cipher;
     gpgme_error_t err;
@@ -515,46 +1398,31 @@ pygpgme_context_encrypt_sign(PyGpgmeContext *self, PyObject *args)
                           &py_plain, &py_cipher))
         return NULL;
 
-    py_recp = PySequence_Fast(py_recp, "first argument must be a sequence");
-    if (py_recp == NULL)
+    if (pygpgme_recipients(py_recp, &recp, &py_recp) < 0)
         return NULL;
 
-    length = PySequence_Fast_GET_SIZE(py_recp);
-    recp = malloc((length + 1) * sizeof (gpgme_key_t));
-    for (i = 0; i < length; i++) {
-        PyObject *item = PySequence_Fast_GET_ITEM(py_recp, i);
-
-        if (!PyObject_TypeCheck(item, &PyGpgmeKey_Type)) {
-            free(recp);
-            Py_DECREF(py_recp);
-            PyErr_SetString(PyExc_TypeError, "items in first argument must "
-                            "be gpgme.Key objects");
-            return NULL;
-        }
-        recp[i] = ((PyGpgmeKey *)item)->key;
-    }
-    recp[i] = NULL;
-
     if (pygpgme_data_new(&plain, py_plain)) {
-        free(recp);
-        Py_DECREF(py_recp);
+        pygpgme_recipients_free(recp, py_recp);
         return NULL;    
     }
-    if (pygpgme_data_new(&cipher, py_cipher)) {
-        free(recp);
-        Py_DECREF(py_recp);
-        gpgme_data_release(plain);
+    if (pygpgme_data_new_output(&cipher, py_cipher,
+                                self->write_buffer_size)) {
+        pygpgme_recipients_free(recp, py_recp);
+        pygpgme_data_release(plain, py_plain);
         return NULL;    
     }
 
     Py_BEGIN_ALLOW_THREADS;
+    pygpgme_op_begin(self, "encrypt_sign");
     err = gpgme_op_encrypt_sign(self->ctx, recp, flags, plain, cipher);
+    if (err == GPG_ERR_NO_ERROR)
+        err = pygpgme_data_flush(cipher);
+    err = pygpgme_op_end(self, err);
     Py_END_ALLOW_THREADS;
 
-    free(recp);
-    Py_DECREF(py_recp);
-    gpgme_data_release(plain);
-    gpgme_data_release(cipher);
+    pygpgme_recipients_free(recp, py_recp);
+    pygpgme_data_release(plain, py_plain);
+    pygpgme_data_release(cipher, py_cipher);
 
     result = gpgme_op_sign_result(self->ctx);
 
@@ -564,7 +1432,7 @@ pygpgme_context_encrypt_sign(PyGpgmeContext *self, PyObject *args)
         PyObject *list;
         gpgme_invalid_key_t key;
 
-        decode_encrypt_result(self);
+        pygpgme_decode_encrypt_result(self);
 
         PyErr_Fetch(&err_type, &err_value, &err_traceback);
         PyErr_NormalizeException(&err_type, &err_value, &err_traceback);
@@ -601,8 +1469,8 @@ pygpgme_context_encrypt_sign(PyGpgmeContext *self, PyObject *args)
         return PyList_New(0);
 }
 
-static void
-decode_decrypt_result(PyGpgmeContext *self)
+void
+pygpgme_decode_decrypt_result(PyGpgmeContext *self)
 {
     PyObject *err_type, *err_value, *err_traceback;
     PyObject *value;
@@ -639,72 +1507,95 @@ decode_decrypt_result(PyGpgmeContext *self)
     PyErr_Restore(err_type, err_value, err_traceback);
 }
 
-static PyObject *
-pygpgme_context_decrypt(PyGpgmeContext *self, PyObject *args)
+/* decrypt py_cipher, writing the plaintext to plain */
+static int
+context_decrypt(PyGpgmeContext *self, PyObject *py_cipher, gpgme_data_t plain)
 {
-    PyObject *py_cipher, *py_plain;
-    gpgme_data_t cipher, plain;
+    gpgme_data_t cipher;
     gpgme_error_t err;
 
-    if (!PyArg_ParseTuple(args, "OO", &py_cipher, &py_plain))
-        return NULL;
-
-    if (pygpgme_data_new(&cipher, py_cipher)) {
-        return NULL;
-    }
-
-    if (pygpgme_data_new(&plain, py_plain)) {
-        gpgme_data_release(cipher);
-        return NULL;    
-    }
+    if (pygpgme_data_new(&cipher, py_cipher))
+        return -1;
 
     Py_BEGIN_ALLOW_THREADS;
+    pygpgme_op_begin(self, "decrypt");
     err = gpgme_op_decrypt(self->ctx, cipher, plain);
+    if (err == GPG_ERR_NO_ERROR)
+        err = pygpgme_data_flush(plain);
+    err = pygpgme_op_end(self, err);
     Py_END_ALLOW_THREADS;
 
-    gpgme_data_release(cipher);
-    gpgme_data_release(plain);
+    pygpgme_data_release(cipher, py_cipher);
 
     if (pygpgme_check_error(err)) {
-        decode_decrypt_result(self);
-        return NULL;
+        pygpgme_decode_decrypt_result(self);
+        return -1;
     }
 
-    Py_RETURN_NONE;
+    return 0;
 }
 
 static PyObject *
-pygpgme_context_decrypt_verify(PyGpgmeContext *self, PyObject *args)
+pygpgme_context_decrypt(PyGpgmeContext *self, PyObject *args)
 {
     PyObject *py_cipher, *py_plain;
-    gpgme_data_t cipher, plain;
-    gpgme_error_t err;
-    gpgme_verify_result_t result;
+    gpgme_data_t plain;
+    int ret;
 
     if (!PyArg_ParseTuple(args, "OO", &py_cipher, &py_plain))
         return NULL;
 
-    if (pygpgme_data_new(&cipher, py_cipher)) {
+    if (pygpgme_data_new_output(&plain, py_plain, self->write_buffer_size))
         return NULL;
-    }
 
-    if (pygpgme_data_new(&plain, py_plain)) {
-        gpgme_data_release(cipher);
-        return NULL;    
-    }
+    ret = context_decrypt(self, py_cipher, plain);
+    pygpgme_data_release(plain, py_plain);
+    if (ret < 0)
+        return NULL;
 
-    Py_BEGIN_ALLOW_THREADS;
-    err = gpgme_op_decrypt_verify(self->ctx, cipher, plain);
-    Py_END_ALLOW_THREADS;
+    Py_RETURN_NONE;
+}
 
-    gpgme_data_release(cipher);
-    gpgme_data_release(plain);
+static PyObject *
+pygpgme_context_decrypt_bytes(PyGpgmeContext *self, PyObject *args)
+{
+    PyObject *py_cipher;
+    gpgme_data_t plain;
 
-    if (pygpgme_check_error(err)) {
-        decode_decrypt_result(self);
+    if (!PyArg_ParseTuple(args, "O", &py_cipher))
+        return NULL;
+
+    if (pygpgme_check_error(gpgme_data_new(&plain)))
+        return NULL;
+
+    if (context_decrypt(self, py_cipher, plain) < 0) {
+        gpgme_data_release(plain);
         return NULL;
     }
 
+    return pygpgme_data_release_and_get_string(plain);
+}
+/* decrypt an iterable of chunks, returning an iterator over the chunks
+ * of plaintext */
+static PyObject *
+pygpgme_context_decrypt_iter(PyGpgmeContext *self, PyObject *args)
+{
+    PyObject *py_chunks;
+
+    if (!PyArg_ParseTuple(args, "O", &py_chunks))
+        return NULL;
+
+    return pygpgme_stream_new(self, PYGPGME_STREAM_DECRYPT, NULL, NULL, 0,
+                              py_chunks);
+}
+
+/* the signatures checked by the last verify operation, or NULL with an
+ * annotated exception set if err is an error */
+PyObject *
+pygpgme_decode_verify_result(PyGpgmeContext *self, gpgme_error_t err)
+{
+    gpgme_verify_result_t result;
+
     result = gpgme_op_verify_result(self->ctx);
 
     /* annotate exception */
@@ -735,32 +1626,75 @@ pygpgme_context_decrypt_verify(PyGpgmeContext *self, PyObject *args)
         return PyList_New(0);
 }
 
+/* decrypt a list of ciphertexts, returning a list of plaintexts and
+ * errors */
 static PyObject *
-pygpgme_context_sign(PyGpgmeContext *self, PyObject *args)
+pygpgme_context_decrypt_many(PyGpgmeContext *self, PyObject *args)
 {
-    PyObject *py_plain, *py_sig;
-    gpgme_data_t plain, sig;
-    int sig_mode = GPGME_SIG_MODE_NORMAL;
+    PyObject *py_ciphers;
+
+    if (!PyArg_ParseTuple(args, "O", &py_ciphers))
+        return NULL;
+
+    return pygpgme_decrypt_many(self, py_ciphers, 0);
+}
+
+static PyObject *
+pygpgme_context_decrypt_verify(PyGpgmeContext *self, PyObject *args)
+{
+    PyObject *py_cipher, *py_plain;
+    gpgme_data_t cipher, plain;
     gpgme_error_t err;
-    gpgme_sign_result_t result;
 
-    if (!PyArg_ParseTuple(args, "OO|i", &py_plain, &py_sig, &sig_mode))
+    if (!PyArg_ParseTuple(args, "OO", &py_cipher, &py_plain))
         return NULL;
 
-    if (pygpgme_data_new(&plain, py_plain))
-        return NULL;    
+    if (pygpgme_data_new(&cipher, py_cipher)) {
+        return NULL;
+    }
 
-    if (pygpgme_data_new(&sig, py_sig)) {
-        gpgme_data_release(plain);
+    if (pygpgme_data_new_output(&plain, py_plain,
+                                self->write_buffer_size)) {
+        pygpgme_data_release(cipher, py_cipher);
         return NULL;    
     }
 
     Py_BEGIN_ALLOW_THREADS;
-    err = gpgme_op_sign(self->ctx, plain, sig, sig_mode);
+    pygpgme_op_begin(self, "decrypt_verify");
+    err = gpgme_op_decrypt_verify(self->ctx, cipher, plain);
+    if (err == GPG_ERR_NO_ERROR)
+        err = pygpgme_data_flush(plain);
+    err = pygpgme_op_end(self, err);
     Py_END_ALLOW_THREADS;
 
-    gpgme_data_release(plain);
-    gpgme_data_release(sig);
+    pygpgme_data_release(cipher, py_cipher);
+    pygpgme_data_release(plain, py_plain);
+
+    if (pygpgme_check_error(err)) {
+        pygpgme_decode_decrypt_result(self);
+        return NULL;
+    }
+
+    return pygpgme_decode_verify_result(self, err);
+}
+
+static PyObject *
+pygpgme_context_decrypt_verify_many(PyGpgmeContext *self, PyObject *args)
+{
+    PyObject *py_ciphers;
+
+    if (!PyArg_ParseTuple(args, "O", &py_ciphers))
+        return NULL;
+
+    return pygpgme_decrypt_many(self, py_ciphers, 1);
+}
+
+/* the list of new signatures made by the last sign operation, or NULL
+ * with an annotated exception set if err is an error */
+PyObject *
+pygpgme_decode_sign_result(PyGpgmeContext *self, gpgme_error_t err)
+{
+    gpgme_sign_result_t result;
 
     result = gpgme_op_sign_result(self->ctx);
 
@@ -783,35 +1717,99 @@ pygpgme_context_sign(PyGpgmeContext *self, PyObject *args)
         for (key = result->invalid_signers; key != NULL; key = key->next) {
             PyObject *item, *err;
 
-            err = pygpgme_error_object(key->reason);
-            item = Py_BuildValue("(zN)", key->fpr, err);
-            PyList_Append(list, item);
-            Py_DECREF(item);
-        }
-        PyObject_SetAttrString(err_value, "invalid_signers", list);
-        Py_DECREF(list);
+            err = pygpgme_error_object(key->reason);
+            item = Py_BuildValue("(zN)", key->fpr, err);
+            PyList_Append(list, item);
+            Py_DECREF(item);
+        }
+        PyObject_SetAttrString(err_value, "invalid_signers", list);
+        Py_DECREF(list);
+
+        list = pygpgme_newsiglist_new(result->signatures);
+        PyObject_SetAttrString(err_value, "signatures", list);
+        Py_DECREF(list);
+    end:
+        PyErr_Restore(err_type, err_value, err_traceback);
+        return NULL;
+    }
+
+    if (result)
+        return pygpgme_newsiglist_new(result->signatures);
+    else
+        return PyList_New(0);
+}
+
+/* sign py_plain, writing the signature to sig.  Returns the list of new
+ * signatures. */
+static PyObject *
+context_sign(PyGpgmeContext *self, PyObject *py_plain, gpgme_data_t sig,
+             int sig_mode)
+{
+    gpgme_data_t plain;
+    gpgme_error_t err;
+
+    if (pygpgme_data_new(&plain, py_plain))
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS;
+    pygpgme_op_begin(self, "sign");
+    err = gpgme_op_sign(self->ctx, plain, sig, sig_mode);
+    if (err == GPG_ERR_NO_ERROR)
+        err = pygpgme_data_flush(sig);
+    err = pygpgme_op_end(self, err);
+    Py_END_ALLOW_THREADS;
+
+    pygpgme_data_release(plain, py_plain);
+
+    return pygpgme_decode_sign_result(self, err);
+}
+
+static PyObject *
+pygpgme_context_sign(PyGpgmeContext *self, PyObject *args)
+{
+    PyObject *py_plain, *py_sig, *ret;
+    gpgme_data_t sig;
+    int sig_mode = GPGME_SIG_MODE_NORMAL;
+
+    if (!PyArg_ParseTuple(args, "OO|i", &py_plain, &py_sig, &sig_mode))
+        return NULL;
+
+    if (pygpgme_data_new_output(&sig, py_sig, self->write_buffer_size))
+        return NULL;
+
+    ret = context_sign(self, py_plain, sig, sig_mode);
+    pygpgme_data_release(sig, py_sig);
+    return ret;
+}
+
+static PyObject *
+pygpgme_context_sign_bytes(PyGpgmeContext *self, PyObject *args)
+{
+    PyObject *py_plain, *result;
+    gpgme_data_t sig;
+    int sig_mode = GPGME_SIG_MODE_NORMAL;
+
+    if (!PyArg_ParseTuple(args, "O|i", &py_plain, &sig_mode))
+        return NULL;
 
-        list = pygpgme_newsiglist_new(result->signatures);
-        PyObject_SetAttrString(err_value, "signatures", list);
-        Py_DECREF(list);
-    end:
-        PyErr_Restore(err_type, err_value, err_traceback);
+    if (pygpgme_check_error(gpgme_data_new(&sig)))
+        return NULL;
+
+    result = context_sign(self, py_plain, sig, sig_mode);
+    if (result == NULL) {
+        gpgme_data_release(sig);
         return NULL;
     }
+    Py_DECREF(result);
 
-    if (result)
-        return pygpgme_newsiglist_new(result->signatures);
-    else
-        return PyList_New(0);
+    return pygpgme_data_release_and_get_string(sig);
 }
-
 static PyObject *
 pygpgme_context_verify(PyGpgmeContext *self, PyObject *args)
 {
     PyObject *py_sig, *py_signed_text, *py_plaintext;
     gpgme_data_t sig, signed_text, plaintext;
     gpgme_error_t err;
-    gpgme_verify_result_t result;
 
     if (!PyArg_ParseTuple(args, "OOO", &py_sig, &py_signed_text,
                           &py_plaintext))
@@ -821,51 +1819,42 @@ pygpgme_context_verify(PyGpgmeContext *self, PyObject *args)
         return NULL;
     }
     if (pygpgme_data_new(&signed_text, py_signed_text)) {
-        gpgme_data_release(sig);
+        pygpgme_data_release(sig, py_sig);
         return NULL;    
     }
-    if (pygpgme_data_new(&plaintext, py_plaintext)) {
-        gpgme_data_release(sig);
-        gpgme_data_release(signed_text);
+    if (pygpgme_data_new_output(&plaintext, py_plaintext,
+                                self->write_buffer_size)) {
+        pygpgme_data_release(sig, py_sig);
+        pygpgme_data_release(signed_text, py_signed_text);
         return NULL;    
     }
 
     Py_BEGIN_ALLOW_THREADS;
+    pygpgme_op_begin(self, "verify");
     err = gpgme_op_verify(self->ctx, sig, signed_text, plaintext);
+    if (err == GPG_ERR_NO_ERROR)
+        err = pygpgme_data_flush(plaintext);
+    err = pygpgme_op_end(self, err);
     Py_END_ALLOW_THREADS;
 
-    gpgme_data_release(sig);
-    gpgme_data_release(signed_text);
-    gpgme_data_release(plaintext);
-
-    result = gpgme_op_verify_result(self->ctx);
-
-    /* annotate exception */
-    if (pygpgme_check_error(err)) {
-        PyObject *err_type, *err_value, *err_traceback;
-        PyObject *list;
-
-        PyErr_Fetch(&err_type, &err_value, &err_traceback);
-        PyErr_NormalizeException(&err_type, &err_value, &err_traceback);
+    pygpgme_data_release(sig, py_sig);
+    pygpgme_data_release(signed_text, py_signed_text);
+    pygpgme_data_release(plaintext, py_plaintext);
 
-        if (result == NULL)
-            goto end;
+    return pygpgme_decode_verify_result(self, err);
+}
 
-        if (!PyErr_GivenExceptionMatches(err_type, pygpgme_error))
-            goto end;
+/* verify a list of (signature, signed_text) jobs, returning a list of
+ * (plaintext, signatures) tuples and errors */
+static PyObject *
+pygpgme_context_verify_many(PyGpgmeContext *self, PyObject *args)
+{
+    PyObject *py_jobs;
 
-        list = pygpgme_siglist_new(result->signatures);
-        PyObject_SetAttrString(err_value, "signatures", list);
-        Py_DECREF(list);
-    end:
-        PyErr_Restore(err_type, err_value, err_traceback);
+    if (!PyArg_ParseTuple(args, "O", &py_jobs))
         return NULL;
-    }
 
-    if (result)
-        return pygpgme_siglist_new(result->signatures);
-    else
-        return PyList_New(0);
+    return pygpgme_verify_many(self, py_jobs);
 }
 
 static PyObject *
@@ -882,10 +1871,14 @@ pygpgme_context_import(PyGpgmeContext *self, PyObject *args)
         return NULL;
 
     Py_BEGIN_ALLOW_THREADS;
+    pygpgme_op_begin(self, "import");
     err = gpgme_op_import(self->ctx, keydata);
+    err = pygpgme_op_end(self, err);
     Py_END_ALLOW_THREADS;
+    /* some keys may have been imported even if it failed */
+    pygpgme_keycache_invalidate(self);
 
-    gpgme_data_release(keydata);
+    pygpgme_data_release(keydata, py_keydata);
     result = pygpgme_import_result(self->ctx);
     if (pygpgme_check_error(err)) {
         PyObject *err_type, *err_value, *err_traceback;
@@ -907,19 +1900,16 @@ pygpgme_context_import(PyGpgmeContext *self, PyObject *args)
     return result;
 }
 
-static PyObject *
-pygpgme_context_export(PyGpgmeContext *self, PyObject *args)
+/* export the keys matching py_pattern to keydata */
+static int
+context_export(PyGpgmeContext *self, PyObject *py_pattern,
+               gpgme_data_t keydata)
 {
-    PyObject *py_pattern, *py_keydata;
     const char *pattern;
     const char **patterns;
     int i, length;
-    gpgme_data_t keydata;
     gpgme_error_t err;
 
-    if (!PyArg_ParseTuple(args, "OO", &py_pattern, &py_keydata))
-        return NULL;
-
     if (py_pattern == Py_None) {
         Py_INCREF(py_pattern);
         pattern = NULL;
@@ -932,7 +1922,7 @@ pygpgme_context_export(PyGpgmeContext *self, PyObject *args)
         py_pattern = PySequence_Fast(py_pattern,
             "first argument must be a string or sequence of strings");
         if (py_pattern == NULL)
-            return NULL;
+            return -1;
         length = PySequence_Fast_GET_SIZE(py_pattern);
         pattern = NULL;
         patterns = malloc((length + 1) * sizeof(const char *));
@@ -944,36 +1934,73 @@ pygpgme_context_export(PyGpgmeContext *self, PyObject *args)
                     "first argument must be a string or sequence of strings");
                 free(patterns);
                 Py_DECREF(py_pattern);
-                return NULL;
+                return -1;
             }
             patterns[i] = PyString_AsString(item);
         }
         patterns[i] = NULL;
     }
 
-    if (pygpgme_data_new(&keydata, py_keydata)) {
-        Py_DECREF(py_pattern);
-        if (patterns)
-            free(patterns);
-        return NULL;
-    }
-
     Py_BEGIN_ALLOW_THREADS;
+    pygpgme_op_begin(self, "export");
     if (patterns)
         err = gpgme_op_export_ext(self->ctx, patterns, 0, keydata);
     else
         err = gpgme_op_export(self->ctx, pattern, 0, keydata);
+    if (err == GPG_ERR_NO_ERROR)
+        err = pygpgme_data_flush(keydata);
+    err = pygpgme_op_end(self, err);
     Py_END_ALLOW_THREADS;
 
     Py_DECREF(py_pattern);
     if (patterns)
         free(patterns);
-    gpgme_data_release(keydata);
     if (pygpgme_check_error(err))
+        return -1;
+    return 0;
+}
+
+static PyObject *
+pygpgme_context_export(PyGpgmeContext *self, PyObject *args)
+{
+    PyObject *py_pattern, *py_keydata;
+    gpgme_data_t keydata;
+    int ret;
+
+    if (!PyArg_ParseTuple(args, "OO", &py_pattern, &py_keydata))
+        return NULL;
+
+    if (pygpgme_data_new_output(&keydata, py_keydata,
+                                self->write_buffer_size))
+        return NULL;
+
+    ret = context_export(self, py_pattern, keydata);
+    pygpgme_data_release(keydata, py_keydata);
+    if (ret < 0)
         return NULL;
     Py_RETURN_NONE;
 }
 
+static PyObject *
+pygpgme_context_export_bytes(PyGpgmeContext *self, PyObject *args)
+{
+    PyObject *py_pattern;
+    gpgme_data_t keydata;
+
+    if (!PyArg_ParseTuple(args, "O", &py_pattern))
+        return NULL;
+
+    if (pygpgme_check_error(gpgme_data_new(&keydata)))
+        return NULL;
+
+    if (context_export(self, py_pattern, keydata) < 0) {
+        gpgme_data_release(keydata);
+        return NULL;
+    }
+
+    return pygpgme_data_release_and_get_string(keydata);
+}
+
 // pygpgme_context_genkey
 
 static PyObject *
@@ -987,8 +2014,11 @@ pygpgme_context_delete(PyGpgmeContext *self, PyObject *args)
         return NULL;
 
     Py_BEGIN_ALLOW_THREADS;
+    pygpgme_op_begin(self, "delete");
     err = gpgme_op_delete(self->ctx, key->key, allow_secret);
+    err = pygpgme_op_end(self, err);
     Py_END_ALLOW_THREADS;
+    pygpgme_keycache_invalidate(self);
 
     if (pygpgme_check_error(err))
         return NULL;
@@ -1002,13 +2032,15 @@ pygpgme_edit_cb(void *user_data, gpgme_status_code_t status,
     PyObject *callback, *ret;
     PyGILState_STATE state;
     gpgme_error_t err;
+    double start;
 
-    state = PyGILState_Ensure();
+    PYGPGME_STATS_ADD(edit_calls, 1);
+    state = pygpgme_callback_enter(&start);
     callback = (PyObject *)user_data;
     ret = PyObject_CallFunction(callback, "lzi", (long)status, args, fd);
     err = pygpgme_check_pyerror();
     Py_XDECREF(ret);
-    PyGILState_Release(state);
+    pygpgme_callback_leave(state, start);
     return err;
 }
 
@@ -1024,15 +2056,20 @@ pygpgme_context_edit(PyGpgmeContext *self, PyObject *args)
                           &py_out))
         return NULL;
 
-    if (pygpgme_data_new(&out, py_out))
+    if (pygpgme_data_new_output(&out, py_out, self->write_buffer_size))
         return NULL;
 
     Py_BEGIN_ALLOW_THREADS;
+    pygpgme_op_begin(self, "edit");
     err = gpgme_op_edit(self->ctx, key->key,
                         pygpgme_edit_cb, (void *)callback, out);
+    if (err == GPG_ERR_NO_ERROR)
+        err = pygpgme_data_flush(out);
+    err = pygpgme_op_end(self, err);
     Py_END_ALLOW_THREADS;
+    pygpgme_keycache_invalidate(self);
 
-    gpgme_data_release(out);
+    pygpgme_data_release(out, py_out);
 
     if (pygpgme_check_error(err))
         return NULL;
@@ -1051,33 +2088,48 @@ pygpgme_context_card_edit(PyGpgmeContext *self, PyObject *args)
                           &py_out))
         return NULL;
 
-    if (pygpgme_data_new(&out, py_out))
+    if (pygpgme_data_new_output(&out, py_out, self->write_buffer_size))
         return NULL;
 
     Py_BEGIN_ALLOW_THREADS;
+    pygpgme_op_begin(self, "card_edit");
     err = gpgme_op_card_edit(self->ctx, key->key,
                              pygpgme_edit_cb, (void *)callback, out);
+    if (err == GPG_ERR_NO_ERROR)
+        err = pygpgme_data_flush(out);
+    err = pygpgme_op_end(self, err);
     Py_END_ALLOW_THREADS;
+    pygpgme_keycache_invalidate(self);
 
-    gpgme_data_release(out);
+    pygpgme_data_release(out, py_out);
 
     if (pygpgme_check_error(err))
         return NULL;
     Py_RETURN_NONE;
 }
 
+/* list the keys matching a pattern or sequence of patterns.  With
+ * prefetch=n, up to n keys are listed ahead in a helper thread. */
 static PyObject *
-pygpgme_context_keylist(PyGpgmeContext *self, PyObject *args)
+pygpgme_context_keylist(PyGpgmeContext *self, PyObject *args,
+                        PyObject *kwargs)
 {
+    static char *kwlist[] = { "pattern", "secret_only", "prefetch", NULL };
     PyObject *py_pattern = Py_None;
     const char *pattern;
     const char **patterns;
     int secret_only = 0, i, length;
+    Py_ssize_t prefetch = 0;
     gpgme_error_t err;
     PyGpgmeKeyIter *ret;
 
-    if (!PyArg_ParseTuple(args, "|Oi", &py_pattern, &secret_only))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|Oin", kwlist,
+                                     &py_pattern, &secret_only, &prefetch))
+        return NULL;
+    if (prefetch < 0) {
+        PyErr_SetString(PyExc_ValueError, "prefetch must not be negative");
         return NULL;
+    }
 
     if (py_pattern == Py_None) {
         Py_INCREF(py_pattern);
@@ -1111,10 +2163,12 @@ pygpgme_context_keylist(PyGpgmeContext *self, PyObject *args)
     }
 
     Py_BEGIN_ALLOW_THREADS;
+    pygpgme_op_begin(self, "keylist");
     if (patterns)
         err = gpgme_op_keylist_ext_start(self->ctx, patterns, secret_only, 0);
     else
         err = gpgme_op_keylist_start(self->ctx, pattern, secret_only);
+    err = pygpgme_op_end(self, err);
     Py_END_ALLOW_THREADS;
 
     Py_DECREF(py_pattern);
@@ -1124,37 +2178,471 @@ pygpgme_context_keylist(PyGpgmeContext *self, PyObject *args)
     if (pygpgme_check_error(err))
         return NULL;
 
-    /* return a KeyIter object */
+    /* return a KeyIter object, holding the context until the keys have
+     * been listed */
     ret = PyObject_New(PyGpgmeKeyIter, &PyGpgmeKeyIter_Type);
     if (!ret)
         return NULL;
     Py_INCREF(self);
     ret->ctx = self;
+    pygpgme_context_hold(self, prefetch == 0);
+    ret->locked = 1;
+    ret->busy = 0;
+    ret->secret = secret_only;
+    ret->queue = NULL;
+    ret->err = GPG_ERR_NO_ERROR;
+    if (prefetch > 0 && pygpgme_keyiter_prefetch(ret, prefetch) < 0) {
+        Py_DECREF(ret);
+        return NULL;
+    }
     return (PyObject *)ret;
 }
 
+/* list the keys matching a pattern into columns of their fields,
+ * without creating a gpgme.Key for each */
+static PyObject *
+pygpgme_context_keylist_table(PyGpgmeContext *self, PyObject *args,
+                              PyObject *kwargs)
+{
+    static char *kwlist[] = { "pattern", "fields", "secret_only", NULL };
+    PyObject *py_pattern = Py_None, *py_fields = Py_None;
+    int secret_only = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OOi", kwlist,
+                                     &py_pattern, &py_fields, &secret_only))
+        return NULL;
+
+    return pygpgme_keylist_table(self, py_pattern, secret_only, py_fields);
+}
+
+/* The *_start() methods begin an operation and return a gpgme.Operation
+ * for it, without waiting for the engine. */
+
+static PyObject *
+pygpgme_context_encrypt_start(PyGpgmeContext *self, PyObject *args)
+{
+    PyObject *py_recp, *py_plain, *py_cipher;
+    PyGpgmeOperation *op;
+    gpgme_data_t plain, cipher;
+    gpgme_error_t err;
+    int flags;
+
+    if (!PyArg_ParseTuple(args, "OiOO", &py_recp, &flags,
+                          &py_plain, &py_cipher))
+        return NULL;
+
+    op = pygpgme_operation_new(self, PYGPGME_OP_ENCRYPT);
+    if (op == NULL)
+        return NULL;
+    if (pygpgme_recipients(py_recp, &op->recp, &op->py_recp) < 0 ||
+        pygpgme_data_new(&plain, py_plain) ||
+        pygpgme_operation_add_data(op, plain, py_plain, 0) ||
+        pygpgme_data_new_output(&cipher, py_cipher,
+                                self->write_buffer_size) ||
+        pygpgme_operation_add_data(op, cipher, py_cipher, 1)) {
+        Py_DECREF(op);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS;
+    err = gpgme_op_encrypt_start(self->ctx, op->recp, flags, plain, cipher);
+    Py_END_ALLOW_THREADS;
+
+    return pygpgme_operation_started(op, err);
+}
+
+static PyObject *
+pygpgme_context_decrypt_start(PyGpgmeContext *self, PyObject *args)
+{
+    PyObject *py_cipher, *py_plain;
+    PyGpgmeOperation *op;
+    gpgme_data_t cipher, plain;
+    gpgme_error_t err;
+
+    if (!PyArg_ParseTuple(args, "OO", &py_cipher, &py_plain))
+        return NULL;
+
+    op = pygpgme_operation_new(self, PYGPGME_OP_DECRYPT);
+    if (op == NULL)
+        return NULL;
+    if (pygpgme_data_new(&cipher, py_cipher) ||
+        pygpgme_operation_add_data(op, cipher, py_cipher, 0) ||
+        pygpgme_data_new_output(&plain, py_plain, self->write_buffer_size) ||
+        pygpgme_operation_add_data(op, plain, py_plain, 1)) {
+        Py_DECREF(op);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS;
+    err = gpgme_op_decrypt_start(self->ctx, cipher, plain);
+    Py_END_ALLOW_THREADS;
+
+    return pygpgme_operation_started(op, err);
+}
+
+static PyObject *
+pygpgme_context_sign_start(PyGpgmeContext *self, PyObject *args)
+{
+    PyObject *py_plain, *py_sig;
+    PyGpgmeOperation *op;
+    gpgme_data_t plain, sig;
+    gpgme_error_t err;
+    int sig_mode = GPGME_SIG_MODE_NORMAL;
+
+    if (!PyArg_ParseTuple(args, "OO|i", &py_plain, &py_sig, &sig_mode))
+        return NULL;
+
+    op = pygpgme_operation_new(self, PYGPGME_OP_SIGN);
+    if (op == NULL)
+        return NULL;
+    if (pygpgme_data_new(&plain, py_plain) ||
+        pygpgme_operation_add_data(op, plain, py_plain, 0) ||
+        pygpgme_data_new_output(&sig, py_sig, self->write_buffer_size) ||
+        pygpgme_operation_add_data(op, sig, py_sig, 1)) {
+        Py_DECREF(op);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS;
+    err = gpgme_op_sign_start(self->ctx, plain, sig, sig_mode);
+    Py_END_ALLOW_THREADS;
+
+    return pygpgme_operation_started(op, err);
+}
+
+static PyObject *
+pygpgme_context_verify_start(PyGpgmeContext *self, PyObject *args)
+{
+    PyObject *py_sig, *py_signed_text, *py_plaintext;
+    PyGpgmeOperation *op;
+    gpgme_data_t sig, signed_text, plaintext;
+    gpgme_error_t err;
+
+    if (!PyArg_ParseTuple(args, "OOO", &py_sig, &py_signed_text,
+                          &py_plaintext))
+        return NULL;
+
+    op = pygpgme_operation_new(self, PYGPGME_OP_VERIFY);
+    if (op == NULL)
+        return NULL;
+    if (pygpgme_data_new(&sig, py_sig) ||
+        pygpgme_operation_add_data(op, sig, py_sig, 0) ||
+        pygpgme_data_new(&signed_text, py_signed_text) ||
+        pygpgme_operation_add_data(op, signed_text, py_signed_text, 0) ||
+        pygpgme_data_new_output(&plaintext, py_plaintext,
+                                self->write_buffer_size) ||
+        pygpgme_operation_add_data(op, plaintext, py_plaintext, 1)) {
+        Py_DECREF(op);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS;
+    err = gpgme_op_verify_start(self->ctx, sig, signed_text, plaintext);
+    Py_END_ALLOW_THREADS;
+
+    return pygpgme_operation_started(op, err);
+}
+
+static PyObject *
+pygpgme_context_import_start(PyGpgmeContext *self, PyObject *args)
+{
+    PyObject *py_keydata;
+    PyGpgmeOperation *op;
+    gpgme_data_t keydata;
+    gpgme_error_t err;
+
+    if (!PyArg_ParseTuple(args, "O", &py_keydata))
+        return NULL;
+
+    op = pygpgme_operation_new(self, PYGPGME_OP_IMPORT);
+    if (op == NULL)
+        return NULL;
+    if (pygpgme_data_new(&keydata, py_keydata) ||
+        pygpgme_operation_add_data(op, keydata, py_keydata, 0)) {
+        Py_DECREF(op);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS;
+    err = gpgme_op_import_start(self->ctx, keydata);
+    Py_END_ALLOW_THREADS;
+
+    return pygpgme_operation_started(op, err);
+}
+
+static PyObject *
+pygpgme_context_keylist_start(PyGpgmeContext *self, PyObject *args)
+{
+    PyGpgmeOperation *op;
+    const char *pattern = NULL;
+    int secret_only = 0;
+    gpgme_error_t err;
+
+    if (!PyArg_ParseTuple(args, "|zi", &pattern, &secret_only))
+        return NULL;
+
+    op = pygpgme_operation_new(self, PYGPGME_OP_KEYLIST);
+    if (op == NULL)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS;
+    err = gpgme_op_keylist_start(self->ctx, pattern, secret_only);
+    Py_END_ALLOW_THREADS;
+
+    return pygpgme_operation_started(op, err);
+}
+
 // pygpgme_context_trustlist
 
+/* the methods using the gpgme context run with it held */
+#define LOCKED(method)                                          \
+    static PyObject *                                           \
+    method##_locked(PyGpgmeContext *self, PyObject *args)       \
+    {                                                           \
+        PyObject *ret;                                          \
+                                                                \
+        if (pygpgme_context_acquire(self) < 0)                  \
+            return NULL;                                        \
+        ret = method(self, args);                               \
+        pygpgme_context_release(self);                          \
+        return ret;                                             \
+    }
+
+#define LOCKED_KW(method)                                       \
+    static PyObject *                                           \
+    method##_locked(PyGpgmeContext *self, PyObject *args,       \
+                    PyObject *kwargs)                           \
+    {                                                           \
+        PyObject *ret;                                          \
+                                                                \
+        if (pygpgme_context_acquire(self) < 0)                  \
+            return NULL;                                        \
+        ret = method(self, args, kwargs);                       \
+        pygpgme_context_release(self);                          \
+        return ret;                                             \
+    }
+
+/* run a blocking method with the context held.  A timeout keyword
+ * argument replaces the context's timeout for the call; the method sees
+ * the other keyword arguments if it takes any. */
+static PyObject *
+context_call_timed(PyGpgmeContext *self, PyCFunctionWithKeywords method,
+                   int keywords, PyObject *args, PyObject *kwargs)
+{
+    PyObject *py_timeout = NULL, *ret;
+    double timeout = 0, saved;
+
+    if (kwargs != NULL)
+        py_timeout = PyDict_GetItemString(kwargs, "timeout");
+    if (py_timeout != NULL) {
+        if (parse_timeout(py_timeout, &timeout) < 0)
+            return NULL;
+        kwargs = PyDict_Copy(kwargs);
+        if (kwargs == NULL)
+            return NULL;
+        if (PyDict_DelItemString(kwargs, "timeout") < 0) {
+            Py_DECREF(kwargs);
+            return NULL;
+        }
+    } else
+        Py_XINCREF(kwargs);
+    if (!keywords && kwargs != NULL && PyDict_Size(kwargs) > 0) {
+        Py_DECREF(kwargs);
+        PyErr_SetString(PyExc_TypeError,
+                        "timeout is the only keyword argument accepted");
+        return NULL;
+    }
+
+    if (pygpgme_context_acquire(self) < 0) {
+        Py_XDECREF(kwargs);
+        return NULL;
+    }
+    saved = self->timeout;
+    if (py_timeout != NULL)
+        self->timeout = timeout;
+    if (keywords)
+        ret = method((PyObject *)self, args, kwargs);
+    else
+        ret = ((PyCFunction)method)((PyObject *)self, args);
+    self->timeout = saved;
+    pygpgme_context_release(self);
+    Py_XDECREF(kwargs);
+    return ret;
+}
+
+#define LOCKED_TIMED(method)                                    \
+    static PyObject *                                           \
+    method##_locked(PyGpgmeContext *self, PyObject *args,       \
+                    PyObject *kwargs)                           \
+    {                                                           \
+        return context_call_timed(                              \
+            self, (PyCFunctionWithKeywords)method, 0, args, kwargs); \
+    }
+
+#define LOCKED_KW_TIMED(method)                                 \
+    static PyObject *                                           \
+    method##_locked(PyGpgmeContext *self, PyObject *args,       \
+                    PyObject *kwargs)                           \
+    {                                                           \
+        return context_call_timed(                              \
+            self, (PyCFunctionWithKeywords)method, 1, args, kwargs); \
+    }
+
+LOCKED(pygpgme_context_set_locale)
+LOCKED(pygpgme_context_set_engine_info)
+LOCKED_TIMED(pygpgme_context_get_key)
+LOCKED_TIMED(pygpgme_context_get_keys)
+LOCKED_TIMED(pygpgme_context_encrypt)
+LOCKED_TIMED(pygpgme_context_encrypt_bytes)
+LOCKED(pygpgme_context_encrypt_iter)
+LOCKED(pygpgme_context_encrypt_start)
+LOCKED_TIMED(pygpgme_context_encrypt_many)
+LOCKED_TIMED(pygpgme_context_encrypt_sign)
+LOCKED_TIMED(pygpgme_context_decrypt)
+LOCKED_TIMED(pygpgme_context_decrypt_bytes)
+LOCKED(pygpgme_context_decrypt_iter)
+LOCKED(pygpgme_context_decrypt_start)
+LOCKED_TIMED(pygpgme_context_decrypt_many)
+LOCKED_TIMED(pygpgme_context_decrypt_verify)
+LOCKED_TIMED(pygpgme_context_decrypt_verify_many)
+LOCKED_TIMED(pygpgme_context_sign)
+LOCKED_TIMED(pygpgme_context_sign_bytes)
+LOCKED(pygpgme_context_sign_start)
+LOCKED_TIMED(pygpgme_context_verify)
+LOCKED(pygpgme_context_verify_start)
+LOCKED_TIMED(pygpgme_context_verify_many)
+LOCKED_TIMED(pygpgme_context_import)
+LOCKED(pygpgme_context_import_start)
+LOCKED_TIMED(pygpgme_context_export)
+LOCKED_TIMED(pygpgme_context_export_bytes)
+LOCKED_TIMED(pygpgme_context_delete)
+LOCKED_TIMED(pygpgme_context_edit)
+LOCKED_TIMED(pygpgme_context_card_edit)
+LOCKED_KW(pygpgme_context_keylist)
+LOCKED_KW_TIMED(pygpgme_context_keylist_table)
+LOCKED(pygpgme_context_keylist_start)
+
 static PyMethodDef pygpgme_context_methods[] = {
-    { "set_locale", (PyCFunction)pygpgme_context_set_locale, METH_VARARGS },
-    { "get_key", (PyCFunction)pygpgme_context_get_key, METH_VARARGS },
-    { "encrypt", (PyCFunction)pygpgme_context_encrypt, METH_VARARGS },
-    { "encrypt_sign", (PyCFunction)pygpgme_context_encrypt_sign, METH_VARARGS },
-    { "decrypt", (PyCFunction)pygpgme_context_decrypt, METH_VARARGS },
-    { "decrypt_verify", (PyCFunction)pygpgme_context_decrypt_verify, METH_VARARGS },
-    { "sign", (PyCFunction)pygpgme_context_sign, METH_VARARGS },
-    { "verify", (PyCFunction)pygpgme_context_verify, METH_VARARGS },
-    { "import_", (PyCFunction)pygpgme_context_import, METH_VARARGS },
-    { "export", (PyCFunction)pygpgme_context_export, METH_VARARGS },
+    { "set_locale", (PyCFunction)pygpgme_context_set_locale_locked, METH_VARARGS },
+    { "set_engine_info", (PyCFunction)pygpgme_context_set_engine_info_locked, METH_VARARGS },
+    { "get_engine_info", (PyCFunction)pygpgme_context_get_engine_info, METH_NOARGS },
+    { "get_key", (PyCFunction)pygpgme_context_get_key_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "get_keys", (PyCFunction)pygpgme_context_get_keys_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "cancel", (PyCFunction)pygpgme_context_cancel, METH_NOARGS },
+    { "encrypt", (PyCFunction)pygpgme_context_encrypt_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "encrypt_bytes", (PyCFunction)pygpgme_context_encrypt_bytes_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "encrypt_iter", (PyCFunction)pygpgme_context_encrypt_iter_locked, METH_VARARGS },
+    { "encrypt_start", (PyCFunction)pygpgme_context_encrypt_start_locked, METH_VARARGS },
+    { "encrypt_many", (PyCFunction)pygpgme_context_encrypt_many_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "encrypt_sign", (PyCFunction)pygpgme_context_encrypt_sign_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "decrypt", (PyCFunction)pygpgme_context_decrypt_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "decrypt_bytes", (PyCFunction)pygpgme_context_decrypt_bytes_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "decrypt_iter", (PyCFunction)pygpgme_context_decrypt_iter_locked, METH_VARARGS },
+    { "decrypt_start", (PyCFunction)pygpgme_context_decrypt_start_locked, METH_VARARGS },
+    { "decrypt_many", (PyCFunction)pygpgme_context_decrypt_many_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "decrypt_verify", (PyCFunction)pygpgme_context_decrypt_verify_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "decrypt_verify_many", (PyCFunction)pygpgme_context_decrypt_verify_many_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "sign", (PyCFunction)pygpgme_context_sign_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "sign_bytes", (PyCFunction)pygpgme_context_sign_bytes_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "sign_start", (PyCFunction)pygpgme_context_sign_start_locked, METH_VARARGS },
+    { "verify", (PyCFunction)pygpgme_context_verify_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "verify_start", (PyCFunction)pygpgme_context_verify_start_locked, METH_VARARGS },
+    { "verify_many", (PyCFunction)pygpgme_context_verify_many_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "import_", (PyCFunction)pygpgme_context_import_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "import_start", (PyCFunction)pygpgme_context_import_start_locked, METH_VARARGS },
+    { "export", (PyCFunction)pygpgme_context_export_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "export_bytes", (PyCFunction)pygpgme_context_export_bytes_locked,
+      METH_VARARGS | METH_KEYWORDS },
     // genkey
-    { "delete", (PyCFunction)pygpgme_context_delete, METH_VARARGS },
-    { "edit", (PyCFunction)pygpgme_context_edit, METH_VARARGS },
-    { "card_edit", (PyCFunction)pygpgme_context_card_edit, METH_VARARGS },
-    { "keylist", (PyCFunction)pygpgme_context_keylist, METH_VARARGS },
+    { "delete", (PyCFunction)pygpgme_context_delete_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "edit", (PyCFunction)pygpgme_context_edit_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "card_edit", (PyCFunction)pygpgme_context_card_edit_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "keylist", (PyCFunction)pygpgme_context_keylist_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "keylist_table", (PyCFunction)pygpgme_context_keylist_table_locked,
+      METH_VARARGS | METH_KEYWORDS },
+    { "keylist_start", (PyCFunction)pygpgme_context_keylist_start_locked, METH_VARARGS },
     // trustlist
     { NULL, 0, 0 }
 };
 
+/* whether the attribute is looked up on the calling thread's context
+ * in affinity mode: the operations and their statistics are, while the
+ * configuration stays on the shared context */
+static int
+context_routed(PyObject *name)
+{
+    const char *str;
+    PyMethodDef *method;
+
+    if (!PyString_Check(name))
+        return 0;
+    str = PyString_AS_STRING(name);
+    if (!strcmp(str, "last_op_stats"))
+        return 1;
+    if (!strcmp(str, "cancel") || !strcmp(str, "set_engine_info") ||
+        !strcmp(str, "get_engine_info"))
+        return 0;
+    for (method = pygpgme_context_methods; method->ml_name != NULL; method++)
+        if (!strcmp(str, method->ml_name))
+            return 1;
+    return 0;
+}
+
+static PyObject *
+pygpgme_context_getattro(PyGpgmeContext *self, PyObject *name)
+{
+    PyGpgmeContext *child;
+    PyObject *ret;
+
+    if (self->children == NULL || !context_routed(name))
+        return PyObject_GenericGetAttr((PyObject *)self, name);
+
+    child = context_thread_child(self);
+    if (child == NULL)
+        return NULL;
+    ret = PyObject_GenericGetAttr((PyObject *)child, name);
+    Py_DECREF(child);
+    return ret;
+}
+
+/* attributes are set with the context held, and in affinity mode are
+ * copied to each thread's context before it is next used */
+static int
+pygpgme_context_setattro(PyGpgmeContext *self, PyObject *name,
+                         PyObject *value)
+{
+    int ret;
+
+    if (pygpgme_context_acquire(self) < 0)
+        return -1;
+    ret = PyObject_GenericSetAttr((PyObject *)self, name, value);
+    pygpgme_context_release(self);
+    if (ret == 0)
+        self->generation++;
+    return ret;
+}
+
 PyTypeObject PyGpgmeContext_Type = {
     PyObject_HEAD_INIT(NULL)
     0,
@@ -1163,6 +2651,9 @@ PyTypeObject PyGpgmeContext_Type = {
     .tp_flags = Py_TPFLAGS_DEFAULT,
     .tp_dealloc = (destructor)pygpgme_context_dealloc,
     .tp_init = (initproc)pygpgme_context_init,
+    .tp_getattro = (getattrofunc)pygpgme_context_getattro,
+    .tp_setattro = (setattrofunc)pygpgme_context_setattro,
+    .tp_weaklistoffset = offsetof(PyGpgmeContext, weakreflist),
     .tp_getset = pygpgme_context_getsets,
     .tp_methods = pygpgme_context_methods,
 };
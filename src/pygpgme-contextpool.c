@@ -0,0 +1,594 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+    pygpgme - a Python wrapper for the gpgme library
+    Copyright (C) 2006  James Henstridge
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "pygpgme.h"
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+/* A ContextPool keeps a fixed number of configured contexts that threads
+ * lease one at a time, so callers don't pay for gpgme_new() and the
+ * attribute setup on every request and never share a context.
+ *
+ * The lists of contexts are only touched with the GIL held.  The count
+ * of idle contexts is also protected by a mutex, which is never held
+ * while taking the GIL, so that threads waiting for a context can sleep
+ * on the condition variable with the GIL released. */
+
+typedef struct {
+    PyObject_HEAD
+    int initialised;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    Py_ssize_t available;
+    Py_ssize_t size;
+    /* the contexts not leased out, and every context in the pool */
+    PyObject *idle;
+    PyObject *members;
+    /* attributes set on new contexts, and the values restored on the
+     * attributes a lease may change when it is returned */
+    PyObject *settings;
+    PyObject *baseline;
+    PyObject *engine_path;
+    PyObject *homedir;
+    /* lease statistics */
+    unsigned long leases;
+    unsigned long waits;
+    unsigned long timeouts;
+    unsigned long replaced;
+    double wait_time;
+    double max_wait_time;
+} PyGpgmeContextPool;
+
+static const char *const reset_attrs[] = {
+    "protocol", "armor", "textmode", "include_certs", "keylist_mode",
+    "passphrase_cb", "progress_cb", "signers", "write_buffer_size",
+    "collect_stats", "io_handler", "timeout", "catch_signals", "key_cache",
+    NULL
+};
+
+static void
+pygpgme_contextpool_dealloc(PyGpgmeContextPool *self)
+{
+    if (self->initialised) {
+        pthread_cond_destroy(&self->cond);
+        pthread_mutex_destroy(&self->lock);
+    }
+    Py_XDECREF(self->idle);
+    Py_XDECREF(self->members);
+    Py_XDECREF(self->settings);
+    Py_XDECREF(self->baseline);
+    Py_XDECREF(self->engine_path);
+    Py_XDECREF(self->homedir);
+    PyObject_Del(self);
+}
+
+static int
+apply_attrs(PyObject *ctx, PyObject *attrs)
+{
+    PyObject *name, *value;
+    Py_ssize_t pos = 0;
+
+    while (PyDict_Next(attrs, &pos, &name, &value)) {
+        if (PyObject_SetAttr(ctx, name, value) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int
+same_string(const char *a, const char *b)
+{
+    return a == b || (a != NULL && b != NULL && strcmp(a, b) == 0);
+}
+
+/* point the context's engine for its protocol at the pool's engine and
+ * home directory, and put back the defaults for other protocols whose
+ * engine info a lease changed */
+static int
+contextpool_set_engine_info(PyGpgmeContextPool *self, PyGpgmeContext *ctx)
+{
+    gpgme_protocol_t protocol = gpgme_get_protocol(ctx->ctx);
+    gpgme_engine_info_t info, defaults;
+    const char *engine_path = NULL, *homedir = NULL;
+
+    if (self->engine_path != NULL)
+        engine_path = PyString_AS_STRING(self->engine_path);
+    if (self->homedir != NULL)
+        homedir = PyString_AS_STRING(self->homedir);
+    if (pygpgme_check_error(gpgme_get_engine_info(&defaults)))
+        return -1;
+    for (info = gpgme_ctx_get_engine_info(ctx->ctx); info != NULL;
+         info = info->next) {
+        gpgme_engine_info_t def = defaults;
+
+        while (def != NULL && def->protocol != info->protocol)
+            def = def->next;
+        if (info->protocol == protocol || def == NULL ||
+            (same_string(info->file_name, def->file_name) &&
+             same_string(info->home_dir, def->home_dir)))
+            continue;
+        if (pygpgme_check_error(gpgme_ctx_set_engine_info(
+                ctx->ctx, info->protocol, NULL, NULL)))
+            return -1;
+    }
+    if (pygpgme_check_error(gpgme_ctx_set_engine_info(
+            ctx->ctx, protocol, engine_path, homedir)))
+        return -1;
+    return 0;
+}
+
+/* create a context configured with the pool's settings */
+static PyGpgmeContext *
+contextpool_new_context(PyGpgmeContextPool *self)
+{
+    PyGpgmeContext *ctx;
+
+    ctx = (PyGpgmeContext *)PyObject_CallObject(
+        (PyObject *)&PyGpgmeContext_Type, NULL);
+    if (ctx == NULL)
+        return NULL;
+
+    if (apply_attrs((PyObject *)ctx, self->settings) < 0 ||
+        ((self->engine_path != NULL || self->homedir != NULL) &&
+         contextpool_set_engine_info(self, ctx) < 0)) {
+        Py_DECREF(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+/* read the attributes restored on returned contexts from a freshly
+ * configured one */
+static PyObject *
+contextpool_get_baseline(PyObject *ctx)
+{
+    PyObject *baseline, *value;
+    int i;
+
+    baseline = PyDict_New();
+    if (baseline == NULL)
+        return NULL;
+    for (i = 0; reset_attrs[i] != NULL; i++) {
+        value = PyObject_GetAttrString(ctx, reset_attrs[i]);
+        if (value == NULL ||
+            PyDict_SetItemString(baseline, reset_attrs[i], value) < 0) {
+            Py_XDECREF(value);
+            Py_DECREF(baseline);
+            return NULL;
+        }
+        Py_DECREF(value);
+    }
+    return baseline;
+}
+
+static int
+pygpgme_contextpool_init(PyGpgmeContextPool *self, PyObject *args,
+                         PyObject *kwargs)
+{
+    static char *kwlist[] = { "size", "engine_path", "homedir", NULL };
+    PyObject *own_kwargs, *value;
+    PyObject *engine_path = Py_None, *homedir = Py_None;
+    PyGpgmeContext *ctx;
+    pthread_condattr_t attr;
+    Py_ssize_t size, i;
+    int ret;
+
+    if (self->initialised) {
+        PyErr_SetString(PyExc_ValueError, "pool already initialised");
+        return -1;
+    }
+
+    /* keyword arguments other than our own are context attributes */
+    self->settings = kwargs ? PyDict_Copy(kwargs) : PyDict_New();
+    own_kwargs = PyDict_New();
+    if (self->settings == NULL || own_kwargs == NULL) {
+        Py_XDECREF(own_kwargs);
+        return -1;
+    }
+    for (i = 0; kwlist[i] != NULL; i++) {
+        value = PyDict_GetItemString(self->settings, kwlist[i]);
+        if (value == NULL)
+            continue;
+        if (PyDict_SetItemString(own_kwargs, kwlist[i], value) < 0 ||
+            PyDict_DelItemString(self->settings, kwlist[i]) < 0) {
+            Py_DECREF(own_kwargs);
+            return -1;
+        }
+    }
+    ret = PyArg_ParseTupleAndKeywords(args, own_kwargs, "n|OO", kwlist,
+                                      &size, &engine_path, &homedir);
+    Py_DECREF(own_kwargs);
+    if (!ret)
+        return -1;
+
+    if (size <= 0) {
+        PyErr_SetString(PyExc_ValueError, "size must be positive");
+        return -1;
+    }
+    if ((engine_path != Py_None && !PyString_Check(engine_path)) ||
+        (homedir != Py_None && !PyString_Check(homedir))) {
+        PyErr_SetString(PyExc_TypeError,
+                        "engine_path and homedir must be strings or None");
+        return -1;
+    }
+    if (engine_path != Py_None) {
+        Py_INCREF(engine_path);
+        self->engine_path = engine_path;
+    }
+    if (homedir != Py_None) {
+        Py_INCREF(homedir);
+        self->homedir = homedir;
+    }
+
+    self->idle = PyList_New(0);
+    self->members = PyList_New(0);
+    if (self->idle == NULL || self->members == NULL)
+        return -1;
+
+    for (i = 0; i < size; i++) {
+        ctx = contextpool_new_context(self);
+        if (ctx == NULL)
+            return -1;
+        if (self->baseline == NULL)
+            self->baseline = contextpool_get_baseline((PyObject *)ctx);
+        if (self->baseline == NULL ||
+            PyList_Append(self->idle, (PyObject *)ctx) < 0 ||
+            PyList_Append(self->members, (PyObject *)ctx) < 0) {
+            Py_DECREF(ctx);
+            return -1;
+        }
+        Py_DECREF(ctx);
+    }
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&self->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&self->lock, NULL);
+    self->size = size;
+    self->available = size;
+    self->initialised = 1;
+    return 0;
+}
+
+/* take an idle context, waiting up to timeout seconds for one to be
+ * returned (forever if timeout is negative).  Returns None if none
+ * became available in time. */
+static PyObject *
+contextpool_acquire(PyGpgmeContextPool *self, double timeout)
+{
+    PyObject *ctx;
+    Py_ssize_t length;
+    struct timespec deadline;
+    double start, waited;
+    int acquired = 1;
+
+    pthread_mutex_lock(&self->lock);
+    if (self->available > 0) {
+        self->available--;
+        pthread_mutex_unlock(&self->lock);
+    } else {
+        pthread_mutex_unlock(&self->lock);
+
+        start = pygpgme_now();
+        Py_BEGIN_ALLOW_THREADS;
+        if (timeout >= 0) {
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += (time_t)timeout;
+            deadline.tv_nsec += (long)((timeout - (time_t)timeout) * 1e9);
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+        }
+        pthread_mutex_lock(&self->lock);
+        while (self->available == 0) {
+            if (timeout < 0)
+                pthread_cond_wait(&self->cond, &self->lock);
+            else if (pthread_cond_timedwait(&self->cond, &self->lock,
+                                            &deadline) == ETIMEDOUT)
+                break;
+        }
+        if (self->available > 0)
+            self->available--;
+        else
+            acquired = 0;
+        pthread_mutex_unlock(&self->lock);
+        Py_END_ALLOW_THREADS;
+
+        waited = pygpgme_now() - start;
+        self->waits++;
+        self->wait_time += waited;
+        if (waited > self->max_wait_time)
+            self->max_wait_time = waited;
+        if (!acquired) {
+            self->timeouts++;
+            Py_RETURN_NONE;
+        }
+    }
+    self->leases++;
+
+    /* the most recently returned context is the warmest */
+    length = PyList_GET_SIZE(self->idle);
+    ctx = PyList_GET_ITEM(self->idle, length - 1);
+    Py_INCREF(ctx);
+    if (PyList_SetSlice(self->idle, length - 1, length, NULL) < 0) {
+        Py_DECREF(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+/* restore the attributes and engine info a lease may have changed, so
+ * the next lessee doesn't get the previous one's keyring */
+static int
+contextpool_reset(PyGpgmeContextPool *self, PyGpgmeContext *ctx)
+{
+    if (ctx->op != NULL)
+        return -1;
+    gpgme_signers_clear(ctx->ctx);
+    ctx->stats.valid = 0;
+    if (apply_attrs((PyObject *)ctx, self->baseline) < 0)
+        return -1;
+    return contextpool_set_engine_info(self, ctx);
+}
+
+static int
+contextpool_release(PyGpgmeContextPool *self, PyObject *ctx)
+{
+    PyObject *fresh;
+    Py_ssize_t i;
+    int ret;
+
+    i = PySequence_Index(self->members, ctx);
+    if (i < 0) {
+        PyErr_Clear();
+        PyErr_SetString(PyExc_ValueError,
+                        "context does not belong to this pool");
+        return -1;
+    }
+    ret = PySequence_Contains(self->idle, ctx);
+    if (ret != 0) {
+        if (ret > 0)
+            PyErr_SetString(PyExc_ValueError, "context is not leased");
+        return -1;
+    }
+
+    /* contexts left with an operation in progress, or that can't be
+     * reset, are replaced */
+    if (contextpool_reset(self, (PyGpgmeContext *)ctx) < 0) {
+        PyErr_Clear();
+        fresh = (PyObject *)contextpool_new_context(self);
+        if (fresh == NULL ||
+            PyList_SetItem(self->members, i, fresh) < 0) {
+            /* the pool shrinks rather than hand out a dirty context */
+            PySequence_DelItem(self->members, i);
+            self->size--;
+            return -1;
+        }
+        ctx = fresh;
+        self->replaced++;
+    }
+
+    if (PyList_Append(self->idle, ctx) < 0)
+        return -1;
+
+    pthread_mutex_lock(&self->lock);
+    self->available++;
+    pthread_cond_signal(&self->cond);
+    pthread_mutex_unlock(&self->lock);
+    return 0;
+}
+
+static int
+parse_timeout(PyObject *py_timeout, double *timeout)
+{
+    *timeout = -1;
+    if (py_timeout == Py_None)
+        return 0;
+    *timeout = PyFloat_AsDouble(py_timeout);
+    if (PyErr_Occurred())
+        return -1;
+    if (*timeout < 0) {
+        PyErr_SetString(PyExc_ValueError, "timeout must be non-negative");
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *
+pygpgme_contextpool_acquire(PyGpgmeContextPool *self, PyObject *args)
+{
+    PyObject *py_timeout = Py_None;
+    double timeout;
+
+    if (!PyArg_ParseTuple(args, "|O", &py_timeout))
+        return NULL;
+    if (parse_timeout(py_timeout, &timeout) < 0)
+        return NULL;
+    return contextpool_acquire(self, timeout);
+}
+
+static PyObject *
+pygpgme_contextpool_release(PyGpgmeContextPool *self, PyObject *args)
+{
+    PyObject *ctx;
+
+    if (!PyArg_ParseTuple(args, "O!", &PyGpgmeContext_Type, &ctx))
+        return NULL;
+    if (contextpool_release(self, ctx) < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject *pygpgme_contextlease_new(PyGpgmeContextPool *pool,
+                                          double timeout);
+
+static PyObject *
+pygpgme_contextpool_lease(PyGpgmeContextPool *self, PyObject *args)
+{
+    PyObject *py_timeout = Py_None;
+    double timeout;
+
+    if (!PyArg_ParseTuple(args, "|O", &py_timeout))
+        return NULL;
+    if (parse_timeout(py_timeout, &timeout) < 0)
+        return NULL;
+    return pygpgme_contextlease_new(self, timeout);
+}
+
+static PyMethodDef pygpgme_contextpool_methods[] = {
+    { "acquire", (PyCFunction)pygpgme_contextpool_acquire, METH_VARARGS },
+    { "release", (PyCFunction)pygpgme_contextpool_release, METH_VARARGS },
+    { "lease", (PyCFunction)pygpgme_contextpool_lease, METH_VARARGS },
+    { NULL, 0, 0 }
+};
+
+static PyObject *
+pygpgme_contextpool_get_size(PyGpgmeContextPool *self)
+{
+    return PyInt_FromSsize_t(self->size);
+}
+
+static PyObject *
+pygpgme_contextpool_get_available(PyGpgmeContextPool *self)
+{
+    if (self->idle == NULL)
+        return PyInt_FromLong(0);
+    return PyInt_FromSsize_t(PyList_GET_SIZE(self->idle));
+}
+
+static PyObject *
+pygpgme_contextpool_get_stats(PyGpgmeContextPool *self)
+{
+    return Py_BuildValue("{s:k,s:k,s:k,s:k,s:d,s:d}",
+                         "leases", self->leases,
+                         "waits", self->waits,
+                         "timeouts", self->timeouts,
+                         "replaced", self->replaced,
+                         "wait_time", self->wait_time,
+                         "max_wait_time", self->max_wait_time);
+}
+
+static PyGetSetDef pygpgme_contextpool_getsets[] = {
+    { "size", (getter)pygpgme_contextpool_get_size },
+    { "available", (getter)pygpgme_contextpool_get_available },
+    { "stats", (getter)pygpgme_contextpool_get_stats },
+    { NULL, (getter)0, (setter)0 }
+};
+
+PyTypeObject PyGpgmeContextPool_Type = {
+    PyObject_HEAD_INIT(NULL)
+    0,
+    "gpgme.ContextPool",
+    sizeof(PyGpgmeContextPool),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_init = (initproc)pygpgme_contextpool_init,
+    .tp_dealloc = (destructor)pygpgme_contextpool_dealloc,
+    .tp_methods = pygpgme_contextpool_methods,
+    .tp_getset = pygpgme_contextpool_getsets,
+};
+
+/* the context manager returned by ContextPool.lease() */
+typedef struct {
+    PyObject_HEAD
+    PyGpgmeContextPool *pool;
+    double timeout;
+    PyObject *ctx;
+} PyGpgmeContextLease;
+
+static void
+pygpgme_contextlease_dealloc(PyGpgmeContextLease *self)
+{
+    Py_XDECREF(self->ctx);
+    Py_XDECREF(self->pool);
+    PyObject_Del(self);
+}
+
+static PyObject *
+pygpgme_contextlease_enter(PyGpgmeContextLease *self)
+{
+    PyObject *ctx;
+
+    if (self->ctx != NULL) {
+        PyErr_SetString(PyExc_ValueError, "lease already entered");
+        return NULL;
+    }
+    ctx = contextpool_acquire(self->pool, self->timeout);
+    if (ctx == NULL)
+        return NULL;
+    if (ctx == Py_None) {
+        Py_DECREF(ctx);
+        pygpgme_check_error(gpgme_error(GPG_ERR_TIMEOUT));
+        return NULL;
+    }
+    self->ctx = ctx;
+    Py_INCREF(ctx);
+    return ctx;
+}
+
+static PyObject *
+pygpgme_contextlease_exit(PyGpgmeContextLease *self, PyObject *args)
+{
+    PyObject *ctx = self->ctx;
+    int ret;
+
+    if (ctx == NULL)
+        Py_RETURN_FALSE;
+    self->ctx = NULL;
+    ret = contextpool_release(self->pool, ctx);
+    Py_DECREF(ctx);
+    if (ret < 0)
+        return NULL;
+    Py_RETURN_FALSE;
+}
+
+static PyMethodDef pygpgme_contextlease_methods[] = {
+    { "__enter__", (PyCFunction)pygpgme_contextlease_enter, METH_NOARGS },
+    { "__exit__", (PyCFunction)pygpgme_contextlease_exit, METH_VARARGS },
+    { NULL, 0, 0 }
+};
+
+PyTypeObject PyGpgmeContextLease_Type = {
+    PyObject_HEAD_INIT(NULL)
+    0,
+    "gpgme.ContextLease",
+    sizeof(PyGpgmeContextLease),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_init = pygpgme_no_constructor,
+    .tp_dealloc = (destructor)pygpgme_contextlease_dealloc,
+    .tp_methods = pygpgme_contextlease_methods,
+};
+
+static PyObject *
+pygpgme_contextlease_new(PyGpgmeContextPool *pool, double timeout)
+{
+    PyGpgmeContextLease *self;
+
+    self = PyObject_New(PyGpgmeContextLease, &PyGpgmeContextLease_Type);
+    if (self == NULL)
+        return NULL;
+    Py_INCREF(pool);
+    self->pool = pool;
+    self->timeout = timeout;
+    self->ctx = NULL;
+    return (PyObject *)self;
+}
@@ -19,6 +19,9 @@
  */
 #include <Python.h>
 #include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
 #include "pygpgme.h"
 
 /* called when a Python exception is set.  Clears the exception and tries
@@ -48,59 +51,236 @@ set_errno(void)
     Py_DECREF(exc);
 }
 
+/* state for a Python file-like object driven through the callbacks */
+typedef struct {
+    PyObject *fp;
+    /* fp has readinto(), so reads can fill gpgme's buffer directly */
+    int readinto;
+    /* fp is a binary io object, whose write() accepts any buffer */
+    int write_buffers;
+    /* the current stream position, or -1 if it is not known */
+    off_t position;
+    /* output waiting to be passed to write(), coalescing small chunks */
+    char *buffer;
+    size_t buffer_size;
+    size_t buffer_used;
+} PyGpgmeFileStream;
+
+/* wrap a chunk of memory owned by gpgme in a memoryview.  The view is
+ * only valid for the duration of the callback it is passed to. */
+static PyObject *
+memoryview_new(const void *buffer, size_t size, int readonly)
+{
+    Py_buffer view;
+
+    if (PyBuffer_FillInfo(&view, NULL, (void *)buffer, size, readonly,
+                          PyBUF_CONTIG) < 0)
+        return NULL;
+    return PyMemoryView_FromBuffer(&view);
+}
+
+/* pass a chunk of output to the Python object's write() method.  Must
+ * be called with the GIL held. */
 static ssize_t
-read_cb(void *handle, void *buffer, size_t size)
+write_chunk(PyGpgmeFileStream *stream, const void *buffer, size_t size)
 {
-    PyGILState_STATE state;
-    PyObject *fp = handle;
-    PyObject *result;
-    int result_size;
+    PyObject *result, *memview;
+    ssize_t bytes_written;
 
-    state = PyGILState_Ensure();
-    result = PyObject_CallMethod(fp, "read", "l", (long)size);
-    /* check for exceptions or non-string return values */
+    if (stream->write_buffers) {
+        memview = memoryview_new(buffer, size, 1);
+        if (memview == NULL) {
+            set_errno();
+            return -1;
+        }
+        result = PyObject_CallMethod(stream->fp, "write", "(O)", memview);
+        Py_DECREF(memview);
+    } else {
+        result = PyObject_CallMethod(stream->fp, "write", "s#",
+                                     buffer, (int)size);
+    }
     if (result == NULL) {
         set_errno();
-        result_size = -1;
-        goto end;
+        return -1;
     }
-    /* if we don't have a string return value, consider that an error too */
-    if (!PyString_Check(result)) {
+    /* non-blocking raw streams return None when nothing was written */
+    if (stream->write_buffers && result == Py_None) {
         Py_DECREF(result);
-        errno = EINVAL;
+        errno = EAGAIN;
+        return -1;
+    }
+    /* io objects report short writes; everything else writes it all */
+    bytes_written = size;
+    if (stream->write_buffers) {
+        bytes_written = PyInt_AsSsize_t(result);
+        if (bytes_written == -1 && PyErr_Occurred()) {
+            Py_DECREF(result);
+            set_errno();
+            return -1;
+        }
+    }
+    Py_DECREF(result);
+    return bytes_written;
+}
+
+/* write out any buffered output.  Must be called with the GIL held. */
+static int
+flush_stream(PyGpgmeFileStream *stream)
+{
+    size_t offset = 0;
+    ssize_t bytes_written;
+
+    while (offset < stream->buffer_used) {
+        bytes_written = write_chunk(stream, stream->buffer + offset,
+                                    stream->buffer_used - offset);
+        if (bytes_written <= 0) {
+            if (bytes_written == 0)
+                errno = EIO;
+            /* keep whatever has not been written yet */
+            memmove(stream->buffer, stream->buffer + offset,
+                    stream->buffer_used - offset);
+            stream->buffer_used -= offset;
+            return -1;
+        }
+        offset += bytes_written;
+    }
+    stream->buffer_used = 0;
+    return 0;
+}
+
+static ssize_t
+read_cb(void *handle, void *buffer, size_t size)
+{
+    PyGILState_STATE state;
+    PyGpgmeFileStream *stream = handle;
+    PyObject *result, *memview;
+    Py_ssize_t result_size;
+    double start;
+
+    state = pygpgme_callback_enter(&start);
+    if (flush_stream(stream) < 0) {
         result_size = -1;
         goto end;
     }
-    /* copy the result into the given buffer */
-    result_size = PyString_Size(result);
-    if (result_size > size)
-        result_size = size;
-    memcpy(buffer, PyString_AsString(result), result_size);
-    Py_DECREF(result);
+    if (stream->readinto) {
+        memview = memoryview_new(buffer, size, 0);
+        if (memview == NULL) {
+            set_errno();
+            result_size = -1;
+            goto end;
+        }
+        result = PyObject_CallMethod(stream->fp, "readinto", "(O)", memview);
+        Py_DECREF(memview);
+        if (result == NULL) {
+            set_errno();
+            result_size = -1;
+            goto end;
+        }
+        /* non-blocking raw streams return None when no data is ready */
+        if (result == Py_None) {
+            Py_DECREF(result);
+            errno = EAGAIN;
+            result_size = -1;
+            goto end;
+        }
+        result_size = PyInt_AsSsize_t(result);
+        Py_DECREF(result);
+        if (result_size == -1 && PyErr_Occurred()) {
+            set_errno();
+            goto end;
+        }
+        if (result_size < 0 || result_size > size) {
+            errno = EINVAL;
+            result_size = -1;
+            goto end;
+        }
+    } else {
+        result = PyObject_CallMethod(stream->fp, "read", "l", (long)size);
+        /* check for exceptions or non-string return values */
+        if (result == NULL) {
+            set_errno();
+            result_size = -1;
+            goto end;
+        }
+        /* if we don't have a string return value, consider that an error
+         * too */
+        if (!PyString_Check(result)) {
+            Py_DECREF(result);
+            errno = EINVAL;
+            result_size = -1;
+            goto end;
+        }
+        /* copy the result into the given buffer */
+        result_size = PyString_Size(result);
+        if (result_size > size)
+            result_size = size;
+        memcpy(buffer, PyString_AsString(result), result_size);
+        Py_DECREF(result);
+    }
+    if (stream->position >= 0)
+        stream->position += result_size;
  end:
-    PyGILState_Release(state);
+    PYGPGME_STATS_ADD(read_calls, 1);
+    if (result_size > 0)
+        PYGPGME_STATS_ADD(bytes_read, result_size);
+    pygpgme_callback_leave(state, start);
     return result_size;
 }
 
+/* A zero length write flushes the output buffer: see pygpgme_data_flush */
 static ssize_t
 write_cb(void *handle, const void *buffer, size_t size)
 {
     PyGILState_STATE state;
-    PyObject *fp = handle;
-    PyObject *result;
+    PyGpgmeFileStream *stream = handle;
     ssize_t bytes_written = 0;
+    double start;
 
-    state = PyGILState_Ensure();
-    result = PyObject_CallMethod(fp, "write", "s#", buffer, (int)size);
-    if (result == NULL) {
-        set_errno();
+    if (size > 0) {
+        PYGPGME_STATS_ADD(write_calls, 1);
+        PYGPGME_STATS_ADD(bytes_written, size);
+    }
+    if (stream->buffer_size > 0) {
+        /* small chunks are appended to the buffer without needing the
+         * GIL at all */
+        if (size > 0 && stream->buffer_used + size <= stream->buffer_size &&
+            size < stream->buffer_size) {
+            if (stream->buffer == NULL) {
+                stream->buffer = malloc(stream->buffer_size);
+                if (stream->buffer == NULL) {
+                    errno = ENOMEM;
+                    return -1;
+                }
+            }
+            memcpy(stream->buffer + stream->buffer_used, buffer, size);
+            stream->buffer_used += size;
+            if (stream->position >= 0)
+                stream->position += size;
+            return size;
+        }
+    }
+    if (size == 0 && stream->buffer_used == 0)
+        return 0;
+
+    state = pygpgme_callback_enter(&start);
+    if (flush_stream(stream) < 0) {
         bytes_written = -1;
         goto end;
     }
-    Py_DECREF(result);
-    bytes_written = size;
+    if (size > 0) {
+        if (stream->buffer_size > 0 && size < stream->buffer_size) {
+            /* the buffer is now empty, so the chunk fits */
+            memcpy(stream->buffer, buffer, size);
+            stream->buffer_used = size;
+            bytes_written = size;
+        } else {
+            bytes_written = write_chunk(stream, buffer, size);
+        }
+        if (bytes_written > 0 && stream->position >= 0)
+            stream->position += bytes_written;
+    }
  end:
-    PyGILState_Release(state);
+    pygpgme_callback_leave(state, start);
     return bytes_written;
 }
 
@@ -108,20 +288,50 @@ static off_t
 seek_cb(void *handle, off_t offset, int whence)
 {
     PyGILState_STATE state;
-    PyObject *fp = handle;
+    PyGpgmeFileStream *stream = handle;
     PyObject *result;
+    double start;
 
-    state = PyGILState_Ensure();
-    result = PyObject_CallMethod(fp, "seek", "li", (long)offset, whence);
+    PYGPGME_STATS_ADD(seek_calls, 1);
+    state = pygpgme_callback_enter(&start);
+    if (flush_stream(stream) < 0) {
+        offset = -1;
+        goto end;
+    }
+    result = PyObject_CallMethod(stream->fp, "seek", "li",
+                                 (long)offset, whence);
     if (result == NULL) {
         set_errno();
         offset = -1;
         goto end;
     }
+
+    /* io objects return the new position from seek(); otherwise work it
+     * out ourselves where possible, and only ask tell() as a last
+     * resort. */
+    if (PyInt_Check(result) || PyLong_Check(result)) {
+        offset = PyInt_AsLong(result);
+        Py_DECREF(result);
+        if (offset == -1 && PyErr_Occurred()) {
+            set_errno();
+            goto end;
+        }
+        stream->position = offset;
+        goto end;
+    }
     Py_DECREF(result);
+    if (whence == SEEK_SET) {
+        stream->position = offset;
+        goto end;
+    }
+    if (whence == SEEK_CUR && stream->position >= 0) {
+        offset += stream->position;
+        stream->position = offset;
+        goto end;
+    }
 
     /* now get the file location */
-    result = PyObject_CallMethod(fp, "tell", NULL);
+    result = PyObject_CallMethod(stream->fp, "tell", NULL);
     if (result == NULL) {
         set_errno();
         offset = -1;
@@ -135,8 +345,9 @@ seek_cb(void *handle, off_t offset, int whence)
     }
     offset = PyInt_AsLong(result);
     Py_DECREF(result);
+    stream->position = offset;
  end:
-    PyGILState_Release(state);
+    pygpgme_callback_leave(state, start);
     return offset;
 }
 
@@ -144,11 +355,17 @@ static void
 release_cb(void *handle)
 {
     PyGILState_STATE state;
-    PyObject *fp = handle;
+    PyGpgmeFileStream *stream = handle;
 
     state = PyGILState_Ensure();
-    Py_DECREF(fp);
+    /* errors can't be reported from here, which is why the context
+     * methods flush their outputs explicitly */
+    if (flush_stream(stream) < 0)
+        PyErr_Clear();
+    Py_DECREF(stream->fp);
     PyGILState_Release(state);
+    free(stream->buffer);
+    PyMem_Free(stream);
 }
 
 static struct gpgme_data_cbs python_data_cbs = {
@@ -158,24 +375,613 @@ static struct gpgme_data_cbs python_data_cbs = {
     .release = release_cb,
 };
 
-/* create a gpgme data object wrapping a Python file like object */
+/* Check whether fp is a binary stream from the io module.  Their write()
+ * methods accept any object supporting the buffer protocol, whereas
+ * classic file-likes such as StringIO would str() a memoryview. */
+static int
+is_binary_io(PyObject *fp)
+{
+    static PyObject *raw_type = NULL, *buffered_type = NULL;
+    int ret;
+
+    if (raw_type == NULL) {
+        PyObject *io = PyImport_ImportModule("io");
+
+        if (io == NULL)
+            return -1;
+        raw_type = PyObject_GetAttrString(io, "RawIOBase");
+        buffered_type = PyObject_GetAttrString(io, "BufferedIOBase");
+        Py_DECREF(io);
+        if (raw_type == NULL || buffered_type == NULL) {
+            Py_CLEAR(raw_type);
+            Py_CLEAR(buffered_type);
+            return -1;
+        }
+    }
+    ret = PyObject_IsInstance(fp, raw_type);
+    if (ret != 0)
+        return ret;
+    return PyObject_IsInstance(fp, buffered_type);
+}
+
+static int
+file_stream_init(PyGpgmeFileStream *stream, PyObject *fp,
+                 Py_ssize_t write_buffer_size)
+{
+    stream->fp = fp;
+    stream->readinto = PyObject_HasAttrString(fp, "readinto");
+    stream->write_buffers = is_binary_io(fp);
+    stream->position = -1;
+    stream->buffer = NULL;
+    stream->buffer_size = write_buffer_size;
+    stream->buffer_used = 0;
+    return stream->write_buffers < 0 ? -1 : 0;
+}
+
+/* A read-ahead source reads a slow Python stream (a network body, a
+ * decompressor) from a helper thread into a ring of buffers, so that the
+ * engine and the Python producer run at the same time.  The engine side
+ * only copies out of filled buffers and never needs the GIL. */
+typedef struct {
+    char *data;
+    size_t length;
+    size_t offset;
+} PyGpgmeReadAheadSlot;
+
+struct _PyGpgmeReadAhead {
+    PyGpgmeFileStream stream;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    PyGpgmeReadAheadSlot *slots;
+    int nbuffers;
+    size_t buffer_size;
+    /* the engine reads from slots[head]; count slots are filled */
+    int head;
+    int count;
+    /* set once the producer has hit end of file or an error */
+    int eof;
+    int error;
+    int stop;
+    /* statistics */
+    unsigned long reads;
+    unsigned long engine_waits;
+    unsigned long producer_waits;
+    unsigned long long bytes;
+};
+
+static void *
+read_ahead_thread(void *arg)
+{
+    PyGpgmeReadAhead *ra = arg;
+    PyGpgmeReadAheadSlot *slot;
+    ssize_t nread;
+    int error;
+
+    pthread_mutex_lock(&ra->lock);
+    while (!ra->stop) {
+        if (ra->count == ra->nbuffers) {
+            ra->producer_waits++;
+            pthread_cond_wait(&ra->cond, &ra->lock);
+            continue;
+        }
+        /* the engine doesn't touch empty slots, so fill this one without
+         * holding the lock */
+        slot = &ra->slots[(ra->head + ra->count) % ra->nbuffers];
+        pthread_mutex_unlock(&ra->lock);
+        nread = read_cb(&ra->stream, slot->data, ra->buffer_size);
+        error = errno;
+        pthread_mutex_lock(&ra->lock);
+
+        ra->reads++;
+        if (nread <= 0) {
+            ra->eof = 1;
+            ra->error = nread < 0 ? error : 0;
+            pthread_cond_broadcast(&ra->cond);
+            break;
+        }
+        slot->length = nread;
+        slot->offset = 0;
+        ra->count++;
+        ra->bytes += nread;
+        pthread_cond_broadcast(&ra->cond);
+    }
+    pthread_mutex_unlock(&ra->lock);
+    return NULL;
+}
+
+static ssize_t
+read_ahead_read_cb(void *handle, void *buffer, size_t size)
+{
+    PyGpgmeReadAhead *ra = handle;
+    PyGpgmeReadAheadSlot *slot;
+
+    pthread_mutex_lock(&ra->lock);
+    if (ra->count == 0 && !ra->eof) {
+        ra->engine_waits++;
+        while (ra->count == 0 && !ra->eof)
+            pthread_cond_wait(&ra->cond, &ra->lock);
+    }
+    if (ra->count == 0) {
+        pthread_mutex_unlock(&ra->lock);
+        if (ra->error) {
+            errno = ra->error;
+            return -1;
+        }
+        return 0;
+    }
+    slot = &ra->slots[ra->head];
+    pthread_mutex_unlock(&ra->lock);
+
+    /* the producer doesn't touch filled slots */
+    if (size > slot->length - slot->offset)
+        size = slot->length - slot->offset;
+    memcpy(buffer, slot->data + slot->offset, size);
+    slot->offset += size;
+    PYGPGME_STATS_ADD(read_calls, 1);
+    PYGPGME_STATS_ADD(bytes_read, size);
+
+    if (slot->offset == slot->length) {
+        pthread_mutex_lock(&ra->lock);
+        ra->head = (ra->head + 1) % ra->nbuffers;
+        ra->count--;
+        pthread_cond_broadcast(&ra->cond);
+        pthread_mutex_unlock(&ra->lock);
+    }
+    return size;
+}
+
+static ssize_t
+read_ahead_write_cb(void *handle, const void *buffer, size_t size)
+{
+    if (size == 0)
+        return 0;
+    errno = EBADF;
+    return -1;
+}
+
+static off_t
+read_ahead_seek_cb(void *handle, off_t offset, int whence)
+{
+    errno = ESPIPE;
+    return -1;
+}
+
+static void
+read_ahead_free(PyGpgmeReadAhead *ra)
+{
+    int i;
+
+    for (i = 0; i < ra->nbuffers; i++)
+        free(ra->slots[i].data);
+    free(ra->slots);
+    pthread_cond_destroy(&ra->cond);
+    pthread_mutex_destroy(&ra->lock);
+    PyMem_Free(ra);
+}
+
+static void
+read_ahead_release_cb(void *handle)
+{
+    PyGILState_STATE state;
+    PyGpgmeReadAhead *ra = handle;
+
+    pthread_mutex_lock(&ra->lock);
+    ra->stop = 1;
+    pthread_cond_broadcast(&ra->cond);
+    pthread_mutex_unlock(&ra->lock);
+
+    /* the producer may be waiting for the GIL to finish a read */
+    state = PyGILState_Ensure();
+    Py_BEGIN_ALLOW_THREADS;
+    pthread_join(ra->thread, NULL);
+    Py_END_ALLOW_THREADS;
+    Py_DECREF(ra->stream.fp);
+    read_ahead_free(ra);
+    PyGILState_Release(state);
+}
+
+static struct gpgme_data_cbs read_ahead_data_cbs = {
+    .read    = read_ahead_read_cb,
+    .write   = read_ahead_write_cb,
+    .seek    = read_ahead_seek_cb,
+    .release = read_ahead_release_cb,
+};
+
+/* A read-only source backed by the memory of an object supporting the
+ * buffer protocol.  The exporter's memory is pinned for the lifetime of
+ * the gpgme_data_t, so the callbacks below never touch the interpreter
+ * and run without the GIL. */
+typedef struct {
+    PyObject *obj;
+    Py_buffer view;
+    const char *data;
+    Py_ssize_t size;
+    Py_ssize_t offset;
+} PyGpgmeBufferSource;
+
+static ssize_t
+buffer_read_cb(void *handle, void *buffer, size_t size)
+{
+    PyGpgmeBufferSource *source = handle;
+    size_t available = source->size - source->offset;
+
+    if (size > available)
+        size = available;
+    memcpy(buffer, source->data + source->offset, size);
+    source->offset += size;
+    PYGPGME_STATS_ADD(read_calls, 1);
+    PYGPGME_STATS_ADD(bytes_read, size);
+    return size;
+}
+
+static ssize_t
+buffer_write_cb(void *handle, const void *buffer, size_t size)
+{
+    if (size == 0)
+        return 0;
+    errno = EBADF;
+    return -1;
+}
+
+static off_t
+buffer_seek_cb(void *handle, off_t offset, int whence)
+{
+    PyGpgmeBufferSource *source = handle;
+
+    switch (whence) {
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        offset += source->offset;
+        break;
+    case SEEK_END:
+        offset += source->size;
+        break;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+    if (offset < 0 || offset > source->size) {
+        errno = EINVAL;
+        return -1;
+    }
+    source->offset = offset;
+    return offset;
+}
+
+static void
+buffer_release_cb(void *handle)
+{
+    PyGILState_STATE state;
+    PyGpgmeBufferSource *source = handle;
+
+    state = PyGILState_Ensure();
+    if (source->view.obj != NULL)
+        PyBuffer_Release(&source->view);
+    Py_DECREF(source->obj);
+    PyGILState_Release(state);
+    PyMem_Free(source);
+}
+
+static struct gpgme_data_cbs buffer_data_cbs = {
+    .read    = buffer_read_cb,
+    .write   = buffer_write_cb,
+    .seek    = buffer_seek_cb,
+    .release = buffer_release_cb,
+};
+
+/* Objects that expose their contents through the buffer protocol (str,
+ * bytearray, buffer, array, ...) are read directly.  File-like objects
+ * (which includes mmap) keep going through their read()/write()
+ * methods, as does unicode, whose buffer is the internal encoding. */
+static int
+is_buffer_source(PyObject *obj)
+{
+    if (PyUnicode_Check(obj))
+        return 0;
+    if (!PyObject_CheckBuffer(obj) && !PyObject_CheckReadBuffer(obj))
+        return 0;
+    if (PyObject_HasAttrString(obj, "read") ||
+        PyObject_HasAttrString(obj, "write"))
+        return 0;
+    return 1;
+}
+
+static int
+buffer_data_new(gpgme_data_t *dh, PyObject *obj)
+{
+    PyGpgmeBufferSource *source;
+    gpgme_error_t error;
+
+    source = PyMem_Malloc(sizeof(PyGpgmeBufferSource));
+    if (source == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    memset(source, 0, sizeof(PyGpgmeBufferSource));
+
+    if (PyObject_CheckBuffer(obj)) {
+        if (PyObject_GetBuffer(obj, &source->view, PyBUF_SIMPLE) < 0) {
+            PyMem_Free(source);
+            return -1;
+        }
+        source->data = source->view.buf;
+        source->size = source->view.len;
+    } else {
+        const void *data;
+
+        if (PyObject_AsReadBuffer(obj, &data, &source->size) < 0) {
+            PyMem_Free(source);
+            return -1;
+        }
+        source->data = data;
+    }
+    Py_INCREF(obj);
+    source->obj = obj;
+
+    error = gpgme_data_new_from_cbs(dh, &buffer_data_cbs, source);
+    if (pygpgme_check_error(error)) {
+        if (source->view.obj != NULL)
+            PyBuffer_Release(&source->view);
+        Py_DECREF(obj);
+        PyMem_Free(source);
+        return -1;
+    }
+    return 0;
+}
+
+/* Raw file descriptors, builtin file objects and objects that have a
+ * fileno() method but no read()/write() (such as sockets) are handed to
+ * gpgme by descriptor, so the engine reads and writes them without the
+ * GIL.  Other wrappers such as GzipFile also provide fileno(), but their
+ * contents differ from what the descriptor yields, so they keep using the
+ * callbacks.  Returns 1 and sets *fd if the object qualifies, 0 if it
+ * does not, and -1 with an exception set on error. */
+static int
+get_data_fd(PyObject *obj, int *fd)
+{
+    PyObject *result;
+
+    if (PyInt_Check(obj) && !PyBool_Check(obj)) {
+        *fd = PyInt_AsLong(obj);
+        if (*fd < 0) {
+            PyErr_SetString(PyExc_ValueError,
+                            "file descriptor must be non-negative");
+            return -1;
+        }
+        return 1;
+    }
+
+    if (PyFile_Check(obj)) {
+        FILE *fp = PyFile_AsFile(obj);
+
+        if (fp == NULL) {
+            PyErr_SetString(PyExc_ValueError, "I/O operation on closed file");
+            return -1;
+        }
+        /* Flush pending writes and drop any read-ahead so that the
+         * descriptor offset matches the file object's position.  The
+         * seek fails harmlessly on pipes, where only the flush matters. */
+        if (fseek(fp, 0, SEEK_CUR) < 0)
+            fflush(fp);
+        *fd = fileno(fp);
+        return 1;
+    }
+
+    if (!PyObject_HasAttrString(obj, "fileno") ||
+        PyObject_HasAttrString(obj, "read") ||
+        PyObject_HasAttrString(obj, "write"))
+        return 0;
+
+    result = PyObject_CallMethod(obj, "fileno", NULL);
+    if (result == NULL)
+        return -1;
+    *fd = PyInt_AsLong(result);
+    Py_DECREF(result);
+    if (*fd == -1 && PyErr_Occurred())
+        return -1;
+    return 1;
+}
+
+/* create a gpgme data object wrapping a Python file like object, a file
+ * descriptor, or an object supporting the buffer protocol.  Output
+ * written to a file like object is collected into chunks of up to
+ * write_buffer_size bytes before being passed to its write() method. */
 int
-pygpgme_data_new(gpgme_data_t *dh, PyObject *fp)
+pygpgme_data_new_output(gpgme_data_t *dh, PyObject *fp,
+                        Py_ssize_t write_buffer_size)
 {
+    PyGpgmeFileStream *stream;
     gpgme_error_t error;
+    int fd;
 
     if (fp == Py_None) {
         *dh = NULL;
         return 0;
     }
 
-    error = gpgme_data_new_from_cbs(dh, &python_data_cbs, fp);
+    /* gpgme.Data objects are used as is, and outlive the operation */
+    if (PyObject_TypeCheck(fp, &PyGpgmeData_Type)) {
+        *dh = ((PyGpgmeData *)fp)->data;
+        return 0;
+    }
+
+    /* files that could not be mapped are streamed instead */
+    if (pygpgme_mappedfile_fallback(fp) != NULL)
+        fp = pygpgme_mappedfile_fallback(fp);
+
+    if (is_buffer_source(fp))
+        return buffer_data_new(dh, fp);
+
+    switch (get_data_fd(fp, &fd)) {
+    case 1:
+        error = gpgme_data_new_from_fd(dh, fd);
+        return pygpgme_check_error(error);
+    case -1:
+        return -1;
+    }
+
+    stream = PyMem_Malloc(sizeof(PyGpgmeFileStream));
+    if (stream == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    if (file_stream_init(stream, fp, write_buffer_size) < 0) {
+        PyMem_Free(stream);
+        return -1;
+    }
+
+    error = gpgme_data_new_from_cbs(dh, &python_data_cbs, stream);
 
-    if (pygpgme_check_error(error))
+    if (pygpgme_check_error(error)) {
+        PyMem_Free(stream);
         return -1;
+    }
 
     /* if no error, then the new gpgme_data_t object owns a reference to
      * the python object */
     Py_INCREF(fp);
     return 0;
 }
+
+int
+pygpgme_data_new(gpgme_data_t *dh, PyObject *fp)
+{
+    return pygpgme_data_new_output(dh, fp, 0);
+}
+
+/* release a data object created by pygpgme_data_new() for fp, unless it
+ * belongs to a gpgme.Data object */
+void
+pygpgme_data_release(gpgme_data_t dh, PyObject *fp)
+{
+    if (dh == NULL || PyObject_TypeCheck(fp, &PyGpgmeData_Type))
+        return;
+    gpgme_data_release(dh);
+}
+
+/* Write out any output still buffered for the data object.  This is
+ * done with a zero length write, which gpgme passes straight through to
+ * the write callback.  May be called without the GIL. */
+gpgme_error_t
+pygpgme_data_flush(gpgme_data_t dh)
+{
+    if (dh == NULL)
+        return GPG_ERR_NO_ERROR;
+    if (gpgme_data_write(dh, NULL, 0) < 0)
+        return gpgme_error_from_errno(errno);
+    return GPG_ERR_NO_ERROR;
+}
+
+/* release a gpgme memory data object, returning its contents as a string */
+PyObject *
+pygpgme_data_release_and_get_string(gpgme_data_t dh)
+{
+    PyObject *ret;
+    char *data;
+    size_t length = 0;
+
+    data = gpgme_data_release_and_get_mem(dh, &length);
+    /* nothing was written to the data object */
+    if (data == NULL)
+        return PyString_FromStringAndSize("", 0);
+    ret = PyString_FromStringAndSize(data, length);
+    gpgme_free(data);
+    return ret;
+}
+
+/* create a gpgme data object reading fp through nbuffers read-ahead
+ * buffers of buffer_size bytes.  Sources that don't go through the
+ * Python callbacks gain nothing from this, and are wrapped as usual with
+ * *read_ahead set to NULL. */
+int
+pygpgme_data_new_read_ahead(gpgme_data_t *dh, PyObject *fp, int nbuffers,
+                            Py_ssize_t buffer_size,
+                            PyGpgmeReadAhead **read_ahead)
+{
+    PyGpgmeReadAhead *ra;
+    gpgme_error_t error;
+    int i;
+
+    *read_ahead = NULL;
+    if (fp == Py_None || PyObject_TypeCheck(fp, &PyGpgmeData_Type) ||
+        PyObject_TypeCheck(fp, &PyGpgmeMappedFile_Type) ||
+        PyInt_Check(fp) || PyFile_Check(fp) || is_buffer_source(fp) ||
+        !PyObject_HasAttrString(fp, "read"))
+        return pygpgme_data_new(dh, fp);
+
+    if (nbuffers < 1 || buffer_size < 1) {
+        PyErr_SetString(PyExc_ValueError,
+                        "read-ahead buffer count and size must be positive");
+        return -1;
+    }
+
+    ra = PyMem_Malloc(sizeof(PyGpgmeReadAhead));
+    if (ra == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    memset(ra, 0, sizeof(PyGpgmeReadAhead));
+    if (file_stream_init(&ra->stream, fp, 0) < 0) {
+        PyMem_Free(ra);
+        return -1;
+    }
+    pthread_mutex_init(&ra->lock, NULL);
+    pthread_cond_init(&ra->cond, NULL);
+    ra->nbuffers = nbuffers;
+    ra->buffer_size = buffer_size;
+    ra->slots = calloc(nbuffers, sizeof(PyGpgmeReadAheadSlot));
+    if (ra->slots == NULL) {
+        ra->nbuffers = 0;
+        read_ahead_free(ra);
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (i = 0; i < nbuffers; i++) {
+        ra->slots[i].data = malloc(buffer_size);
+        if (ra->slots[i].data == NULL) {
+            read_ahead_free(ra);
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+
+    /* the producer thread calls into Python */
+    PyEval_InitThreads();
+    errno = pthread_create(&ra->thread, NULL, read_ahead_thread, ra);
+    if (errno != 0) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        read_ahead_free(ra);
+        return -1;
+    }
+    Py_INCREF(fp);
+
+    error = gpgme_data_new_from_cbs(dh, &read_ahead_data_cbs, ra);
+    if (pygpgme_check_error(error)) {
+        read_ahead_release_cb(ra);
+        return -1;
+    }
+
+    *read_ahead = ra;
+    return 0;
+}
+
+/* a snapshot of the read-ahead statistics */
+PyObject *
+pygpgme_read_ahead_stats(PyGpgmeReadAhead *ra)
+{
+    PyObject *ret;
+
+    pthread_mutex_lock(&ra->lock);
+    ret = Py_BuildValue("{s:i,s:n,s:k,s:K,s:k,s:k,s:i}",
+                        "buffers", ra->nbuffers,
+                        "buffer_size", (Py_ssize_t)ra->buffer_size,
+                        "reads", ra->reads,
+                        "bytes", ra->bytes,
+                        "engine_waits", ra->engine_waits,
+                        "producer_waits", ra->producer_waits,
+                        "buffered", ra->count);
+    pthread_mutex_unlock(&ra->lock);
+    return ret;
+}
@@ -0,0 +1,357 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+    pygpgme - a Python wrapper for the gpgme library
+    Copyright (C) 2006  James Henstridge
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "pygpgme.h"
+#include <errno.h>
+
+/* A gpgme_data_t that can be passed to any number of Context methods.
+ * Operations read and write at the current position, so inputs need to
+ * be rewound before they are reused. */
+
+static void
+pygpgme_data_dealloc(PyGpgmeData *self)
+{
+    if (self->data)
+        gpgme_data_release(self->data);
+    self->data = NULL;
+    self->read_ahead = NULL;
+    Py_CLEAR(self->source);
+    PyObject_Del(self);
+}
+
+static int
+pygpgme_data_init(PyGpgmeData *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = { "source", "path", "write_buffer_size",
+                              "read_ahead", "read_ahead_size", NULL };
+    PyObject *source = Py_None, *path = NULL, *mapping = NULL;
+    Py_ssize_t write_buffer_size = PYGPGME_DEFAULT_WRITE_BUFFER_SIZE;
+    Py_ssize_t read_ahead_size = 64 * 1024;
+    int read_ahead = 0;
+    int ret;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OOnin", kwlist,
+                                     &source, &path, &write_buffer_size,
+                                     &read_ahead, &read_ahead_size))
+        return -1;
+
+    if (self->data != NULL) {
+        PyErr_SetString(PyExc_ValueError, "data already initialised");
+        return -1;
+    }
+
+    if (source != Py_None && path != NULL) {
+        PyErr_SetString(PyExc_TypeError,
+                        "source and path can not both be given");
+        return -1;
+    }
+    if (PyObject_TypeCheck(source, &PyGpgmeData_Type)) {
+        PyErr_SetString(PyExc_TypeError, "can not wrap a gpgme.Data object");
+        return -1;
+    }
+    if (write_buffer_size < 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "write_buffer_size must be non-negative");
+        return -1;
+    }
+    if (read_ahead < 0 || read_ahead_size <= 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "read_ahead must be non-negative and "
+                        "read_ahead_size positive");
+        return -1;
+    }
+
+    self->size_hint = -1;
+
+    /* files named by path are memory mapped where possible */
+    if (path != NULL) {
+        mapping = PyObject_CallFunctionObjArgs(
+            (PyObject *)&PyGpgmeMappedFile_Type, path, NULL);
+        if (mapping == NULL)
+            return -1;
+        source = mapping;
+    }
+
+    /* with no source, create an empty memory buffer */
+    if (source == Py_None)
+        ret = pygpgme_check_error(gpgme_data_new(&self->data));
+    else if (read_ahead > 0)
+        ret = pygpgme_data_new_read_ahead(&self->data, source, read_ahead,
+                                          read_ahead_size, &self->read_ahead);
+    else
+        ret = pygpgme_data_new_output(&self->data, source,
+                                      write_buffer_size);
+    if (ret == 0 && source != Py_None) {
+        Py_INCREF(source);
+        self->source = source;
+    }
+    Py_XDECREF(mapping);
+    return ret;
+}
+
+static PyObject *
+pygpgme_data_get_encoding(PyGpgmeData *self)
+{
+    return PyInt_FromLong(gpgme_data_get_encoding(self->data));
+}
+
+static int
+pygpgme_data_set_encoding(PyGpgmeData *self, PyObject *value)
+{
+    gpgme_data_encoding_t encoding;
+
+    encoding = PyInt_AsLong(value);
+    if (PyErr_Occurred())
+        return -1;
+
+    if (pygpgme_check_error(gpgme_data_set_encoding(self->data, encoding)))
+        return -1;
+
+    return 0;
+}
+
+static PyObject *
+pygpgme_data_get_file_name(PyGpgmeData *self)
+{
+    const char *file_name = gpgme_data_get_file_name(self->data);
+
+    if (file_name == NULL)
+        Py_RETURN_NONE;
+    return PyString_FromString(file_name);
+}
+
+static int
+pygpgme_data_set_file_name(PyGpgmeData *self, PyObject *value)
+{
+    const char *file_name = NULL;
+
+    if (value != NULL && value != Py_None) {
+        file_name = PyString_AsString(value);
+        if (file_name == NULL)
+            return -1;
+    }
+
+    if (pygpgme_check_error(gpgme_data_set_file_name(self->data, file_name)))
+        return -1;
+
+    return 0;
+}
+
+static PyObject *
+pygpgme_data_get_size_hint(PyGpgmeData *self)
+{
+    if (self->size_hint < 0)
+        Py_RETURN_NONE;
+    return PyInt_FromSsize_t(self->size_hint);
+}
+
+/* The size hint lets the engine report progress and size its buffers
+ * for data it can't stat, such as callback-backed streams.  Older gpgme
+ * versions have no way to pass it on, in which case it is only kept. */
+static int
+pygpgme_data_set_size_hint(PyGpgmeData *self, PyObject *value)
+{
+    Py_ssize_t size_hint = -1;
+
+    if (value != NULL && value != Py_None) {
+        size_hint = PyInt_AsSsize_t(value);
+        if (PyErr_Occurred())
+            return -1;
+        if (size_hint < 0) {
+            PyErr_SetString(PyExc_ValueError,
+                            "size_hint must be non-negative");
+            return -1;
+        }
+    }
+
+#if GPGME_VERSION_NUMBER >= 0x010700
+    if (size_hint >= 0) {
+        char buf[32];
+
+        PyOS_snprintf(buf, sizeof(buf), "%ld", (long)size_hint);
+        if (pygpgme_check_error(gpgme_data_set_flag(self->data,
+                                                    "size-hint", buf)))
+            return -1;
+    }
+#endif
+    self->size_hint = size_hint;
+    return 0;
+}
+
+static PyObject *
+pygpgme_data_get_read_ahead_stats(PyGpgmeData *self)
+{
+    if (self->read_ahead == NULL)
+        Py_RETURN_NONE;
+    return pygpgme_read_ahead_stats(self->read_ahead);
+}
+
+static PyGetSetDef pygpgme_data_getsets[] = {
+    { "encoding", (getter)pygpgme_data_get_encoding,
+      (setter)pygpgme_data_set_encoding },
+    { "file_name", (getter)pygpgme_data_get_file_name,
+      (setter)pygpgme_data_set_file_name },
+    { "size_hint", (getter)pygpgme_data_get_size_hint,
+      (setter)pygpgme_data_set_size_hint },
+    { "read_ahead_stats", (getter)pygpgme_data_get_read_ahead_stats },
+    { NULL, (getter)0, (setter)0 }
+};
+
+static PyObject *
+pygpgme_data_seek(PyGpgmeData *self, PyObject *args)
+{
+    long offset;
+    int whence = SEEK_SET;
+    off_t ret;
+
+    if (!PyArg_ParseTuple(args, "l|i", &offset, &whence))
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS;
+    ret = gpgme_data_seek(self->data, offset, whence);
+    Py_END_ALLOW_THREADS;
+
+    if (ret < 0) {
+        pygpgme_check_error(gpgme_error_from_errno(errno));
+        return NULL;
+    }
+    return PyInt_FromLong(ret);
+}
+
+static PyObject *
+pygpgme_data_rewind(PyGpgmeData *self)
+{
+    off_t ret;
+
+    Py_BEGIN_ALLOW_THREADS;
+    ret = gpgme_data_seek(self->data, 0, SEEK_SET);
+    Py_END_ALLOW_THREADS;
+
+    if (ret < 0) {
+        pygpgme_check_error(gpgme_error_from_errno(errno));
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+pygpgme_data_read(PyGpgmeData *self, PyObject *args)
+{
+    Py_ssize_t size = -1, length = 0, allocated;
+    PyObject *ret;
+    ssize_t nread;
+
+    if (!PyArg_ParseTuple(args, "|n", &size))
+        return NULL;
+
+    allocated = size >= 0 ? size : 8192;
+    ret = PyString_FromStringAndSize(NULL, allocated);
+    if (ret == NULL)
+        return NULL;
+
+    for (;;) {
+        if (length == allocated) {
+            if (size >= 0)
+                break;
+            allocated *= 2;
+            if (_PyString_Resize(&ret, allocated) < 0)
+                return NULL;
+        }
+        Py_BEGIN_ALLOW_THREADS;
+        nread = gpgme_data_read(self->data, PyString_AS_STRING(ret) + length,
+                                allocated - length);
+        Py_END_ALLOW_THREADS;
+        if (nread < 0) {
+            Py_DECREF(ret);
+            pygpgme_check_error(gpgme_error_from_errno(errno));
+            return NULL;
+        }
+        if (nread == 0)
+            break;
+        length += nread;
+    }
+
+    if (length != allocated && _PyString_Resize(&ret, length) < 0)
+        return NULL;
+    return ret;
+}
+
+static PyObject *
+pygpgme_data_write(PyGpgmeData *self, PyObject *args)
+{
+    Py_buffer view;
+    Py_ssize_t offset = 0;
+    ssize_t nwritten;
+    gpgme_error_t err = GPG_ERR_NO_ERROR;
+
+    if (!PyArg_ParseTuple(args, "s*", &view))
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS;
+    while (offset < view.len) {
+        nwritten = gpgme_data_write(self->data, (char *)view.buf + offset,
+                                    view.len - offset);
+        if (nwritten <= 0) {
+            err = gpgme_error_from_errno(nwritten < 0 ? errno : EIO);
+            break;
+        }
+        offset += nwritten;
+    }
+    Py_END_ALLOW_THREADS;
+
+    PyBuffer_Release(&view);
+    if (pygpgme_check_error(err))
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+pygpgme_data_flush_method(PyGpgmeData *self)
+{
+    gpgme_error_t err;
+
+    Py_BEGIN_ALLOW_THREADS;
+    err = pygpgme_data_flush(self->data);
+    Py_END_ALLOW_THREADS;
+
+    if (pygpgme_check_error(err))
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef pygpgme_data_methods[] = {
+    { "seek", (PyCFunction)pygpgme_data_seek, METH_VARARGS },
+    { "rewind", (PyCFunction)pygpgme_data_rewind, METH_NOARGS },
+    { "read", (PyCFunction)pygpgme_data_read, METH_VARARGS },
+    { "write", (PyCFunction)pygpgme_data_write, METH_VARARGS },
+    { "flush", (PyCFunction)pygpgme_data_flush_method, METH_NOARGS },
+    { NULL, 0, 0 }
+};
+
+PyTypeObject PyGpgmeData_Type = {
+    PyObject_HEAD_INIT(NULL)
+    0,
+    "gpgme.Data",
+    sizeof(PyGpgmeData),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_init = (initproc)pygpgme_data_init,
+    .tp_dealloc = (destructor)pygpgme_data_dealloc,
+    .tp_getset = pygpgme_data_getsets,
+    .tp_methods = pygpgme_data_methods,
+};
@@ -58,7 +58,8 @@ pygpgme_error_object(gpgme_error_t err)
 }
 
 /* check whether the given gpgme_error_t value indicates an error.  If so,
- * raise an equivalent Python exception and return TRUE */
+ * raise an equivalent Python exception and return TRUE.  An operation
+ * cancelled by a signal raises the exception raised by its handler. */
 int
 pygpgme_check_error(gpgme_error_t err)
 {
@@ -67,6 +68,9 @@ pygpgme_check_error(gpgme_error_t err)
     if (err == GPG_ERR_NO_ERROR)
         return 0;
 
+    if (gpgme_err_code(err) == GPG_ERR_CANCELED && PyErr_CheckSignals() < 0)
+        return -1;
+
     exc = pygpgme_error_object(err);
     if (!exc)
         return -1;
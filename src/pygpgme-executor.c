@@ -0,0 +1,1056 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+    pygpgme - a Python wrapper for the gpgme library
+    Copyright (C) 2006  James Henstridge
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "pygpgme.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* An Executor owns a number of worker threads, each with its own
+ * context, that run the same in-memory jobs as the *_many() methods.
+ * Each worker has a queue of its own.  Submissions are spread over the
+ * queues round robin; a worker takes jobs from the front of its own
+ * queue, and steals from the back of the others' when it is empty, so
+ * one slow job doesn't hold up the jobs queued behind it.
+ *
+ * Jobs are submitted in one of the priority classes, and workers run
+ * everything queued in a more urgent class first.  Within a class, jobs
+ * with a deadline are queued ahead of those without, earliest first,
+ * and a job still queued when its deadline passes fails with
+ * GPG_ERR_TIMEOUT instead of being run.  A class may be given a limit
+ * on the jobs queued in it, past which submissions fail with
+ * GPG_ERR_RESOURCE_LIMIT, and some workers may be reserved for the
+ * classes above PRIORITY_BULK so bulk jobs can't occupy all of them.
+ *
+ * Workers only take the GIL once a job has finished, to mark its
+ * Future done, run its callbacks and convert its result. */
+
+typedef struct _PyGpgmeFuture PyGpgmeFuture;
+
+struct _PyGpgmeFuture {
+    PyObject_HEAD
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /* set with both the GIL and lock held */
+    int done;
+    PyGpgmeBatchJob job;
+    PyObject *result;
+    PyObject *exc_type;
+    PyObject *exc_value;
+    PyObject *exc_traceback;
+    PyObject *callbacks;
+    int priority;
+    /* on the pygpgme_now() clock; 0 if the job has no deadline */
+    double deadline;
+    double submitted;
+    /* links in a worker's queue, protected by that worker's lock */
+    PyGpgmeFuture *prev, *next;
+};
+
+typedef struct _PyGpgmeExecutor PyGpgmeExecutor;
+
+typedef struct {
+    PyGpgmeExecutor *executor;
+    int index;
+    int started;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    /* a queue per priority class */
+    PyGpgmeFuture *head[PYGPGME_N_PRIORITIES];
+    PyGpgmeFuture *tail[PYGPGME_N_PRIORITIES];
+    PyGpgmeContext *ctx;
+    /* protected by lock */
+    unsigned long completed;
+    unsigned long stolen;
+} ExecutorWorker;
+
+/* the state of a priority class, protected by the executor's lock */
+typedef struct {
+    /* jobs queued but not yet claimed by a worker */
+    Py_ssize_t queued;
+    /* the most jobs that may be queued, or 0 for no limit */
+    Py_ssize_t limit;
+    unsigned long submitted;
+    unsigned long rejected;
+    unsigned long expired;
+    /* the time jobs spent queued */
+    double wait_time;
+    double max_wait_time;
+} ExecutorClass;
+
+struct _PyGpgmeExecutor {
+    PyObject_HEAD
+    int initialised;
+    /* protects classes and shutdown */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    ExecutorClass classes[PYGPGME_N_PRIORITIES];
+    int shutdown;
+    int joined;
+    int nworkers;
+    /* the first reserved workers don't run PRIORITY_BULK jobs */
+    int reserved;
+    ExecutorWorker *workers;
+    unsigned int next;
+    PyObject *weakreflist;
+};
+
+/* weak references to the executors that have started workers, which
+ * are shut down at exit, before the interpreter they need is gone */
+static PyObject *live_executors = NULL;
+
+/* Futures */
+
+static void
+pygpgme_future_dealloc(PyGpgmeFuture *self)
+{
+    pygpgme_batch_job_clear(&self->job);
+    pthread_cond_destroy(&self->cond);
+    pthread_mutex_destroy(&self->lock);
+    Py_XDECREF(self->result);
+    Py_XDECREF(self->exc_type);
+    Py_XDECREF(self->exc_value);
+    Py_XDECREF(self->exc_traceback);
+    Py_XDECREF(self->callbacks);
+    PyObject_Del(self);
+}
+
+static PyGpgmeFuture *
+future_new(PyGpgmeBatchOp op, int flags)
+{
+    PyGpgmeFuture *self;
+
+    self = PyObject_New(PyGpgmeFuture, &PyGpgmeFuture_Type);
+    if (self == NULL)
+        return NULL;
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->cond, NULL);
+    self->done = 0;
+    memset(&self->job, 0, sizeof(self->job));
+    self->job.op = op;
+    self->job.flags = flags;
+    self->result = NULL;
+    self->exc_type = NULL;
+    self->exc_value = NULL;
+    self->exc_traceback = NULL;
+    self->callbacks = NULL;
+    self->priority = PYGPGME_PRIORITY_NORMAL;
+    self->deadline = 0;
+    self->submitted = 0;
+    self->prev = self->next = NULL;
+    return self;
+}
+
+/* record the job's outcome and run the done callbacks.  Called by the
+ * worker with the GIL held. */
+static void
+future_finish(PyGpgmeFuture *self)
+{
+    PyObject *callbacks, *ret;
+    Py_ssize_t i;
+
+    self->result = pygpgme_batch_result(&self->job);
+    if (self->result != NULL &&
+        PyObject_TypeCheck(self->result, (PyTypeObject *)pygpgme_error)) {
+        PyErr_SetObject((PyObject *)Py_TYPE(self->result), self->result);
+        Py_CLEAR(self->result);
+    }
+    if (self->result == NULL)
+        PyErr_Fetch(&self->exc_type, &self->exc_value, &self->exc_traceback);
+    pygpgme_batch_job_clear(&self->job);
+
+    pthread_mutex_lock(&self->lock);
+    self->done = 1;
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->lock);
+
+    /* callbacks may add more callbacks, which are run immediately */
+    callbacks = self->callbacks;
+    self->callbacks = NULL;
+    for (i = 0; callbacks != NULL && i < PyList_GET_SIZE(callbacks); i++) {
+        PyObject *callback = PyList_GET_ITEM(callbacks, i);
+
+        ret = PyObject_CallFunctionObjArgs(callback, self, NULL);
+        if (ret == NULL)
+            PyErr_WriteUnraisable(callback);
+        Py_XDECREF(ret);
+    }
+    Py_XDECREF(callbacks);
+}
+
+static PyObject *
+pygpgme_future_done(PyGpgmeFuture *self)
+{
+    return PyBool_FromLong(self->done);
+}
+
+static PyObject *
+pygpgme_future_result(PyGpgmeFuture *self)
+{
+    if (!self->done) {
+        PyErr_SetString(PyExc_ValueError, "operation has not finished");
+        return NULL;
+    }
+    if (self->result == NULL) {
+        Py_XINCREF(self->exc_type);
+        Py_XINCREF(self->exc_value);
+        Py_XINCREF(self->exc_traceback);
+        PyErr_Restore(self->exc_type, self->exc_value, self->exc_traceback);
+        return NULL;
+    }
+    Py_INCREF(self->result);
+    return self->result;
+}
+
+/* wait up to timeout seconds for the job to finish, forever if timeout
+ * is None, and return its result */
+static PyObject *
+pygpgme_future_wait(PyGpgmeFuture *self, PyObject *args)
+{
+    PyObject *py_timeout = Py_None;
+    struct timespec deadline;
+    double timeout = -1;
+    int done;
+
+    if (!PyArg_ParseTuple(args, "|O", &py_timeout))
+        return NULL;
+    if (py_timeout != Py_None) {
+        timeout = PyFloat_AsDouble(py_timeout);
+        if (PyErr_Occurred())
+            return NULL;
+    }
+
+    if (!self->done) {
+        Py_BEGIN_ALLOW_THREADS;
+        if (timeout >= 0) {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += (time_t)timeout;
+            deadline.tv_nsec += (long)((timeout - (time_t)timeout) * 1e9);
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+        }
+        pthread_mutex_lock(&self->lock);
+        while (!self->done) {
+            if (timeout < 0)
+                pthread_cond_wait(&self->cond, &self->lock);
+            else if (pthread_cond_timedwait(&self->cond, &self->lock,
+                                            &deadline) == ETIMEDOUT)
+                break;
+        }
+        done = self->done;
+        pthread_mutex_unlock(&self->lock);
+        Py_END_ALLOW_THREADS;
+
+        if (!done) {
+            pygpgme_check_error(gpgme_error(GPG_ERR_TIMEOUT));
+            return NULL;
+        }
+    }
+    return pygpgme_future_result(self);
+}
+
+static PyObject *
+pygpgme_future_add_done_callback(PyGpgmeFuture *self, PyObject *callback)
+{
+    PyObject *ret;
+
+    /* the worker needs the GIL to finish the job, so it can't do so
+     * while the callback is being added */
+    if (self->done) {
+        ret = PyObject_CallFunctionObjArgs(callback, self, NULL);
+        if (ret == NULL)
+            return NULL;
+        Py_DECREF(ret);
+        Py_RETURN_NONE;
+    }
+    if (self->callbacks == NULL) {
+        self->callbacks = PyList_New(0);
+        if (self->callbacks == NULL)
+            return NULL;
+    }
+    if (PyList_Append(self->callbacks, callback) < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef pygpgme_future_methods[] = {
+    { "done", (PyCFunction)pygpgme_future_done, METH_NOARGS },
+    { "result", (PyCFunction)pygpgme_future_result, METH_NOARGS },
+    { "wait", (PyCFunction)pygpgme_future_wait, METH_VARARGS },
+    { "add_done_callback", (PyCFunction)pygpgme_future_add_done_callback,
+      METH_O },
+    { NULL, 0, 0 }
+};
+
+PyTypeObject PyGpgmeFuture_Type = {
+    PyObject_HEAD_INIT(NULL)
+    0,
+    "gpgme.Future",
+    sizeof(PyGpgmeFuture),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_init = pygpgme_no_constructor,
+    .tp_dealloc = (destructor)pygpgme_future_dealloc,
+    .tp_methods = pygpgme_future_methods,
+};
+
+/* Workers */
+
+/* take a job of the given priority from the front of the worker's own
+ * queue, or steal one from the back of another worker's.  The caller
+ * has claimed a job of that priority, so one is queued somewhere. */
+static PyGpgmeFuture *
+executor_take(ExecutorWorker *worker, int priority)
+{
+    PyGpgmeExecutor *executor = worker->executor;
+    ExecutorWorker *victim;
+    PyGpgmeFuture *future;
+    int i;
+
+    for (;;) {
+        pthread_mutex_lock(&worker->lock);
+        future = worker->head[priority];
+        if (future != NULL) {
+            worker->head[priority] = future->next;
+            if (future->next != NULL)
+                future->next->prev = NULL;
+            else
+                worker->tail[priority] = NULL;
+        }
+        pthread_mutex_unlock(&worker->lock);
+        if (future != NULL)
+            return future;
+
+        for (i = 1; i < executor->nworkers; i++) {
+            victim = &executor->workers[(worker->index + i) %
+                                        executor->nworkers];
+            pthread_mutex_lock(&victim->lock);
+            future = victim->tail[priority];
+            if (future != NULL) {
+                victim->tail[priority] = future->prev;
+                if (future->prev != NULL)
+                    future->prev->next = NULL;
+                else
+                    victim->head[priority] = NULL;
+            }
+            pthread_mutex_unlock(&victim->lock);
+            if (future != NULL) {
+                pthread_mutex_lock(&worker->lock);
+                worker->stolen++;
+                pthread_mutex_unlock(&worker->lock);
+                return future;
+            }
+        }
+        /* jobs are queued before they can be claimed, so this is not
+         * expected to happen; let the other workers run */
+        sched_yield();
+    }
+}
+
+/* claim a job from the most urgent class the worker runs that has any
+ * queued, returning its priority, or -1 if there are none.  Called
+ * with the executor's lock held. */
+static int
+executor_claim(ExecutorWorker *worker)
+{
+    PyGpgmeExecutor *executor = worker->executor;
+    int priority, last = PYGPGME_N_PRIORITIES - 1;
+
+    if (worker->index < executor->reserved)
+        last = PYGPGME_PRIORITY_BULK - 1;
+    for (priority = 0; priority <= last; priority++) {
+        if (executor->classes[priority].queued > 0) {
+            executor->classes[priority].queued--;
+            return priority;
+        }
+    }
+    return -1;
+}
+
+static void *
+executor_thread(void *arg)
+{
+    ExecutorWorker *worker = arg;
+    PyGpgmeExecutor *executor = worker->executor;
+    ExecutorClass *class;
+    PyGpgmeFuture *future;
+    PyGILState_STATE state;
+    double now, waited;
+    int priority, expired;
+
+    for (;;) {
+        pthread_mutex_lock(&executor->lock);
+        while ((priority = executor_claim(worker)) < 0 &&
+               !executor->shutdown)
+            pthread_cond_wait(&executor->cond, &executor->lock);
+        pthread_mutex_unlock(&executor->lock);
+        if (priority < 0)
+            break;
+
+        future = executor_take(worker, priority);
+        future->next = future->prev = NULL;
+
+        now = pygpgme_now();
+        waited = now - future->submitted;
+        expired = future->deadline != 0 && now > future->deadline;
+        pthread_mutex_lock(&executor->lock);
+        class = &executor->classes[priority];
+        class->wait_time += waited;
+        if (waited > class->max_wait_time)
+            class->max_wait_time = waited;
+        if (expired)
+            class->expired++;
+        pthread_mutex_unlock(&executor->lock);
+
+        if (expired)
+            future->job.err = gpgme_error(GPG_ERR_TIMEOUT);
+        else {
+            /* the context's timeout bounds the time the job may run */
+            pygpgme_op_begin(worker->ctx, "executor");
+            pygpgme_batch_run(worker->ctx->ctx, &future->job);
+            future->job.err = pygpgme_op_end(worker->ctx, future->job.err);
+        }
+
+        pthread_mutex_lock(&worker->lock);
+        worker->completed++;
+        pthread_mutex_unlock(&worker->lock);
+
+        state = PyGILState_Ensure();
+        future_finish(future);
+        Py_DECREF(future);
+        PyGILState_Release(state);
+    }
+    return NULL;
+}
+
+/* stop the workers once the queued jobs are done, optionally waiting
+ * for them to exit */
+static void
+executor_shutdown(PyGpgmeExecutor *self, int wait)
+{
+    int i;
+
+    if (!self->initialised)
+        return;
+
+    pthread_mutex_lock(&self->lock);
+    self->shutdown = 1;
+    pthread_cond_broadcast(&self->cond);
+    pthread_mutex_unlock(&self->lock);
+
+    if (!wait || self->joined)
+        return;
+    Py_BEGIN_ALLOW_THREADS;
+    for (i = 0; i < self->nworkers; i++)
+        if (self->workers[i].started)
+            pthread_join(self->workers[i].thread, NULL);
+    Py_END_ALLOW_THREADS;
+    self->joined = 1;
+}
+
+static PyObject *
+executor_shutdown_all(PyObject *module, PyObject *args)
+{
+    PyObject *executor;
+    Py_ssize_t i;
+
+    for (i = 0; live_executors != NULL &&
+             i < PyList_GET_SIZE(live_executors); i++) {
+        executor = PyWeakref_GET_OBJECT(PyList_GET_ITEM(live_executors, i));
+        if (executor == Py_None)
+            continue;
+        /* the joins release the GIL */
+        Py_INCREF(executor);
+        executor_shutdown((PyGpgmeExecutor *)executor, 1);
+        Py_DECREF(executor);
+    }
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef executor_shutdown_all_def = {
+    "_shutdown_executors", (PyCFunction)executor_shutdown_all, METH_NOARGS
+};
+
+/* remember self so its workers are joined at exit, registering the
+ * atexit hook the first time, and forget executors that are gone */
+static int
+executor_register(PyGpgmeExecutor *self)
+{
+    PyObject *atexit, *func, *ref, *ret;
+    Py_ssize_t i;
+
+    if (live_executors == NULL) {
+        atexit = PyImport_ImportModule("atexit");
+        if (atexit == NULL)
+            return -1;
+        func = PyCFunction_New(&executor_shutdown_all_def, NULL);
+        ret = func ? PyObject_CallMethod(atexit, "register", "O", func) : NULL;
+        Py_XDECREF(func);
+        Py_DECREF(atexit);
+        if (ret == NULL)
+            return -1;
+        Py_DECREF(ret);
+        live_executors = PyList_New(0);
+        if (live_executors == NULL)
+            return -1;
+    }
+    for (i = PyList_GET_SIZE(live_executors) - 1; i >= 0; i--)
+        if (PyWeakref_GET_OBJECT(PyList_GET_ITEM(live_executors, i)) ==
+            Py_None && PySequence_DelItem(live_executors, i) < 0)
+            return -1;
+
+    ref = PyWeakref_NewRef((PyObject *)self, NULL);
+    if (ref == NULL)
+        return -1;
+    i = PyList_Append(live_executors, ref);
+    Py_DECREF(ref);
+    return i;
+}
+
+/* Executors */
+
+static void
+pygpgme_executor_dealloc(PyGpgmeExecutor *self)
+{
+    int i;
+
+    if (self->weakreflist != NULL)
+        PyObject_ClearWeakRefs((PyObject *)self);
+
+    executor_shutdown(self, 1);
+    for (i = 0; self->workers != NULL && i < self->nworkers; i++) {
+        pthread_mutex_destroy(&self->workers[i].lock);
+        Py_XDECREF(self->workers[i].ctx);
+    }
+    free(self->workers);
+    if (self->initialised) {
+        pthread_cond_destroy(&self->cond);
+        pthread_mutex_destroy(&self->lock);
+    }
+    PyObject_Del(self);
+}
+
+/* set the queue limits from a dictionary mapping priorities to limits */
+static int
+executor_set_limits(PyGpgmeExecutor *self, PyObject *limits)
+{
+    PyObject *key, *value;
+    Py_ssize_t pos = 0, limit;
+    long priority;
+
+    if (limits == NULL)
+        return 0;
+    while (PyDict_Next(limits, &pos, &key, &value)) {
+        priority = PyInt_AsLong(key);
+        if (PyErr_Occurred())
+            return -1;
+        if (priority < 0 || priority >= PYGPGME_N_PRIORITIES) {
+            PyErr_SetString(PyExc_ValueError, "unknown priority");
+            return -1;
+        }
+        limit = PyInt_AsSsize_t(value);
+        if (PyErr_Occurred())
+            return -1;
+        if (limit < 0) {
+            PyErr_SetString(PyExc_ValueError,
+                            "queue limits must not be negative");
+            return -1;
+        }
+        self->classes[priority].limit = limit;
+    }
+    return 0;
+}
+
+static int
+pygpgme_executor_init(PyGpgmeExecutor *self, PyObject *args,
+                      PyObject *kwargs)
+{
+    static char *kwlist[] = { "workers", "reserved", "queue_limits",
+                              "engine_path", "homedir", NULL };
+    PyObject *settings, *own_kwargs, *name, *value, *limits = NULL;
+    const char *engine_path = NULL, *homedir = NULL;
+    Py_ssize_t pos;
+    int nworkers, reserved = 0, i, ret;
+
+    if (self->initialised || self->workers != NULL) {
+        PyErr_SetString(PyExc_ValueError, "executor already initialised");
+        return -1;
+    }
+
+    /* keyword arguments of our own are moved out of the ones that are
+     * context attributes */
+    settings = kwargs ? PyDict_Copy(kwargs) : PyDict_New();
+    own_kwargs = PyDict_New();
+    if (settings == NULL || own_kwargs == NULL) {
+        Py_XDECREF(settings);
+        Py_XDECREF(own_kwargs);
+        return -1;
+    }
+    for (i = 0; kwlist[i] != NULL; i++) {
+        value = PyDict_GetItemString(settings, kwlist[i]);
+        if (value != NULL &&
+            (PyDict_SetItemString(own_kwargs, kwlist[i], value) < 0 ||
+             PyDict_DelItemString(settings, kwlist[i]) < 0)) {
+            Py_DECREF(settings);
+            Py_DECREF(own_kwargs);
+            return -1;
+        }
+    }
+    ret = PyArg_ParseTupleAndKeywords(args, own_kwargs, "i|iO!zz", kwlist,
+                                      &nworkers, &reserved,
+                                      &PyDict_Type, &limits,
+                                      &engine_path, &homedir);
+    if (ret && executor_set_limits(self, limits) < 0)
+        ret = 0;
+    Py_DECREF(own_kwargs);
+    if (!ret) {
+        Py_DECREF(settings);
+        return -1;
+    }
+    if (nworkers <= 0) {
+        Py_DECREF(settings);
+        PyErr_SetString(PyExc_ValueError, "workers must be positive");
+        return -1;
+    }
+    if (reserved < 0 || reserved >= nworkers) {
+        Py_DECREF(settings);
+        PyErr_SetString(PyExc_ValueError,
+                        "reserved must leave a worker for bulk jobs");
+        return -1;
+    }
+    self->reserved = reserved;
+
+    self->workers = calloc(nworkers, sizeof(ExecutorWorker));
+    if (self->workers == NULL) {
+        Py_DECREF(settings);
+        PyErr_NoMemory();
+        return -1;
+    }
+    self->nworkers = nworkers;
+    for (i = 0; i < nworkers; i++) {
+        self->workers[i].executor = self;
+        self->workers[i].index = i;
+        pthread_mutex_init(&self->workers[i].lock, NULL);
+    }
+    for (i = 0; i < nworkers; i++) {
+        PyObject *ctx;
+
+        ctx = PyObject_CallObject((PyObject *)&PyGpgmeContext_Type, NULL);
+        if (ctx == NULL) {
+            Py_DECREF(settings);
+            return -1;
+        }
+        self->workers[i].ctx = (PyGpgmeContext *)ctx;
+        pos = 0;
+        while (PyDict_Next(settings, &pos, &name, &value)) {
+            if (PyObject_SetAttr(ctx, name, value) < 0) {
+                Py_DECREF(settings);
+                return -1;
+            }
+        }
+        if ((engine_path != NULL || homedir != NULL) &&
+            pygpgme_check_error(gpgme_ctx_set_engine_info(
+                self->workers[i].ctx->ctx,
+                gpgme_get_protocol(self->workers[i].ctx->ctx),
+                engine_path, homedir))) {
+            Py_DECREF(settings);
+            return -1;
+        }
+    }
+    Py_DECREF(settings);
+
+    pthread_mutex_init(&self->lock, NULL);
+    pthread_cond_init(&self->cond, NULL);
+    self->initialised = 1;
+
+    PyEval_InitThreads();
+    for (i = 0; i < nworkers; i++) {
+        errno = pthread_create(&self->workers[i].thread, NULL,
+                               executor_thread, &self->workers[i]);
+        if (errno != 0) {
+            PyErr_SetFromErrno(PyExc_OSError);
+            executor_shutdown(self, 1);
+            return -1;
+        }
+        self->workers[i].started = 1;
+    }
+    if (executor_register(self) < 0) {
+        executor_shutdown(self, 1);
+        return -1;
+    }
+    return 0;
+}
+
+/* whether a should be run before b of the same priority */
+static int
+future_before(PyGpgmeFuture *a, PyGpgmeFuture *b)
+{
+    return a->deadline != 0 && (b->deadline == 0 || a->deadline < b->deadline);
+}
+
+/* queue the job on the next worker in turn, in order of deadline.
+ * deadline is None or the number of seconds from now by which the job
+ * must have started. */
+static PyObject *
+executor_submit(PyGpgmeExecutor *self, PyGpgmeFuture *future, int priority,
+                PyObject *py_deadline)
+{
+    ExecutorClass *class;
+    ExecutorWorker *worker;
+    PyGpgmeFuture *pos;
+    double deadline = 0;
+    int first = 0, count = self->nworkers;
+
+    if (!self->initialised) {
+        Py_DECREF(future);
+        PyErr_SetString(PyExc_ValueError, "Executor not initialised");
+        return NULL;
+    }
+    if (priority < 0 || priority >= PYGPGME_N_PRIORITIES) {
+        Py_DECREF(future);
+        PyErr_SetString(PyExc_ValueError, "unknown priority");
+        return NULL;
+    }
+    if (py_deadline != Py_None) {
+        deadline = PyFloat_AsDouble(py_deadline);
+        if (PyErr_Occurred()) {
+            Py_DECREF(future);
+            return NULL;
+        }
+    }
+    if (self->shutdown) {
+        Py_DECREF(future);
+        PyErr_SetString(PyExc_ValueError, "executor has been shut down");
+        return NULL;
+    }
+
+    future->priority = priority;
+    future->submitted = pygpgme_now();
+    if (py_deadline != Py_None)
+        future->deadline = future->submitted + deadline;
+    /* bulk jobs aren't queued on the reserved workers */
+    if (priority == PYGPGME_PRIORITY_BULK) {
+        first = self->reserved;
+        count -= self->reserved;
+    }
+
+    pthread_mutex_lock(&self->lock);
+    class = &self->classes[priority];
+    if (class->limit != 0 && class->queued >= class->limit) {
+        class->rejected++;
+        pthread_mutex_unlock(&self->lock);
+        Py_DECREF(future);
+        pygpgme_check_error(gpgme_error(GPG_ERR_RESOURCE_LIMIT));
+        return NULL;
+    }
+
+    /* the worker's reference, dropped once the job has finished */
+    Py_INCREF(future);
+    worker = &self->workers[first + self->next++ % count];
+    pthread_mutex_lock(&worker->lock);
+    pos = worker->tail[priority];
+    while (pos != NULL && future_before(future, pos))
+        pos = pos->prev;
+    future->prev = pos;
+    if (pos != NULL) {
+        future->next = pos->next;
+        pos->next = future;
+    } else {
+        future->next = worker->head[priority];
+        worker->head[priority] = future;
+    }
+    if (future->next != NULL)
+        future->next->prev = future;
+    else
+        worker->tail[priority] = future;
+    pthread_mutex_unlock(&worker->lock);
+
+    class->queued++;
+    class->submitted++;
+    /* a reserved worker woken for a bulk job would go back to sleep */
+    if (self->reserved > 0)
+        pthread_cond_broadcast(&self->cond);
+    else
+        pthread_cond_signal(&self->cond);
+    pthread_mutex_unlock(&self->lock);
+    return (PyObject *)future;
+}
+
+static PyObject *
+pygpgme_executor_encrypt(PyGpgmeExecutor *self, PyObject *args,
+                         PyObject *kwargs)
+{
+    static char *kwlist[] = { "recipients", "flags", "plaintext",
+                              "priority", "deadline", NULL };
+    PyObject *py_recp, *py_plain, *py_deadline = Py_None;
+    PyGpgmeFuture *future;
+    int flags, priority = PYGPGME_PRIORITY_NORMAL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OiO|iO", kwlist,
+                                     &py_recp, &flags, &py_plain,
+                                     &priority, &py_deadline))
+        return NULL;
+
+    future = future_new(PYGPGME_BATCH_ENCRYPT, flags);
+    if (future == NULL)
+        return NULL;
+    if (pygpgme_recipients(py_recp, &future->job.recp,
+                           &future->job.py_recp) < 0 ||
+        pygpgme_batch_get_buffer(py_plain, &future->job.input,
+                                 &future->job.have_input) < 0) {
+        Py_DECREF(future);
+        return NULL;
+    }
+    return executor_submit(self, future, priority, py_deadline);
+}
+
+static PyObject *
+executor_decrypt(PyGpgmeExecutor *self, PyObject *args, PyObject *kwargs,
+                 PyGpgmeBatchOp op)
+{
+    static char *kwlist[] = { "ciphertext", "priority", "deadline", NULL };
+    PyObject *py_cipher, *py_deadline = Py_None;
+    PyGpgmeFuture *future;
+    int priority = PYGPGME_PRIORITY_NORMAL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|iO", kwlist,
+                                     &py_cipher, &priority, &py_deadline))
+        return NULL;
+
+    future = future_new(op, 0);
+    if (future == NULL)
+        return NULL;
+    if (pygpgme_batch_get_buffer(py_cipher, &future->job.input,
+                                 &future->job.have_input) < 0) {
+        Py_DECREF(future);
+        return NULL;
+    }
+    return executor_submit(self, future, priority, py_deadline);
+}
+
+static PyObject *
+pygpgme_executor_decrypt(PyGpgmeExecutor *self, PyObject *args,
+                         PyObject *kwargs)
+{
+    return executor_decrypt(self, args, kwargs, PYGPGME_BATCH_DECRYPT);
+}
+
+static PyObject *
+pygpgme_executor_decrypt_verify(PyGpgmeExecutor *self, PyObject *args,
+                                PyObject *kwargs)
+{
+    return executor_decrypt(self, args, kwargs,
+                            PYGPGME_BATCH_DECRYPT_VERIFY);
+}
+
+static PyObject *
+pygpgme_executor_sign(PyGpgmeExecutor *self, PyObject *args,
+                      PyObject *kwargs)
+{
+    static char *kwlist[] = { "plaintext", "mode", "priority", "deadline",
+                              NULL };
+    PyObject *py_plain, *py_deadline = Py_None;
+    PyGpgmeFuture *future;
+    int mode = GPGME_SIG_MODE_NORMAL, priority = PYGPGME_PRIORITY_NORMAL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|iiO", kwlist,
+                                     &py_plain, &mode, &priority,
+                                     &py_deadline))
+        return NULL;
+
+    future = future_new(PYGPGME_BATCH_SIGN, mode);
+    if (future == NULL)
+        return NULL;
+    if (pygpgme_batch_get_buffer(py_plain, &future->job.input,
+                                 &future->job.have_input) < 0) {
+        Py_DECREF(future);
+        return NULL;
+    }
+    return executor_submit(self, future, priority, py_deadline);
+}
+
+static PyObject *
+pygpgme_executor_verify(PyGpgmeExecutor *self, PyObject *args,
+                        PyObject *kwargs)
+{
+    static char *kwlist[] = { "signature", "signed_text", "priority",
+                              "deadline", NULL };
+    PyObject *py_sig, *py_signed_text = Py_None, *py_deadline = Py_None;
+    PyGpgmeFuture *future;
+    int priority = PYGPGME_PRIORITY_NORMAL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OiO", kwlist,
+                                     &py_sig, &py_signed_text, &priority,
+                                     &py_deadline))
+        return NULL;
+
+    future = future_new(PYGPGME_BATCH_VERIFY, 0);
+    if (future == NULL)
+        return NULL;
+    if (pygpgme_batch_get_buffer(py_sig, &future->job.input,
+                                 &future->job.have_input) < 0 ||
+        (py_signed_text != Py_None &&
+         pygpgme_batch_get_buffer(py_signed_text, &future->job.signed_text,
+                                  &future->job.have_signed_text) < 0)) {
+        Py_DECREF(future);
+        return NULL;
+    }
+    return executor_submit(self, future, priority, py_deadline);
+}
+
+static PyObject *
+pygpgme_executor_shutdown(PyGpgmeExecutor *self, PyObject *args)
+{
+    int wait = 1;
+
+    if (!PyArg_ParseTuple(args, "|i", &wait))
+        return NULL;
+
+    executor_shutdown(self, wait);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+pygpgme_executor_enter(PyGpgmeExecutor *self)
+{
+    Py_INCREF(self);
+    return (PyObject *)self;
+}
+
+static PyObject *
+pygpgme_executor_exit(PyGpgmeExecutor *self, PyObject *args)
+{
+    executor_shutdown(self, 1);
+    Py_RETURN_FALSE;
+}
+
+static PyMethodDef pygpgme_executor_methods[] = {
+    { "encrypt", (PyCFunction)pygpgme_executor_encrypt,
+      METH_VARARGS | METH_KEYWORDS },
+    { "decrypt", (PyCFunction)pygpgme_executor_decrypt,
+      METH_VARARGS | METH_KEYWORDS },
+    { "decrypt_verify", (PyCFunction)pygpgme_executor_decrypt_verify,
+      METH_VARARGS | METH_KEYWORDS },
+    { "sign", (PyCFunction)pygpgme_executor_sign,
+      METH_VARARGS | METH_KEYWORDS },
+    { "verify", (PyCFunction)pygpgme_executor_verify,
+      METH_VARARGS | METH_KEYWORDS },
+    { "shutdown", (PyCFunction)pygpgme_executor_shutdown, METH_VARARGS },
+    { "__enter__", (PyCFunction)pygpgme_executor_enter, METH_NOARGS },
+    { "__exit__", (PyCFunction)pygpgme_executor_exit, METH_VARARGS },
+    { NULL, 0, 0 }
+};
+
+static PyObject *
+pygpgme_executor_get_workers(PyGpgmeExecutor *self)
+{
+    return PyInt_FromLong(self->nworkers);
+}
+
+/* the number of jobs each worker has run, and how many of those it
+ * stole from another worker's queue */
+static PyObject *
+pygpgme_executor_get_stats(PyGpgmeExecutor *self)
+{
+    PyObject *list, *item;
+    unsigned long completed, stolen;
+    int i;
+
+    list = PyList_New(self->nworkers);
+    if (list == NULL)
+        return NULL;
+    for (i = 0; i < self->nworkers; i++) {
+        pthread_mutex_lock(&self->workers[i].lock);
+        completed = self->workers[i].completed;
+        stolen = self->workers[i].stolen;
+        pthread_mutex_unlock(&self->workers[i].lock);
+
+        item = Py_BuildValue("{s:k,s:k}", "completed", completed,
+                             "stolen", stolen);
+        if (item == NULL) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, i, item);
+    }
+    return list;
+}
+
+/* per priority class: the jobs queued now, the queue limit, and how
+ * many jobs were submitted, rejected by the limit and expired before
+ * they could run, with the time jobs spent queued */
+static PyObject *
+pygpgme_executor_get_queue_stats(PyGpgmeExecutor *self)
+{
+    ExecutorClass classes[PYGPGME_N_PRIORITIES];
+    PyObject *list, *item;
+    int i;
+
+    if (self->initialised) {
+        pthread_mutex_lock(&self->lock);
+        memcpy(classes, self->classes, sizeof(classes));
+        pthread_mutex_unlock(&self->lock);
+    } else
+        memcpy(classes, self->classes, sizeof(classes));
+
+    list = PyList_New(PYGPGME_N_PRIORITIES);
+    if (list == NULL)
+        return NULL;
+    for (i = 0; i < PYGPGME_N_PRIORITIES; i++) {
+        item = Py_BuildValue("{s:n,s:n,s:k,s:k,s:k,s:d,s:d}",
+                             "queued", classes[i].queued,
+                             "limit", classes[i].limit,
+                             "submitted", classes[i].submitted,
+                             "rejected", classes[i].rejected,
+                             "expired", classes[i].expired,
+                             "wait_time", classes[i].wait_time,
+                             "max_wait_time", classes[i].max_wait_time);
+        if (item == NULL) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, i, item);
+    }
+    return list;
+}
+
+static PyGetSetDef pygpgme_executor_getsets[] = {
+    { "workers", (getter)pygpgme_executor_get_workers },
+    { "stats", (getter)pygpgme_executor_get_stats },
+    { "queue_stats", (getter)pygpgme_executor_get_queue_stats },
+    { NULL, (getter)0, (setter)0 }
+};
+
+PyTypeObject PyGpgmeExecutor_Type = {
+    PyObject_HEAD_INIT(NULL)
+    0,
+    "gpgme.Executor",
+    sizeof(PyGpgmeExecutor),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_init = (initproc)pygpgme_executor_init,
+    .tp_dealloc = (destructor)pygpgme_executor_dealloc,
+    .tp_methods = pygpgme_executor_methods,
+    .tp_getset = pygpgme_executor_getsets,
+    .tp_weaklistoffset = offsetof(PyGpgmeExecutor, weakreflist),
+};
@@ -0,0 +1,406 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+    pygpgme - a Python wrapper for the gpgme library
+    Copyright (C) 2006  James Henstridge
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "pygpgme.h"
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A KeyCache holds references to the most recently used keys, so that
+ * looking up a recipient or signer again doesn't run the engine.  Keys
+ * are found by fingerprint, secret flag, keylist mode and home
+ * directory, so one cache can be shared by contexts using different
+ * keyrings.  Contexts flush the cache they use whenever they change a
+ * keyring.  The cache has a lock of its own, as the contexts sharing
+ * it may be used from several threads. */
+
+typedef struct _KeyCacheEntry KeyCacheEntry;
+struct _KeyCacheEntry {
+    char *name;
+    unsigned long hash;
+    gpgme_key_t key;
+    /* the next entry in the same bucket */
+    KeyCacheEntry *chain;
+    /* the neighbours in order of use */
+    KeyCacheEntry *newer, *older;
+};
+
+typedef struct {
+    PyObject_HEAD
+    pthread_mutex_t lock;
+    int initialised;
+    KeyCacheEntry **buckets;
+    unsigned long nbuckets;
+    KeyCacheEntry *newest, *oldest;
+    Py_ssize_t length;
+    Py_ssize_t size;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long flushes;
+} PyGpgmeKeyCache;
+
+static void
+keycache_entry_free(KeyCacheEntry *entry)
+{
+    gpgme_key_unref(entry->key);
+    free(entry->name);
+    free(entry);
+}
+
+/* drop every entry.  Called with the lock held. */
+static void
+keycache_clear(PyGpgmeKeyCache *self)
+{
+    KeyCacheEntry *entry, *older;
+
+    for (entry = self->newest; entry != NULL; entry = older) {
+        older = entry->older;
+        keycache_entry_free(entry);
+    }
+    if (self->buckets != NULL)
+        memset(self->buckets, 0, self->nbuckets * sizeof(KeyCacheEntry *));
+    self->newest = self->oldest = NULL;
+    self->length = 0;
+}
+
+static void
+pygpgme_keycache_dealloc(PyGpgmeKeyCache *self)
+{
+    if (self->initialised) {
+        keycache_clear(self);
+        pthread_mutex_destroy(&self->lock);
+    }
+    free(self->buckets);
+    PyObject_Del(self);
+}
+
+static int
+pygpgme_keycache_init(PyGpgmeKeyCache *self, PyObject *args,
+                      PyObject *kwargs)
+{
+    static char *kwlist[] = { "size", NULL };
+    Py_ssize_t size = 1024;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|n", kwlist, &size))
+        return -1;
+
+    if (self->initialised) {
+        PyErr_SetString(PyExc_ValueError, "KeyCache already initialised");
+        return -1;
+    }
+    if (size <= 0) {
+        PyErr_SetString(PyExc_ValueError, "size must be positive");
+        return -1;
+    }
+
+    /* a power of two, with at most one entry per bucket when full */
+    self->nbuckets = 16;
+    while (self->nbuckets < (unsigned long)size)
+        self->nbuckets *= 2;
+    self->buckets = calloc(self->nbuckets, sizeof(KeyCacheEntry *));
+    if (self->buckets == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    self->size = size;
+    pthread_mutex_init(&self->lock, NULL);
+    self->initialised = 1;
+    return 0;
+}
+
+/* the name a key is cached under, or NULL if it can't be cached.  The
+ * home directory is the one the engine will use, which for contexts
+ * that don't set one follows GNUPGHOME. */
+static char *
+keycache_name(PyGpgmeContext *ctx, const char *fpr, int secret)
+{
+    gpgme_protocol_t protocol = gpgme_get_protocol(ctx->ctx);
+    gpgme_engine_info_t info;
+    const char *home_dir = NULL;
+    char *name, *p;
+    size_t length;
+
+    if (fpr == NULL)
+        return NULL;
+    for (info = gpgme_ctx_get_engine_info(ctx->ctx); info != NULL;
+         info = info->next)
+        if (info->protocol == protocol)
+            home_dir = info->home_dir;
+    if (home_dir == NULL)
+        home_dir = getenv("GNUPGHOME");
+    if (home_dir == NULL)
+        home_dir = "";
+
+    length = strlen(home_dir) + strlen(fpr) + 32;
+    name = malloc(length);
+    if (name == NULL)
+        return NULL;
+    snprintf(name, length, "%d:%d:%u:%s:", (int)protocol, secret ? 1 : 0,
+             (unsigned int)gpgme_get_keylist_mode(ctx->ctx), home_dir);
+    /* fingerprints compare without regard to case */
+    p = name + strlen(name);
+    while (*fpr != '\0')
+        *p++ = toupper((unsigned char)*fpr++);
+    *p = '\0';
+    return name;
+}
+
+static unsigned long
+keycache_hash(const char *name)
+{
+    unsigned long hash = 2166136261UL;
+
+    while (*name != '\0')
+        hash = (hash ^ (unsigned char)*name++) * 16777619UL;
+    return hash;
+}
+
+/* find the entry for name, or NULL.  Called with the lock held. */
+static KeyCacheEntry *
+keycache_find(PyGpgmeKeyCache *self, const char *name, unsigned long hash)
+{
+    KeyCacheEntry *entry;
+
+    for (entry = self->buckets[hash & (self->nbuckets - 1)]; entry != NULL;
+         entry = entry->chain)
+        if (entry->hash == hash && !strcmp(entry->name, name))
+            return entry;
+    return NULL;
+}
+
+static void
+keycache_unlink(PyGpgmeKeyCache *self, KeyCacheEntry *entry)
+{
+    if (entry->newer != NULL)
+        entry->newer->older = entry->older;
+    else
+        self->newest = entry->older;
+    if (entry->older != NULL)
+        entry->older->newer = entry->newer;
+    else
+        self->oldest = entry->newer;
+    entry->newer = entry->older = NULL;
+}
+
+static void
+keycache_push(PyGpgmeKeyCache *self, KeyCacheEntry *entry)
+{
+    entry->older = self->newest;
+    entry->newer = NULL;
+    if (self->newest != NULL)
+        self->newest->newer = entry;
+    else
+        self->oldest = entry;
+    self->newest = entry;
+}
+
+static void
+keycache_remove(PyGpgmeKeyCache *self, KeyCacheEntry *entry)
+{
+    KeyCacheEntry **link;
+
+    link = &self->buckets[entry->hash & (self->nbuckets - 1)];
+    while (*link != entry)
+        link = &(*link)->chain;
+    *link = entry->chain;
+    keycache_unlink(self, entry);
+    self->length--;
+    keycache_entry_free(entry);
+}
+
+static PyGpgmeKeyCache *
+context_cache(PyGpgmeContext *ctx)
+{
+    if (ctx->key_cache == NULL ||
+        !((PyGpgmeKeyCache *)ctx->key_cache)->initialised)
+        return NULL;
+    return (PyGpgmeKeyCache *)ctx->key_cache;
+}
+
+/* the cached key for fpr, with a reference added, or NULL if ctx has
+ * no cache or the key isn't in it */
+gpgme_key_t
+pygpgme_keycache_lookup(PyGpgmeContext *ctx, const char *fpr, int secret)
+{
+    PyGpgmeKeyCache *self = context_cache(ctx);
+    KeyCacheEntry *entry;
+    gpgme_key_t key = NULL;
+    unsigned long hash;
+    char *name;
+
+    if (self == NULL || (name = keycache_name(ctx, fpr, secret)) == NULL)
+        return NULL;
+    hash = keycache_hash(name);
+
+    pthread_mutex_lock(&self->lock);
+    entry = keycache_find(self, name, hash);
+    if (entry != NULL) {
+        keycache_unlink(self, entry);
+        keycache_push(self, entry);
+        key = entry->key;
+        gpgme_key_ref(key);
+        self->hits++;
+    } else
+        self->misses++;
+    pthread_mutex_unlock(&self->lock);
+
+    free(name);
+    return key;
+}
+
+/* remember a key found by ctx, evicting the least recently used one if
+ * the cache is full */
+void
+pygpgme_keycache_insert(PyGpgmeContext *ctx, gpgme_key_t key, int secret)
+{
+    PyGpgmeKeyCache *self = context_cache(ctx);
+    KeyCacheEntry *entry;
+    unsigned long hash;
+    char *name;
+
+    if (self == NULL || key->subkeys == NULL ||
+        (name = keycache_name(ctx, key->subkeys->fpr, secret)) == NULL)
+        return;
+    hash = keycache_hash(name);
+
+    pthread_mutex_lock(&self->lock);
+    entry = keycache_find(self, name, hash);
+    if (entry != NULL) {
+        /* replace the key with the fresher one */
+        free(name);
+        gpgme_key_ref(key);
+        gpgme_key_unref(entry->key);
+        entry->key = key;
+        keycache_unlink(self, entry);
+        keycache_push(self, entry);
+        pthread_mutex_unlock(&self->lock);
+        return;
+    }
+
+    entry = malloc(sizeof(KeyCacheEntry));
+    if (entry == NULL) {
+        pthread_mutex_unlock(&self->lock);
+        free(name);
+        return;
+    }
+    if (self->length == self->size) {
+        keycache_remove(self, self->oldest);
+        self->evictions++;
+    }
+    entry->name = name;
+    entry->hash = hash;
+    gpgme_key_ref(key);
+    entry->key = key;
+    entry->chain = self->buckets[hash & (self->nbuckets - 1)];
+    self->buckets[hash & (self->nbuckets - 1)] = entry;
+    keycache_push(self, entry);
+    self->length++;
+    pthread_mutex_unlock(&self->lock);
+}
+
+/* ctx has changed a keyring, so the cached keys may be stale */
+void
+pygpgme_keycache_invalidate(PyGpgmeContext *ctx)
+{
+    PyGpgmeKeyCache *self = context_cache(ctx);
+
+    if (self == NULL)
+        return;
+    pthread_mutex_lock(&self->lock);
+    keycache_clear(self);
+    self->flushes++;
+    pthread_mutex_unlock(&self->lock);
+}
+
+static PyObject *
+pygpgme_keycache_flush(PyGpgmeKeyCache *self)
+{
+    if (!self->initialised) {
+        PyErr_SetString(PyExc_ValueError, "KeyCache not initialised");
+        return NULL;
+    }
+    pthread_mutex_lock(&self->lock);
+    keycache_clear(self);
+    self->flushes++;
+    pthread_mutex_unlock(&self->lock);
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef pygpgme_keycache_methods[] = {
+    { "flush", (PyCFunction)pygpgme_keycache_flush, METH_NOARGS },
+    { NULL, 0, 0 }
+};
+
+static Py_ssize_t
+pygpgme_keycache_length(PyGpgmeKeyCache *self)
+{
+    return self->length;
+}
+
+static PySequenceMethods pygpgme_keycache_as_sequence = {
+    .sq_length = (lenfunc)pygpgme_keycache_length,
+};
+
+static PyObject *
+pygpgme_keycache_get_size(PyGpgmeKeyCache *self)
+{
+    return PyInt_FromSsize_t(self->size);
+}
+
+static PyObject *
+pygpgme_keycache_get_stats(PyGpgmeKeyCache *self)
+{
+    PyObject *stats;
+
+    if (!self->initialised) {
+        PyErr_SetString(PyExc_ValueError, "KeyCache not initialised");
+        return NULL;
+    }
+    pthread_mutex_lock(&self->lock);
+    stats = Py_BuildValue("{s:n,s:k,s:k,s:k,s:k}",
+                          "entries", self->length,
+                          "hits", self->hits,
+                          "misses", self->misses,
+                          "evictions", self->evictions,
+                          "flushes", self->flushes);
+    pthread_mutex_unlock(&self->lock);
+    return stats;
+}
+
+static PyGetSetDef pygpgme_keycache_getsets[] = {
+    { "size", (getter)pygpgme_keycache_get_size },
+    { "stats", (getter)pygpgme_keycache_get_stats },
+    { NULL, (getter)0, (setter)0 }
+};
+
+PyTypeObject PyGpgmeKeyCache_Type = {
+    PyObject_HEAD_INIT(NULL)
+    0,
+    "gpgme.KeyCache",
+    sizeof(PyGpgmeKeyCache),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_init = (initproc)pygpgme_keycache_init,
+    .tp_dealloc = (destructor)pygpgme_keycache_dealloc,
+    .tp_methods = pygpgme_keycache_methods,
+    .tp_getset = pygpgme_keycache_getsets,
+    .tp_as_sequence = &pygpgme_keycache_as_sequence,
+};
@@ -18,18 +18,172 @@
     Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 #include "pygpgme.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+/* A KeyIter holds its context until the listing has ended, so it can be
+ * used from any thread while other threads wait for the context.
+ *
+ * A prefetching KeyIter lists keys in a helper thread, which keeps a
+ * bounded queue of keys filled while Python works through the ones
+ * already listed.  The helper thread only runs gpgme, so it never
+ * needs the GIL. */
+struct _PyGpgmeKeyQueue {
+    pthread_mutex_t lock;
+    /* signalled whenever a key is added or taken */
+    pthread_cond_t cond;
+    pthread_t thread;
+    gpgme_key_t *keys;
+    Py_ssize_t size;
+    Py_ssize_t head;
+    Py_ssize_t length;
+    /* set with the reason once the listing has ended */
+    int finished;
+    gpgme_error_t err;
+    int stopping;
+};
+
+static void *
+keyqueue_thread(void *arg)
+{
+    PyGpgmeKeyIter *self = arg;
+    PyGpgmeKeyQueue *queue = self->queue;
+    gpgme_key_t key;
+    gpgme_error_t err;
+
+    for (;;) {
+        pygpgme_op_begin(self->ctx, "keylist_next");
+        err = gpgme_op_keylist_next(self->ctx->ctx, &key);
+        err = pygpgme_op_end(self->ctx, err);
+        pthread_mutex_lock(&queue->lock);
+        if (err != GPG_ERR_NO_ERROR) {
+            queue->err = err;
+            queue->finished = 1;
+            pthread_cond_broadcast(&queue->cond);
+            pthread_mutex_unlock(&queue->lock);
+            break;
+        }
+        while (queue->length == queue->size && !queue->stopping)
+            pthread_cond_wait(&queue->cond, &queue->lock);
+        if (queue->stopping) {
+            pthread_mutex_unlock(&queue->lock);
+            gpgme_key_unref(key);
+            break;
+        }
+        queue->keys[(queue->head + queue->length) % queue->size] = key;
+        queue->length++;
+        pthread_cond_broadcast(&queue->cond);
+        pthread_mutex_unlock(&queue->lock);
+    }
+    return NULL;
+}
+
+/* list keys ahead in a helper thread, keeping up to size of them */
+int
+pygpgme_keyiter_prefetch(PyGpgmeKeyIter *self, Py_ssize_t size)
+{
+    PyGpgmeKeyQueue *queue;
+
+    queue = calloc(1, sizeof(PyGpgmeKeyQueue));
+    if (queue == NULL || (queue->keys = malloc(size * sizeof(gpgme_key_t)))
+        == NULL) {
+        free(queue);
+        PyErr_NoMemory();
+        return -1;
+    }
+    queue->size = size;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+    self->queue = queue;
+
+    errno = pthread_create(&queue->thread, NULL, keyqueue_thread, self);
+    if (errno != 0) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        self->queue = NULL;
+        pthread_mutex_destroy(&queue->lock);
+        pthread_cond_destroy(&queue->cond);
+        free(queue->keys);
+        free(queue);
+        return -1;
+    }
+    return 0;
+}
+
+/* stop the helper thread, and drop the keys it listed that haven't
+ * been taken */
+static void
+keyqueue_free(PyGpgmeKeyQueue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->stopping = 1;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+
+    Py_BEGIN_ALLOW_THREADS;
+    pthread_join(queue->thread, NULL);
+    Py_END_ALLOW_THREADS;
+
+    for (; queue->length > 0; queue->length--) {
+        gpgme_key_unref(queue->keys[queue->head]);
+        queue->head = (queue->head + 1) % queue->size;
+    }
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->cond);
+    free(queue->keys);
+    free(queue);
+}
+
+/* take up to n keys from the queue, waiting until there are n or the
+ * listing has ended.  Called without the GIL. */
+static Py_ssize_t
+keyqueue_take(PyGpgmeKeyQueue *queue, gpgme_key_t *keys, Py_ssize_t n,
+              gpgme_error_t *err)
+{
+    Py_ssize_t count = 0;
+
+    pthread_mutex_lock(&queue->lock);
+    while (count < n) {
+        while (queue->length == 0 && !queue->finished)
+            pthread_cond_wait(&queue->cond, &queue->lock);
+        if (queue->length == 0) {
+            *err = queue->err;
+            break;
+        }
+        while (count < n && queue->length > 0) {
+            keys[count++] = queue->keys[queue->head];
+            queue->head = (queue->head + 1) % queue->size;
+            queue->length--;
+        }
+        pthread_cond_broadcast(&queue->cond);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
 
 static void
 pygpgme_keyiter_dealloc(PyGpgmeKeyIter *self)
 {
+    if (self->queue != NULL) {
+        keyqueue_free(self->queue);
+        self->queue = NULL;
+    }
     if (self->ctx) {
-        gpgme_error_t err = gpgme_op_keylist_end(self->ctx->ctx);
-        PyObject *exc = pygpgme_error_object(err);
+        if (self->locked) {
+            gpgme_error_t err;
+            PyObject *exc;
 
-        if (exc != NULL && exc != Py_None) {
-            PyErr_WriteUnraisable(exc);
+            pygpgme_context_acquire_held(self->ctx);
+            err = gpgme_op_keylist_end(self->ctx->ctx);
+            pygpgme_context_release(self->ctx);
+            exc = pygpgme_error_object(err);
+
+            if (exc != NULL && exc != Py_None) {
+                PyErr_WriteUnraisable(exc);
+            }
+            Py_XDECREF(exc);
+            pygpgme_context_unhold(self->ctx);
         }
-        Py_XDECREF(exc);
         Py_DECREF(self->ctx);
         self->ctx = NULL;
     }
@@ -43,35 +197,135 @@ pygpgme_keyiter_iter(PyGpgmeKeyIter *self)
     return (PyObject *)self;
 }
 
+/* list up to n more keys into keys.  Returns the number listed, which
+ * is only less than n once the listing has ended, or -1 if it ended
+ * with an error and no keys were listed. */
+static Py_ssize_t
+keyiter_list(PyGpgmeKeyIter *self, gpgme_key_t *keys, Py_ssize_t n)
+{
+    gpgme_error_t err = GPG_ERR_NO_ERROR;
+    Py_ssize_t count = 0, i;
+
+    /* keys are listed without the GIL, so only one thread at a time */
+    if (self->busy) {
+        PyErr_SetString(PyExc_ValueError, "KeyIter already executing");
+        return -1;
+    }
+    self->busy = 1;
+    if (self->locked) {
+        /* wait for the thread that started the listing to be done with
+         * the context, unless a helper thread is listing the keys */
+        if (self->queue == NULL)
+            pygpgme_context_acquire_held(self->ctx);
+        Py_BEGIN_ALLOW_THREADS;
+        if (self->queue != NULL)
+            count = keyqueue_take(self->queue, keys, n, &err);
+        else {
+            pygpgme_op_begin(self->ctx, "keylist_next");
+            while (count < n &&
+                   (err = gpgme_op_keylist_next(self->ctx->ctx,
+                                                &keys[count])) ==
+                   GPG_ERR_NO_ERROR)
+                count++;
+            err = pygpgme_op_end(self->ctx, err);
+        }
+        Py_END_ALLOW_THREADS;
+        if (self->queue == NULL)
+            pygpgme_context_release(self->ctx);
+
+        /* the listing is over, so let other threads use the context */
+        if (err != GPG_ERR_NO_ERROR) {
+            if (self->queue != NULL) {
+                keyqueue_free(self->queue);
+                self->queue = NULL;
+            }
+            self->locked = 0;
+            pygpgme_context_unhold(self->ctx);
+            /* an error is raised once the keys before it are taken */
+            if (gpgme_err_source(err) != GPG_ERR_SOURCE_GPGME ||
+                gpgme_err_code(err) != GPG_ERR_EOF)
+                self->err = err;
+        }
+    }
+    self->busy = 0;
+
+    for (i = 0; i < count; i++)
+        pygpgme_keycache_insert(self->ctx, keys[i], self->secret);
+
+    if (count == 0 && self->err != GPG_ERR_NO_ERROR) {
+        err = self->err;
+        self->err = GPG_ERR_NO_ERROR;
+        pygpgme_check_error(err);
+        return -1;
+    }
+    return count;
+}
+
 static PyObject *
 pygpgme_keyiter_next(PyGpgmeKeyIter *self)
 {
-    gpgme_key_t key = NULL;
-    gpgme_error_t err;
+    gpgme_key_t key;
+    Py_ssize_t count;
     PyObject *ret;
 
-    Py_BEGIN_ALLOW_THREADS;
-    err = gpgme_op_keylist_next(self->ctx->ctx, &key);
-    Py_END_ALLOW_THREADS;
+    count = keyiter_list(self, &key, 1);
+    if (count < 0)
+        return NULL;
 
     /* end iteration */
-    if (gpgme_err_source(err) == GPG_ERR_SOURCE_GPGME &&
-        gpgme_err_code(err) == GPG_ERR_EOF) {
+    if (count == 0) {
         PyErr_SetNone(PyExc_StopIteration);
         return NULL;
     }
 
-    if (pygpgme_check_error(err))
-        return NULL;
-
-    if (key == NULL)
-        Py_RETURN_NONE;
-
     ret = pygpgme_key_new(key);
     gpgme_key_unref(key);
     return ret;
 }
 
+/* return a list of up to n keys, listed without taking the GIL back
+ * between them.  The list is empty once all keys have been returned. */
+static PyObject *
+pygpgme_keyiter_next_batch(PyGpgmeKeyIter *self, PyObject *args)
+{
+    Py_ssize_t n, count, i;
+    gpgme_key_t *keys;
+    PyObject *list, *item;
+
+    if (!PyArg_ParseTuple(args, "n", &n))
+        return NULL;
+    if (n <= 0) {
+        PyErr_SetString(PyExc_ValueError, "n must be positive");
+        return NULL;
+    }
+
+    keys = malloc(n * sizeof(gpgme_key_t));
+    if (keys == NULL)
+        return PyErr_NoMemory();
+    count = keyiter_list(self, keys, n);
+    if (count < 0) {
+        free(keys);
+        return NULL;
+    }
+
+    list = PyList_New(count);
+    for (i = 0; i < count; i++) {
+        item = list != NULL ? pygpgme_key_new(keys[i]) : NULL;
+        gpgme_key_unref(keys[i]);
+        if (item == NULL)
+            Py_CLEAR(list);
+        else
+            PyList_SET_ITEM(list, i, item);
+    }
+    free(keys);
+    return list;
+}
+
+static PyMethodDef pygpgme_keyiter_methods[] = {
+    { "next_batch", (PyCFunction)pygpgme_keyiter_next_batch, METH_VARARGS },
+    { NULL, 0, 0 }
+};
+
 PyTypeObject PyGpgmeKeyIter_Type = {
     PyObject_HEAD_INIT(NULL)
     0,
@@ -82,4 +336,5 @@ PyTypeObject PyGpgmeKeyIter_Type = {
     .tp_dealloc = (destructor)pygpgme_keyiter_dealloc,
     .tp_iter = (getiterfunc)pygpgme_keyiter_iter,
     .tp_iternext = (iternextfunc)pygpgme_keyiter_next,
+    .tp_methods = pygpgme_keyiter_methods,
 };
@@ -0,0 +1,414 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+    pygpgme - a Python wrapper for the gpgme library
+    Copyright (C) 2006  James Henstridge
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "pygpgme.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Context.keylist_table() lists keys into columns rather than objects.
+ * Each key is copied into the requested columns and released as soon
+ * as it has been listed, all without the GIL, so scanning a large
+ * keyring takes memory in proportion to the columns asked for and
+ * creates no Python object per key.  The columns are returned as
+ * array.array objects; string columns are one packed string with an
+ * array of n + 1 offsets into it. */
+
+typedef enum {
+    COLUMN_STRING,
+    COLUMN_LONG,
+    COLUMN_SHORT,
+    COLUMN_BYTE
+} ColumnKind;
+
+typedef struct {
+    const char *name;
+    ColumnKind kind;
+    const char *(*string)(gpgme_key_t key);
+    long (*number)(gpgme_key_t key);
+} ColumnSpec;
+
+typedef struct {
+    char *data;
+    size_t length, allocated;
+} ColumnBuffer;
+
+typedef struct {
+    const ColumnSpec *spec;
+    ColumnBuffer values;
+    /* the end of each string, for string columns */
+    ColumnBuffer offsets;
+} Column;
+
+static const char *
+column_fpr(gpgme_key_t key)
+{
+    return key->subkeys != NULL ? key->subkeys->fpr : NULL;
+}
+
+static const char *
+column_keyid(gpgme_key_t key)
+{
+    return key->subkeys != NULL ? key->subkeys->keyid : NULL;
+}
+
+static const char *
+column_uid(gpgme_key_t key)
+{
+    return key->uids != NULL ? key->uids->uid : NULL;
+}
+
+static const char *
+column_email(gpgme_key_t key)
+{
+    return key->uids != NULL ? key->uids->email : NULL;
+}
+
+static long
+column_timestamp(gpgme_key_t key)
+{
+    return key->subkeys != NULL ? key->subkeys->timestamp : 0;
+}
+
+static long
+column_expires(gpgme_key_t key)
+{
+    return key->subkeys != NULL ? key->subkeys->expires : 0;
+}
+
+static long
+column_length(gpgme_key_t key)
+{
+    return key->subkeys != NULL ? key->subkeys->length : 0;
+}
+
+static long
+column_algo(gpgme_key_t key)
+{
+    return key->subkeys != NULL ? key->subkeys->pubkey_algo : 0;
+}
+
+static long
+column_owner_trust(gpgme_key_t key)
+{
+    return key->owner_trust;
+}
+
+static long
+column_flags(gpgme_key_t key)
+{
+    return (key->revoked ? PYGPGME_KEY_FLAG_REVOKED : 0) |
+        (key->expired ? PYGPGME_KEY_FLAG_EXPIRED : 0) |
+        (key->disabled ? PYGPGME_KEY_FLAG_DISABLED : 0) |
+        (key->invalid ? PYGPGME_KEY_FLAG_INVALID : 0) |
+        (key->can_encrypt ? PYGPGME_KEY_FLAG_CAN_ENCRYPT : 0) |
+        (key->can_sign ? PYGPGME_KEY_FLAG_CAN_SIGN : 0) |
+        (key->can_certify ? PYGPGME_KEY_FLAG_CAN_CERTIFY : 0) |
+        (key->secret ? PYGPGME_KEY_FLAG_SECRET : 0);
+}
+
+/* the primary key's fields, and the primary user ID's */
+static const ColumnSpec column_specs[] = {
+    { "fpr", COLUMN_STRING, column_fpr, NULL },
+    { "keyid", COLUMN_STRING, column_keyid, NULL },
+    { "uid", COLUMN_STRING, column_uid, NULL },
+    { "email", COLUMN_STRING, column_email, NULL },
+    { "timestamp", COLUMN_LONG, NULL, column_timestamp },
+    { "expires", COLUMN_LONG, NULL, column_expires },
+    { "length", COLUMN_LONG, NULL, column_length },
+    /* ECC algorithm numbers such as GPGME_PK_EDDSA don't fit a byte */
+    { "algo", COLUMN_SHORT, NULL, column_algo },
+    { "owner_trust", COLUMN_BYTE, NULL, column_owner_trust },
+    { "flags", COLUMN_BYTE, NULL, column_flags },
+    { NULL }
+};
+
+static const char *default_fields[] = {
+    "fpr", "timestamp", "expires", "flags", "algo", NULL
+};
+
+static int
+column_append(ColumnBuffer *buf, const void *data, size_t length)
+{
+    size_t allocated;
+    char *grown;
+
+    if (buf->length + length > buf->allocated) {
+        allocated = buf->allocated ? buf->allocated : 256;
+        while (allocated < buf->length + length)
+            allocated *= 2;
+        grown = realloc(buf->data, allocated);
+        if (grown == NULL)
+            return -1;
+        buf->data = grown;
+        buf->allocated = allocated;
+    }
+    memcpy(buf->data + buf->length, data, length);
+    buf->length += length;
+    return 0;
+}
+
+/* copy a key's fields into the columns.  Called without the GIL. */
+static int
+columns_add_key(Column *columns, int ncolumns, gpgme_key_t key)
+{
+    const char *str;
+    unsigned short word;
+    unsigned char byte;
+    long value;
+    int i;
+
+    for (i = 0; i < ncolumns; i++) {
+        Column *column = &columns[i];
+
+        switch (column->spec->kind) {
+        case COLUMN_STRING:
+            str = column->spec->string(key);
+            if (str != NULL &&
+                column_append(&column->values, str, strlen(str)) < 0)
+                return -1;
+            value = column->values.length;
+            if (column_append(&column->offsets, &value, sizeof(value)) < 0)
+                return -1;
+            break;
+        case COLUMN_LONG:
+            value = column->spec->number(key);
+            if (column_append(&column->values, &value, sizeof(value)) < 0)
+                return -1;
+            break;
+        case COLUMN_SHORT:
+            word = column->spec->number(key);
+            if (column_append(&column->values, &word, sizeof(word)) < 0)
+                return -1;
+            break;
+        case COLUMN_BYTE:
+            byte = column->spec->number(key);
+            if (column_append(&column->values, &byte, sizeof(byte)) < 0)
+                return -1;
+            break;
+        }
+    }
+    return 0;
+}
+
+static PyObject *
+make_array(char typecode, ColumnBuffer *buf)
+{
+    static PyObject *array_type = NULL;
+
+    if (array_type == NULL) {
+        PyObject *array = PyImport_ImportModule("array");
+
+        if (array == NULL)
+            return NULL;
+        array_type = PyObject_GetAttrString(array, "array");
+        Py_DECREF(array);
+        if (array_type == NULL)
+            return NULL;
+    }
+    return PyObject_CallFunction(array_type, "cs#", typecode,
+                                 buf->data != NULL ? buf->data : "",
+                                 (int)buf->length);
+}
+
+static PyObject *
+column_object(Column *column)
+{
+    switch (column->spec->kind) {
+    case COLUMN_STRING:
+        return Py_BuildValue("(s#N)",
+                             column->values.data != NULL ?
+                             column->values.data : "",
+                             (int)column->values.length,
+                             make_array('l', &column->offsets));
+    case COLUMN_LONG:
+        return make_array('l', &column->values);
+    case COLUMN_SHORT:
+        return make_array('H', &column->values);
+    case COLUMN_BYTE:
+        return make_array('B', &column->values);
+    }
+    return NULL;
+}
+
+/* set up a column for each field name, or the default ones if py_fields
+ * is None.  Returns the number of columns, or -1 on error. */
+static int
+columns_new(PyObject *py_fields, Column **columns)
+{
+    PyObject *seq = NULL;
+    const char *name;
+    int ncolumns, i, j;
+
+    if (py_fields == Py_None) {
+        for (ncolumns = 0; default_fields[ncolumns] != NULL; ncolumns++)
+            ;
+    } else {
+        seq = PySequence_Fast(py_fields, "fields must be a sequence");
+        if (seq == NULL)
+            return -1;
+        ncolumns = PySequence_Fast_GET_SIZE(seq);
+    }
+
+    *columns = calloc(ncolumns > 0 ? ncolumns : 1, sizeof(Column));
+    if (*columns == NULL) {
+        Py_XDECREF(seq);
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (i = 0; i < ncolumns; i++) {
+        if (seq != NULL) {
+            PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+
+            if (!PyString_Check(item)) {
+                PyErr_SetString(PyExc_TypeError, "fields must be strings");
+                goto error;
+            }
+            name = PyString_AS_STRING(item);
+        } else
+            name = default_fields[i];
+
+        for (j = 0; column_specs[j].name != NULL; j++)
+            if (!strcmp(column_specs[j].name, name))
+                break;
+        if (column_specs[j].name == NULL) {
+            PyErr_Format(PyExc_ValueError, "unknown field '%s'", name);
+            goto error;
+        }
+        (*columns)[i].spec = &column_specs[j];
+        if (column_specs[j].kind == COLUMN_STRING) {
+            long start = 0;
+
+            if (column_append(&(*columns)[i].offsets, &start,
+                              sizeof(start)) < 0) {
+                PyErr_NoMemory();
+                goto error;
+            }
+        }
+    }
+    Py_XDECREF(seq);
+    return ncolumns;
+
+ error:
+    for (j = 0; j <= i && j < ncolumns; j++)
+        free((*columns)[j].offsets.data);
+    free(*columns);
+    *columns = NULL;
+    Py_XDECREF(seq);
+    return -1;
+}
+
+static void
+columns_free(Column *columns, int ncolumns)
+{
+    int i;
+
+    for (i = 0; i < ncolumns; i++) {
+        free(columns[i].values.data);
+        free(columns[i].offsets.data);
+    }
+    free(columns);
+}
+
+/* list the keys matching py_pattern, returning a dict of columns by
+ * field name */
+PyObject *
+pygpgme_keylist_table(PyGpgmeContext *self, PyObject *py_pattern,
+                      int secret_only, PyObject *py_fields)
+{
+    PyObject *seq = NULL, *ret = NULL, *column;
+    const char *pattern = NULL, **patterns = NULL;
+    Column *columns;
+    gpgme_key_t key;
+    gpgme_error_t err;
+    int ncolumns, i, length;
+
+    ncolumns = columns_new(py_fields, &columns);
+    if (ncolumns < 0)
+        return NULL;
+
+    if (PyString_Check(py_pattern))
+        pattern = PyString_AS_STRING(py_pattern);
+    else if (py_pattern != Py_None) {
+        seq = PySequence_Fast(py_pattern,
+            "first argument must be a string or sequence of strings");
+        if (seq == NULL)
+            goto end;
+        length = PySequence_Fast_GET_SIZE(seq);
+        patterns = malloc((length + 1) * sizeof(const char *));
+        if (patterns == NULL) {
+            PyErr_NoMemory();
+            goto end;
+        }
+        for (i = 0; i < length; i++) {
+            PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+
+            if (!PyString_Check(item)) {
+                PyErr_SetString(PyExc_TypeError,
+                    "first argument must be a string or sequence of strings");
+                goto end;
+            }
+            patterns[i] = PyString_AS_STRING(item);
+        }
+        patterns[i] = NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS;
+    pygpgme_op_begin(self, "keylist_table");
+    if (patterns)
+        err = gpgme_op_keylist_ext_start(self->ctx, patterns, secret_only, 0);
+    else
+        err = gpgme_op_keylist_start(self->ctx, pattern, secret_only);
+    while (err == GPG_ERR_NO_ERROR &&
+           (err = gpgme_op_keylist_next(self->ctx, &key)) ==
+           GPG_ERR_NO_ERROR) {
+        if (columns_add_key(columns, ncolumns, key) < 0) {
+            err = gpgme_error_from_errno(ENOMEM);
+            gpgme_op_keylist_end(self->ctx);
+        }
+        gpgme_key_unref(key);
+    }
+    if (gpgme_err_code(err) == GPG_ERR_EOF)
+        err = GPG_ERR_NO_ERROR;
+    err = pygpgme_op_end(self, err);
+    Py_END_ALLOW_THREADS;
+
+    if (pygpgme_check_error(err))
+        goto end;
+
+    ret = PyDict_New();
+    if (ret == NULL)
+        goto end;
+    for (i = 0; i < ncolumns; i++) {
+        column = column_object(&columns[i]);
+        if (column == NULL ||
+            PyDict_SetItemString(ret, columns[i].spec->name, column) < 0) {
+            Py_XDECREF(column);
+            Py_CLEAR(ret);
+            goto end;
+        }
+        Py_DECREF(column);
+    }
+
+ end:
+    columns_free(columns, ncolumns);
+    free(patterns);
+    Py_XDECREF(seq);
+    return ret;
+}
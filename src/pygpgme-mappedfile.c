@@ -0,0 +1,202 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+    pygpgme - a Python wrapper for the gpgme library
+    Copyright (C) 2006  James Henstridge
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "pygpgme.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* A read-only memory mapping of a whole regular file.  It exports the
+ * mapping through the buffer protocol, so when passed as a data argument
+ * the engine reads the page cache directly without involving Python.
+ * Files that can't be mapped (pipes, sockets, character devices) are
+ * streamed from their file descriptor instead. */
+
+static void
+pygpgme_mappedfile_dealloc(PyGpgmeMappedFile *self)
+{
+    if (self->data != NULL)
+        munmap(self->data, self->size);
+    self->data = NULL;
+    if (self->fd >= 0)
+        close(self->fd);
+    self->fd = -1;
+    Py_XDECREF(self->fallback);
+    self->fallback = NULL;
+    PyObject_Del(self);
+}
+
+/* fd is set before __init__ runs, so dealloc never closes descriptor 0
+ * of an object that wasn't initialised */
+static PyObject *
+pygpgme_mappedfile_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    PyGpgmeMappedFile *self;
+
+    self = (PyGpgmeMappedFile *)PyType_GenericNew(type, args, kwargs);
+    if (self != NULL)
+        self->fd = -1;
+    return (PyObject *)self;
+}
+
+static int
+pygpgme_mappedfile_init(PyGpgmeMappedFile *self, PyObject *args,
+                        PyObject *kwargs)
+{
+    static char *kwlist[] = { "file", NULL };
+    PyObject *file, *path = NULL;
+    struct stat st;
+    int fd;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", kwlist, &file))
+        return -1;
+
+    if (self->data != NULL || self->fallback != NULL || self->fd >= 0) {
+        PyErr_SetString(PyExc_ValueError, "mapping already initialised");
+        return -1;
+    }
+
+    if (PyUnicode_Check(file)) {
+        path = PyUnicode_AsEncodedString(file, Py_FileSystemDefaultEncoding,
+                                         NULL);
+        if (path == NULL)
+            return -1;
+    } else if (PyString_Check(file)) {
+        Py_INCREF(file);
+        path = file;
+    }
+
+    if (path != NULL) {
+        Py_BEGIN_ALLOW_THREADS;
+        fd = open(PyString_AsString(path), O_RDONLY);
+        Py_END_ALLOW_THREADS;
+        if (fd < 0) {
+            PyErr_SetFromErrnoWithFilenameObject(PyExc_IOError, path);
+            Py_DECREF(path);
+            return -1;
+        }
+        Py_DECREF(path);
+        self->fd = fd;
+    } else {
+        fd = PyObject_AsFileDescriptor(file);
+        if (fd < 0)
+            return -1;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        PyErr_SetFromErrno(PyExc_IOError);
+        return -1;
+    }
+
+    if (!S_ISREG(st.st_mode)) {
+        /* stream from the descriptor instead */
+        if (self->fd >= 0)
+            self->fallback = PyInt_FromLong(self->fd);
+        else {
+            Py_INCREF(file);
+            self->fallback = file;
+        }
+        return self->fallback ? 0 : -1;
+    }
+
+    self->size = st.st_size;
+    if (self->size > 0) {
+        void *data;
+
+        Py_BEGIN_ALLOW_THREADS;
+        data = mmap(NULL, self->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data != MAP_FAILED)
+            madvise(data, self->size, MADV_SEQUENTIAL);
+        Py_END_ALLOW_THREADS;
+        if (data == MAP_FAILED) {
+            PyErr_SetFromErrno(PyExc_IOError);
+            return -1;
+        }
+        self->data = data;
+    }
+
+    /* the mapping stays valid once the descriptor is closed */
+    if (self->fd >= 0) {
+        close(self->fd);
+        self->fd = -1;
+    }
+    return 0;
+}
+
+static PyObject *
+pygpgme_mappedfile_get_mapped(PyGpgmeMappedFile *self)
+{
+    return PyBool_FromLong(self->fallback == NULL);
+}
+
+static PyObject *
+pygpgme_mappedfile_get_size(PyGpgmeMappedFile *self)
+{
+    if (self->fallback != NULL)
+        Py_RETURN_NONE;
+    return PyInt_FromSsize_t(self->size);
+}
+
+static PyGetSetDef pygpgme_mappedfile_getsets[] = {
+    { "mapped", (getter)pygpgme_mappedfile_get_mapped },
+    { "size", (getter)pygpgme_mappedfile_get_size },
+    { NULL, (getter)0, (setter)0 }
+};
+
+static int
+pygpgme_mappedfile_getbuffer(PyGpgmeMappedFile *self, Py_buffer *view,
+                             int flags)
+{
+    if (self->fallback != NULL) {
+        PyErr_SetString(PyExc_BufferError, "file is not memory mapped");
+        return -1;
+    }
+    /* an empty file has no mapping */
+    return PyBuffer_FillInfo(view, (PyObject *)self,
+                             self->data ? self->data : "", self->size,
+                             1, flags);
+}
+
+static PyBufferProcs pygpgme_mappedfile_as_buffer = {
+    .bf_getbuffer = (getbufferproc)pygpgme_mappedfile_getbuffer,
+};
+
+PyTypeObject PyGpgmeMappedFile_Type = {
+    PyObject_HEAD_INIT(NULL)
+    0,
+    "gpgme.MappedFile",
+    sizeof(PyGpgmeMappedFile),
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER,
+    .tp_new = pygpgme_mappedfile_new,
+    .tp_init = (initproc)pygpgme_mappedfile_init,
+    .tp_dealloc = (destructor)pygpgme_mappedfile_dealloc,
+    .tp_getset = pygpgme_mappedfile_getsets,
+    .tp_as_buffer = &pygpgme_mappedfile_as_buffer,
+};
+
+/* the object to read instead when the file could not be mapped, or NULL */
+PyObject *
+pygpgme_mappedfile_fallback(PyObject *obj)
+{
+    if (!PyObject_TypeCheck(obj, &PyGpgmeMappedFile_Type))
+        return NULL;
+    return ((PyGpgmeMappedFile *)obj)->fallback;
+}
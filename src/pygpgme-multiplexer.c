@@ -0,0 +1,205 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+    pygpgme - a Python wrapper for the gpgme library
+    Copyright (C) 2006  James Henstridge
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "pygpgme.h"
+
+/* A Multiplexer drives operations started on any number of contexts
+ * from a single thread, using gpgme's global event loop: gpgme_wait()
+ * with no context services every operation started without an
+ * io_handler and returns whichever one finished.  Only one Multiplexer
+ * should drive the global loop at a time, since operations finished for
+ * contexts it doesn't know about are ignored. */
+
+static void
+pygpgme_multiplexer_dealloc(PyGpgmeMultiplexer *self)
+{
+    Py_XDECREF(self->pending);
+    Py_XDECREF(self->ready);
+    PyObject_Del(self);
+}
+
+static int
+pygpgme_multiplexer_init(PyGpgmeMultiplexer *self, PyObject *args,
+                         PyObject *kwargs)
+{
+    static char *kwlist[] = { NULL };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "", kwlist))
+        return -1;
+
+    Py_CLEAR(self->pending);
+    Py_CLEAR(self->ready);
+    self->pending = PyList_New(0);
+    self->ready = PyList_New(0);
+    if (self->pending == NULL || self->ready == NULL)
+        return -1;
+    return 0;
+}
+
+static PyObject *
+pygpgme_multiplexer_add(PyGpgmeMultiplexer *self, PyObject *args)
+{
+    PyGpgmeOperation *op;
+
+    if (!PyArg_ParseTuple(args, "O!", &PyGpgmeOperation_Type, &op))
+        return NULL;
+
+    if (op->done) {
+        if (PyList_Append(self->ready, (PyObject *)op) < 0)
+            return NULL;
+        Py_RETURN_NONE;
+    }
+    if (op->ctx->io_handler != NULL) {
+        PyErr_SetString(PyExc_ValueError,
+                        "operation is driven by the context's io_handler");
+        return NULL;
+    }
+    if (PySequence_Contains(self->pending, (PyObject *)op)) {
+        PyErr_SetString(PyExc_ValueError, "operation already added");
+        return NULL;
+    }
+    if (PyList_Append(self->pending, (PyObject *)op) < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+/* return the next finished operation, or None if hang is false and none
+ * has finished yet, or if there are no operations left */
+static PyObject *
+multiplexer_wait(PyGpgmeMultiplexer *self, int hang)
+{
+    PyGpgmeOperation *op;
+    gpgme_ctx_t ctx;
+    gpgme_error_t err = GPG_ERR_NO_ERROR;
+    Py_ssize_t i, length;
+
+    for (;;) {
+        if (PyList_GET_SIZE(self->ready) > 0) {
+            op = (PyGpgmeOperation *)PyList_GET_ITEM(self->ready, 0);
+            Py_INCREF(op);
+            if (PySequence_DelItem(self->ready, 0) < 0) {
+                Py_DECREF(op);
+                return NULL;
+            }
+            return (PyObject *)op;
+        }
+
+        length = PyList_GET_SIZE(self->pending);
+        if (length == 0)
+            Py_RETURN_NONE;
+
+        /* an operation may have been finished by its own wait() */
+        for (i = 0; i < length; i++) {
+            op = (PyGpgmeOperation *)PyList_GET_ITEM(self->pending, i);
+            if (op->done)
+                break;
+        }
+        if (i == length) {
+            err = GPG_ERR_NO_ERROR;
+            Py_BEGIN_ALLOW_THREADS;
+            ctx = gpgme_wait(NULL, &err, hang);
+            Py_END_ALLOW_THREADS;
+
+            if (ctx == NULL) {
+                if (pygpgme_check_error(err))
+                    return NULL;
+                Py_RETURN_NONE;
+            }
+            for (i = 0; i < length; i++) {
+                op = (PyGpgmeOperation *)PyList_GET_ITEM(self->pending, i);
+                if (op->ctx->ctx == ctx)
+                    break;
+            }
+            if (i == length)
+                continue;
+        }
+
+        Py_INCREF(op);
+        if (PySequence_DelItem(self->pending, i) < 0) {
+            Py_DECREF(op);
+            return NULL;
+        }
+        if (!op->done)
+            pygpgme_operation_complete(op, err);
+        return (PyObject *)op;
+    }
+}
+
+static PyObject *
+pygpgme_multiplexer_wait(PyGpgmeMultiplexer *self, PyObject *args)
+{
+    int hang = 1;
+
+    if (!PyArg_ParseTuple(args, "|i", &hang))
+        return NULL;
+
+    return multiplexer_wait(self, hang);
+}
+
+static PyMethodDef pygpgme_multiplexer_methods[] = {
+    { "add", (PyCFunction)pygpgme_multiplexer_add, METH_VARARGS },
+    { "wait", (PyCFunction)pygpgme_multiplexer_wait, METH_VARARGS },
+    { NULL, 0, 0 }
+};
+
+static Py_ssize_t
+pygpgme_multiplexer_length(PyGpgmeMultiplexer *self)
+{
+    return PyList_GET_SIZE(self->pending) + PyList_GET_SIZE(self->ready);
+}
+
+static PySequenceMethods pygpgme_multiplexer_as_sequence = {
+    .sq_length = (lenfunc)pygpgme_multiplexer_length,
+};
+
+static PyObject *
+pygpgme_multiplexer_iter(PyGpgmeMultiplexer *self)
+{
+    Py_INCREF(self);
+    return (PyObject *)self;
+}
+
+/* iterating yields operations as they finish, until none are left */
+static PyObject *
+pygpgme_multiplexer_next(PyGpgmeMultiplexer *self)
+{
+    PyObject *op;
+
+    op = multiplexer_wait(self, 1);
+    if (op == Py_None) {
+        Py_DECREF(op);
+        PyErr_SetNone(PyExc_StopIteration);
+        return NULL;
+    }
+    return op;
+}
+
+PyTypeObject PyGpgmeMultiplexer_Type = {
+    PyObject_HEAD_INIT(NULL)
+    0,
+    "gpgme.Multiplexer",
+    sizeof(PyGpgmeMultiplexer),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_init = (initproc)pygpgme_multiplexer_init,
+    .tp_dealloc = (destructor)pygpgme_multiplexer_dealloc,
+    .tp_methods = pygpgme_multiplexer_methods,
+    .tp_as_sequence = &pygpgme_multiplexer_as_sequence,
+    .tp_iter = (getiterfunc)pygpgme_multiplexer_iter,
+    .tp_iternext = (iternextfunc)pygpgme_multiplexer_next,
+};
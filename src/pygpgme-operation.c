@@ -0,0 +1,544 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+    pygpgme - a Python wrapper for the gpgme library
+    Copyright (C) 2006  James Henstridge
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "pygpgme.h"
+
+/* An Operation is returned by the Context *_start() methods.  If the
+ * context has an io_handler, the engine's file descriptors are watched
+ * by that event loop and the operation finishes from its callbacks;
+ * otherwise wait() drives it to completion. */
+
+static void
+operation_release_data(PyGpgmeOperation *self)
+{
+    int i;
+
+    for (i = 0; i < self->ndata; i++) {
+        pygpgme_data_release(self->data[i], self->py_data[i]);
+        self->data[i] = NULL;
+        self->py_data[i] = NULL;
+    }
+    self->ndata = 0;
+    pygpgme_recipients_free(self->recp, self->py_recp);
+    self->recp = NULL;
+    self->py_recp = NULL;
+}
+
+static void
+pygpgme_operation_dealloc(PyGpgmeOperation *self)
+{
+    if (self->ctx != NULL && self->ctx->op == self) {
+        /* the operation is abandoned */
+        self->ctx->op = NULL;
+        if (self->started && !self->done) {
+            Py_BEGIN_ALLOW_THREADS;
+            gpgme_cancel(self->ctx->ctx);
+            Py_END_ALLOW_THREADS;
+        }
+    }
+    if (self->locked)
+        pygpgme_context_unhold(self->ctx);
+    operation_release_data(self);
+    Py_XDECREF(self->keys);
+    Py_XDECREF(self->result);
+    Py_XDECREF(self->exc_type);
+    Py_XDECREF(self->exc_value);
+    Py_XDECREF(self->exc_traceback);
+    Py_XDECREF(self->callbacks);
+    Py_XDECREF(self->ctx);
+    PyObject_Del(self);
+}
+
+/* record the outcome of the operation and run the done callbacks */
+void
+pygpgme_operation_finish(PyGpgmeOperation *self, gpgme_error_t err)
+{
+    PyObject *callbacks, *ret;
+    Py_ssize_t i;
+
+    if (self->done)
+        return;
+
+    /* make sure buffered output is written before it is released */
+    for (i = 0; i < self->ndata && err == GPG_ERR_NO_ERROR; i++)
+        if (self->output[i])
+            err = pygpgme_data_flush(self->data[i]);
+    operation_release_data(self);
+    if (self->ctx->op == self)
+        self->ctx->op = NULL;
+
+    switch (self->type) {
+    case PYGPGME_OP_ENCRYPT:
+        if (pygpgme_check_error(err))
+            pygpgme_decode_encrypt_result(self->ctx);
+        else
+            self->result = Py_None;
+        Py_XINCREF(self->result);
+        break;
+    case PYGPGME_OP_DECRYPT:
+        if (pygpgme_check_error(err))
+            pygpgme_decode_decrypt_result(self->ctx);
+        else
+            self->result = Py_None;
+        Py_XINCREF(self->result);
+        break;
+    case PYGPGME_OP_SIGN:
+        self->result = pygpgme_decode_sign_result(self->ctx, err);
+        break;
+    case PYGPGME_OP_VERIFY:
+        self->result = pygpgme_decode_verify_result(self->ctx, err);
+        break;
+    case PYGPGME_OP_IMPORT:
+        pygpgme_keycache_invalidate(self->ctx);
+        if (!pygpgme_check_error(err))
+            self->result = pygpgme_import_result(self->ctx->ctx);
+        break;
+    case PYGPGME_OP_KEYLIST:
+        if (!pygpgme_check_error(err)) {
+            self->result = self->keys;
+            self->keys = NULL;
+        }
+        break;
+    }
+    if (self->result == NULL)
+        PyErr_Fetch(&self->exc_type, &self->exc_value, &self->exc_traceback);
+    self->done = 1;
+    /* the results have been read, so the context is free again */
+    if (self->locked) {
+        self->locked = 0;
+        pygpgme_context_unhold(self->ctx);
+    }
+
+    /* callbacks may add more callbacks, which are run immediately */
+    callbacks = self->callbacks;
+    self->callbacks = NULL;
+    for (i = 0; callbacks != NULL && i < PyList_GET_SIZE(callbacks); i++) {
+        PyObject *callback = PyList_GET_ITEM(callbacks, i);
+
+        ret = PyObject_CallFunctionObjArgs(callback, self, NULL);
+        if (ret == NULL)
+            PyErr_WriteUnraisable(callback);
+        Py_XDECREF(ret);
+    }
+    Py_XDECREF(callbacks);
+}
+
+static PyObject *
+pygpgme_operation_done(PyGpgmeOperation *self)
+{
+    return PyBool_FromLong(self->done);
+}
+
+static PyObject *
+pygpgme_operation_result(PyGpgmeOperation *self)
+{
+    if (!self->done) {
+        PyErr_SetString(PyExc_ValueError, "operation has not finished");
+        return NULL;
+    }
+    if (self->result == NULL) {
+        Py_XINCREF(self->exc_type);
+        Py_XINCREF(self->exc_value);
+        Py_XINCREF(self->exc_traceback);
+        PyErr_Restore(self->exc_type, self->exc_value, self->exc_traceback);
+        return NULL;
+    }
+    Py_INCREF(self->result);
+    return self->result;
+}
+
+/* finish an operation driven by gpgme_wait(), which doesn't deliver
+ * next-key events */
+void
+pygpgme_operation_complete(PyGpgmeOperation *self, gpgme_error_t err)
+{
+    gpgme_key_t key;
+    PyObject *item;
+
+    if (self->type == PYGPGME_OP_KEYLIST && err == GPG_ERR_NO_ERROR) {
+        /* the keys are queued by the finished operation */
+        while ((err = gpgme_op_keylist_next(self->ctx->ctx, &key)) ==
+               GPG_ERR_NO_ERROR) {
+            item = pygpgme_key_new(key);
+            gpgme_key_unref(key);
+            if (item == NULL || PyList_Append(self->keys, item) < 0) {
+                Py_XDECREF(item);
+                err = pygpgme_check_pyerror();
+                break;
+            }
+            Py_DECREF(item);
+        }
+        if (gpgme_err_code(err) == GPG_ERR_EOF)
+            err = GPG_ERR_NO_ERROR;
+        gpgme_op_keylist_end(self->ctx->ctx);
+    }
+    pygpgme_operation_finish(self, err);
+}
+
+/* run the operation to completion, for contexts without an io_handler.
+ * The operation is cancelled with a timeout error if it doesn't finish
+ * within timeout seconds, or the context's timeout if that is None. */
+static PyObject *
+pygpgme_operation_wait(PyGpgmeOperation *self, PyObject *args)
+{
+    PyObject *py_timeout = Py_None;
+    gpgme_error_t err = GPG_ERR_NO_ERROR;
+    double timeout = self->ctx->timeout, deadline = 0;
+    int expired;
+
+    if (!PyArg_ParseTuple(args, "|O", &py_timeout))
+        return NULL;
+    if (py_timeout != Py_None) {
+        timeout = PyFloat_AsDouble(py_timeout);
+        if (PyErr_Occurred())
+            return NULL;
+        if (timeout < 0) {
+            PyErr_SetString(PyExc_ValueError,
+                            "timeout must not be negative");
+            return NULL;
+        }
+    }
+
+    if (self->done)
+        return pygpgme_operation_result(self);
+
+    if (self->ctx->io_handler != NULL) {
+        PyErr_SetString(PyExc_ValueError,
+                        "operation is driven by the context's io_handler");
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS;
+    if (timeout > 0 || py_timeout != Py_None)
+        deadline = pygpgme_now() + timeout;
+    pygpgme_watchdog_arm(self->ctx, deadline);
+    gpgme_wait(self->ctx->ctx, &err, 1);
+    expired = pygpgme_watchdog_disarm(self->ctx);
+    Py_END_ALLOW_THREADS;
+
+    if (expired && gpgme_err_code(err) == GPG_ERR_CANCELED)
+        err = gpgme_err_make(gpgme_err_source(err), GPG_ERR_TIMEOUT);
+    pygpgme_operation_complete(self, err);
+    return pygpgme_operation_result(self);
+}
+
+static PyObject *
+pygpgme_operation_add_done_callback(PyGpgmeOperation *self,
+                                    PyObject *callback)
+{
+    PyObject *ret;
+
+    if (self->done) {
+        ret = PyObject_CallFunctionObjArgs(callback, self, NULL);
+        if (ret == NULL)
+            return NULL;
+        Py_DECREF(ret);
+        Py_RETURN_NONE;
+    }
+    if (self->callbacks == NULL) {
+        self->callbacks = PyList_New(0);
+        if (self->callbacks == NULL)
+            return NULL;
+    }
+    if (PyList_Append(self->callbacks, callback) < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef pygpgme_operation_methods[] = {
+    { "done", (PyCFunction)pygpgme_operation_done, METH_NOARGS },
+    { "result", (PyCFunction)pygpgme_operation_result, METH_NOARGS },
+    { "wait", (PyCFunction)pygpgme_operation_wait, METH_VARARGS },
+    { "add_done_callback", (PyCFunction)pygpgme_operation_add_done_callback,
+      METH_O },
+    { NULL, 0, 0 }
+};
+
+static PyObject *
+pygpgme_operation_get_context(PyGpgmeOperation *self)
+{
+    Py_INCREF(self->ctx);
+    return (PyObject *)self->ctx;
+}
+
+static PyGetSetDef pygpgme_operation_getsets[] = {
+    { "context", (getter)pygpgme_operation_get_context },
+    { NULL, (getter)0, (setter)0 }
+};
+
+PyTypeObject PyGpgmeOperation_Type = {
+    PyObject_HEAD_INIT(NULL)
+    0,
+    "gpgme.Operation",
+    sizeof(PyGpgmeOperation),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_init = pygpgme_no_constructor,
+    .tp_dealloc = (destructor)pygpgme_operation_dealloc,
+    .tp_methods = pygpgme_operation_methods,
+    .tp_getset = pygpgme_operation_getsets,
+};
+
+/* create an operation for ctx, which must not already be running one.
+ * Waits for other threads using the context. */
+PyGpgmeOperation *
+pygpgme_operation_new(PyGpgmeContext *ctx, PyGpgmeOpType type)
+{
+    PyGpgmeOperation *self;
+
+    if (ctx->op != NULL) {
+        PyErr_SetString(PyExc_ValueError,
+                        "an operation is already in progress");
+        return NULL;
+    }
+
+    self = PyObject_New(PyGpgmeOperation, &PyGpgmeOperation_Type);
+    if (self == NULL)
+        return NULL;
+    Py_INCREF(ctx);
+    self->ctx = ctx;
+    self->type = type;
+    self->started = 0;
+    self->done = 0;
+    self->locked = 0;
+    self->recp = NULL;
+    self->py_recp = NULL;
+    self->ndata = 0;
+    self->keys = NULL;
+    self->result = NULL;
+    self->exc_type = self->exc_value = self->exc_traceback = NULL;
+    self->callbacks = NULL;
+    if (type == PYGPGME_OP_KEYLIST) {
+        self->keys = PyList_New(0);
+        if (self->keys == NULL) {
+            Py_DECREF(self);
+            return NULL;
+        }
+    }
+    /* held until the operation finishes */
+    pygpgme_context_hold(ctx, 0);
+    self->locked = 1;
+    ctx->op = self;
+    return self;
+}
+
+/* hand a data object created with pygpgme_data_new() to the operation,
+ * to be released when it finishes */
+int
+pygpgme_operation_add_data(PyGpgmeOperation *self, gpgme_data_t data,
+                           PyObject *py_data, int output)
+{
+    if (self->ndata == PYGPGME_OPERATION_MAX_DATA) {
+        pygpgme_data_release(data, py_data);
+        PyErr_SetString(PyExc_ValueError, "too many data objects");
+        return -1;
+    }
+    self->data[self->ndata] = data;
+    self->py_data[self->ndata] = py_data;
+    self->output[self->ndata] = output;
+    self->ndata++;
+    return 0;
+}
+
+/* called with the result of the gpgme_op_*_start() call.  Returns the
+ * operation, or raises the error. */
+PyObject *
+pygpgme_operation_started(PyGpgmeOperation *self, gpgme_error_t err)
+{
+    if (err != GPG_ERR_NO_ERROR) {
+        if (!self->done)
+            pygpgme_operation_finish(self, err);
+        pygpgme_operation_result(self);
+        Py_DECREF(self);
+        return NULL;
+    }
+    self->started = 1;
+    return (PyObject *)self;
+}
+
+/* A callable registered with the io_handler for one of the engine's
+ * file descriptors.  It keeps the operation alive while it is being
+ * watched. */
+typedef struct {
+    PyObject_HEAD
+    PyGpgmeContext *ctx;
+    PyGpgmeOperation *op;
+    int fd;
+    int dir;
+    gpgme_io_cb_t fnc;
+    void *fnc_data;
+} PyGpgmeIOWatch;
+
+static void
+pygpgme_iowatch_dealloc(PyGpgmeIOWatch *self)
+{
+    Py_XDECREF(self->op);
+    Py_XDECREF(self->ctx);
+    PyObject_Del(self);
+}
+
+static PyObject *
+pygpgme_iowatch_call(PyGpgmeIOWatch *self, PyObject *args, PyObject *kwargs)
+{
+    /* the handler may drop its reference from within the call */
+    Py_INCREF(self);
+    self->fnc(self->fnc_data, self->fd);
+    Py_DECREF(self);
+    Py_RETURN_NONE;
+}
+
+PyTypeObject PyGpgmeIOWatch_Type = {
+    PyObject_HEAD_INIT(NULL)
+    0,
+    "gpgme.IOWatch",
+    sizeof(PyGpgmeIOWatch),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_init = pygpgme_no_constructor,
+    .tp_dealloc = (destructor)pygpgme_iowatch_dealloc,
+    .tp_call = (ternaryfunc)pygpgme_iowatch_call,
+};
+
+static gpgme_error_t
+pygpgme_add_io_cb(void *data, int fd, int dir, gpgme_io_cb_t fnc,
+                  void *fnc_data, void **r_tag)
+{
+    PyGpgmeContext *ctx = data;
+    PyGpgmeIOWatch *watch;
+    PyGILState_STATE state;
+    PyObject *ret;
+    gpgme_error_t err = GPG_ERR_NO_ERROR;
+
+    state = PyGILState_Ensure();
+    watch = PyObject_New(PyGpgmeIOWatch, &PyGpgmeIOWatch_Type);
+    if (watch == NULL) {
+        err = pygpgme_check_pyerror();
+        goto end;
+    }
+    Py_INCREF(ctx);
+    watch->ctx = ctx;
+    watch->op = ctx->op;
+    Py_XINCREF(watch->op);
+    watch->fd = fd;
+    watch->dir = dir;
+    watch->fnc = fnc;
+    watch->fnc_data = fnc_data;
+
+    /* dir is 1 when gpgme reads from the descriptor */
+    ret = PyObject_CallMethod(ctx->io_handler,
+                              dir ? "add_reader" : "add_writer",
+                              "iO", fd, watch);
+    if (ret == NULL) {
+        Py_DECREF(watch);
+        err = pygpgme_check_pyerror();
+        goto end;
+    }
+    Py_DECREF(ret);
+    *r_tag = watch;
+ end:
+    PyGILState_Release(state);
+    return err;
+}
+
+static void
+pygpgme_remove_io_cb(void *tag)
+{
+    PyGpgmeIOWatch *watch = tag;
+    PyGILState_STATE state;
+    PyObject *ret;
+
+    state = PyGILState_Ensure();
+    ret = PyObject_CallMethod(watch->ctx->io_handler,
+                              watch->dir ? "remove_reader" : "remove_writer",
+                              "i", watch->fd);
+    if (ret == NULL)
+        PyErr_WriteUnraisable(watch->ctx->io_handler);
+    Py_XDECREF(ret);
+    Py_DECREF(watch);
+    PyGILState_Release(state);
+}
+
+static void
+pygpgme_event_io_cb(void *data, gpgme_event_io_t type, void *type_data)
+{
+    PyGpgmeContext *ctx = data;
+    PyGpgmeOperation *op;
+    PyGILState_STATE state;
+    gpgme_error_t err;
+    PyObject *item;
+
+    state = PyGILState_Ensure();
+    op = ctx->op;
+    switch (type) {
+    case GPGME_EVENT_DONE:
+        /* the status of the operation comes first in the event data of
+         * every gpgme version */
+        err = *(gpgme_error_t *)type_data;
+#if GPGME_VERSION_NUMBER >= 0x010500
+        if (err == GPG_ERR_NO_ERROR)
+            err = ((gpgme_io_event_done_data_t)type_data)->op_err;
+#endif
+        if (op != NULL) {
+            Py_INCREF(op);
+            pygpgme_operation_finish(op, err);
+            Py_DECREF(op);
+        }
+        break;
+    case GPGME_EVENT_NEXT_KEY:
+        if (op != NULL && op->keys != NULL) {
+            item = pygpgme_key_new((gpgme_key_t)type_data);
+            if (item == NULL || PyList_Append(op->keys, item) < 0)
+                PyErr_WriteUnraisable((PyObject *)op);
+            Py_XDECREF(item);
+        }
+        break;
+    default:
+        break;
+    }
+    PyGILState_Release(state);
+}
+
+/* set the event loop used to drive started operations.  handler needs
+ * add_reader(fd, callback), add_writer(fd, callback), remove_reader(fd)
+ * and remove_writer(fd) methods, as provided by asyncio-style loops. */
+int
+pygpgme_set_io_handler(PyGpgmeContext *ctx, PyObject *handler)
+{
+    struct gpgme_io_cbs io_cbs = { NULL, NULL, NULL, NULL, NULL };
+
+    if (ctx->op != NULL) {
+        PyErr_SetString(PyExc_ValueError,
+                        "can not change io_handler while an operation "
+                        "is in progress");
+        return -1;
+    }
+
+    if (handler != NULL && handler != Py_None) {
+        io_cbs.add = pygpgme_add_io_cb;
+        io_cbs.add_priv = ctx;
+        io_cbs.remove = pygpgme_remove_io_cb;
+        io_cbs.event = pygpgme_event_io_cb;
+        io_cbs.event_priv = ctx;
+        Py_INCREF(handler);
+    } else {
+        handler = NULL;
+    }
+    gpgme_set_io_cbs(ctx->ctx, &io_cbs);
+    Py_XDECREF(ctx->io_handler);
+    ctx->io_handler = handler;
+    return 0;
+}
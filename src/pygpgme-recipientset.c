@@ -0,0 +1,262 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+    pygpgme - a Python wrapper for the gpgme library
+    Copyright (C) 2006  James Henstridge
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "pygpgme.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* A RecipientSet is an immutable group of encryption keys, checked
+ * once when it is built.  Its NULL terminated key array is passed to
+ * gpgme as it is by every encrypt method, so encrypting to the same
+ * group repeatedly doesn't rebuild the array each time. */
+
+static void
+pygpgme_recipientset_dealloc(PyGpgmeRecipientSet *self)
+{
+    int i;
+
+    for (i = 0; i < self->length; i++)
+        gpgme_key_unref(self->keys[i]);
+    free(self->keys);
+    PyObject_Del(self);
+}
+
+/* the reason the key can't be encrypted to, or 0 */
+static gpgme_error_t
+recipientset_check_key(gpgme_key_t key)
+{
+    if (key->revoked)
+        return gpgme_error(GPG_ERR_CERT_REVOKED);
+    if (key->expired)
+        return gpgme_error(GPG_ERR_KEY_EXPIRED);
+    if (key->disabled || key->invalid)
+        return gpgme_error(GPG_ERR_UNUSABLE_PUBKEY);
+    if (!key->can_encrypt)
+        return gpgme_error(GPG_ERR_WRONG_KEY_USAGE);
+    return GPG_ERR_NO_ERROR;
+}
+
+static const char *
+key_fpr(gpgme_key_t key)
+{
+    return key->subkeys != NULL ? key->subkeys->fpr : NULL;
+}
+
+/* add the key unless it is already in the set */
+static void
+recipientset_add(PyGpgmeRecipientSet *self, gpgme_key_t key)
+{
+    const char *fpr = key_fpr(key);
+    int i;
+
+    for (i = 0; i < self->length; i++) {
+        if (self->keys[i] == key ||
+            (fpr != NULL && key_fpr(self->keys[i]) != NULL &&
+             !strcmp(fpr, key_fpr(self->keys[i]))))
+            return;
+    }
+    gpgme_key_ref(key);
+    self->keys[self->length++] = key;
+    self->keys[self->length] = NULL;
+}
+
+/* raise an unusable public key error listing the rejected keys in its
+ * invalid_recipients attribute, as encrypt() does */
+static void
+recipientset_raise_invalid(PyObject *invalid)
+{
+    PyObject *err_type, *err_value, *err_traceback;
+
+    pygpgme_check_error(gpgme_error(GPG_ERR_UNUSABLE_PUBKEY));
+    PyErr_Fetch(&err_type, &err_value, &err_traceback);
+    PyErr_NormalizeException(&err_type, &err_value, &err_traceback);
+    PyObject_SetAttrString(err_value, "invalid_recipients", invalid);
+    PyErr_Restore(err_type, err_value, err_traceback);
+}
+
+static int
+pygpgme_recipientset_init(PyGpgmeRecipientSet *self, PyObject *args,
+                          PyObject *kwargs)
+{
+    static char *kwlist[] = { "recipients", "ctx", NULL };
+    PyObject *py_recp, *ctx = Py_None, *seq, *invalid = NULL;
+    Py_ssize_t length, i;
+    int ret = -1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O", kwlist,
+                                     &py_recp, &ctx))
+        return -1;
+
+    if (self->keys != NULL) {
+        PyErr_SetString(PyExc_ValueError, "RecipientSet is immutable");
+        return -1;
+    }
+    if (ctx != Py_None && !PyObject_TypeCheck(ctx, &PyGpgmeContext_Type)) {
+        PyErr_SetString(PyExc_TypeError, "ctx must be a gpgme.Context");
+        return -1;
+    }
+
+    seq = PySequence_Fast(py_recp, "recipients must be a sequence");
+    if (seq == NULL)
+        return -1;
+    length = PySequence_Fast_GET_SIZE(seq);
+    self->keys = malloc((length + 1) * sizeof(gpgme_key_t));
+    if (self->keys == NULL) {
+        PyErr_NoMemory();
+        goto end;
+    }
+    self->keys[0] = NULL;
+    invalid = PyList_New(0);
+    if (invalid == NULL)
+        goto end;
+
+    /* fingerprints are looked up in ctx, or a new default context */
+    if (ctx == Py_None) {
+        for (i = 0; i < length; i++)
+            if (!PyObject_TypeCheck(PySequence_Fast_GET_ITEM(seq, i),
+                                    &PyGpgmeKey_Type))
+                break;
+        if (i < length) {
+            ctx = PyObject_CallObject((PyObject *)&PyGpgmeContext_Type,
+                                      NULL);
+            if (ctx == NULL)
+                goto end;
+        } else
+            Py_INCREF(ctx);
+    } else
+        Py_INCREF(ctx);
+
+    for (i = 0; i < length; i++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(seq, i), *key, *entry;
+        gpgme_error_t err;
+
+        if (PyObject_TypeCheck(item, &PyGpgmeKey_Type)) {
+            Py_INCREF(item);
+            key = item;
+        } else if (PyString_Check(item)) {
+            key = PyObject_CallMethod(ctx, "get_key", "O", item);
+            if (key == NULL)
+                break;
+        } else {
+            PyErr_SetString(PyExc_TypeError, "recipients must be gpgme.Key "
+                            "objects or fingerprints");
+            break;
+        }
+
+        err = recipientset_check_key(((PyGpgmeKey *)key)->key);
+        if (err != GPG_ERR_NO_ERROR) {
+            entry = Py_BuildValue("(zN)", key_fpr(((PyGpgmeKey *)key)->key),
+                                  pygpgme_error_object(err));
+            if (entry == NULL || PyList_Append(invalid, entry) < 0) {
+                Py_XDECREF(entry);
+                Py_DECREF(key);
+                break;
+            }
+            Py_DECREF(entry);
+        } else
+            recipientset_add(self, ((PyGpgmeKey *)key)->key);
+        Py_DECREF(key);
+    }
+    Py_DECREF(ctx);
+    if (i < length)
+        goto end;
+
+    if (PyList_GET_SIZE(invalid) > 0) {
+        recipientset_raise_invalid(invalid);
+        goto end;
+    }
+    ret = 0;
+
+ end:
+    Py_XDECREF(invalid);
+    Py_DECREF(seq);
+    if (ret < 0 && self->keys != NULL) {
+        for (i = 0; i < self->length; i++)
+            gpgme_key_unref(self->keys[i]);
+        free(self->keys);
+        self->keys = NULL;
+        self->length = 0;
+    }
+    return ret;
+}
+
+static Py_ssize_t
+pygpgme_recipientset_length(PyGpgmeRecipientSet *self)
+{
+    return self->length;
+}
+
+static PyObject *
+pygpgme_recipientset_item(PyGpgmeRecipientSet *self, Py_ssize_t i)
+{
+    if (i < 0 || i >= self->length) {
+        PyErr_SetString(PyExc_IndexError, "RecipientSet index out of range");
+        return NULL;
+    }
+    return pygpgme_key_new(self->keys[i]);
+}
+
+static PySequenceMethods pygpgme_recipientset_as_sequence = {
+    .sq_length = (lenfunc)pygpgme_recipientset_length,
+    .sq_item = (ssizeargfunc)pygpgme_recipientset_item,
+};
+
+static PyObject *
+pygpgme_recipientset_get_fingerprints(PyGpgmeRecipientSet *self)
+{
+    PyObject *list, *item;
+    int i;
+
+    list = PyList_New(self->length);
+    if (list == NULL)
+        return NULL;
+    for (i = 0; i < self->length; i++) {
+        const char *fpr = key_fpr(self->keys[i]);
+
+        if (fpr != NULL)
+            item = PyString_FromString(fpr);
+        else {
+            Py_INCREF(Py_None);
+            item = Py_None;
+        }
+        if (item == NULL) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, i, item);
+    }
+    return list;
+}
+
+static PyGetSetDef pygpgme_recipientset_getsets[] = {
+    { "fingerprints", (getter)pygpgme_recipientset_get_fingerprints },
+    { NULL, (getter)0, (setter)0 }
+};
+
+PyTypeObject PyGpgmeRecipientSet_Type = {
+    PyObject_HEAD_INIT(NULL)
+    0,
+    "gpgme.RecipientSet",
+    sizeof(PyGpgmeRecipientSet),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_init = (initproc)pygpgme_recipientset_init,
+    .tp_dealloc = (destructor)pygpgme_recipientset_dealloc,
+    .tp_as_sequence = &pygpgme_recipientset_as_sequence,
+    .tp_getset = pygpgme_recipientset_getsets,
+};
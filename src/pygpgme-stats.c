@@ -0,0 +1,121 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+    pygpgme - a Python wrapper for the gpgme library
+    Copyright (C) 2006  James Henstridge
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "pygpgme.h"
+#include <string.h>
+#include <time.h>
+
+/* Operations are synchronous, so the callbacks for an operation run in
+ * the thread that started it.  The current statistics are found through
+ * a thread local pointer rather than threading them through every data
+ * object, which may be shared between contexts. */
+
+__thread PyGpgmeOpStats *pygpgme_op_stats = NULL;
+
+/* seconds on the monotonic clock */
+double
+pygpgme_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* called without the GIL, immediately before an operation */
+void
+pygpgme_op_begin(PyGpgmeContext *self, const char *operation)
+{
+    pygpgme_watchdog_arm(self, self->timeout > 0 ?
+                         pygpgme_now() + self->timeout : 0);
+
+    if (!self->collect_stats) {
+        self->stats.valid = 0;
+        return;
+    }
+    memset(&self->stats, 0, sizeof(self->stats));
+    self->stats.operation = operation;
+    self->stats.outer = pygpgme_op_stats;
+    pygpgme_op_stats = &self->stats;
+    self->stats.start = pygpgme_now();
+}
+
+/* called without the GIL, immediately after an operation.  Returns
+ * err, replacing the cancellation error of an operation that ran past
+ * its deadline with a timeout error. */
+gpgme_error_t
+pygpgme_op_end(PyGpgmeContext *self, gpgme_error_t err)
+{
+    if (pygpgme_watchdog_disarm(self) &&
+        gpgme_err_code(err) == GPG_ERR_CANCELED)
+        err = gpgme_err_make(gpgme_err_source(err), GPG_ERR_TIMEOUT);
+
+    if (pygpgme_op_stats != &self->stats)
+        return err;
+    self->stats.total_time = pygpgme_now() - self->stats.start;
+    self->stats.valid = 1;
+    pygpgme_op_stats = self->stats.outer;
+    self->stats.outer = NULL;
+    return err;
+}
+
+/* take the GIL from a callback, timing the wait if statistics are being
+ * collected.  start receives the time the callback got the GIL. */
+PyGILState_STATE
+pygpgme_callback_enter(double *start)
+{
+    PyGILState_STATE state;
+    double t;
+
+    if (pygpgme_op_stats == NULL)
+        return PyGILState_Ensure();
+
+    t = pygpgme_now();
+    state = PyGILState_Ensure();
+    *start = pygpgme_now();
+    pygpgme_op_stats->gil_wait_time += *start - t;
+    return state;
+}
+
+void
+pygpgme_callback_leave(PyGILState_STATE state, double start)
+{
+    if (pygpgme_op_stats != NULL)
+        pygpgme_op_stats->callback_time += pygpgme_now() - start;
+    PyGILState_Release(state);
+}
+
+PyObject *
+pygpgme_op_stats_dict(PyGpgmeOpStats *stats)
+{
+    return Py_BuildValue("{s:s,s:k,s:k,s:k,s:k,s:k,s:k,s:K,s:K,"
+                         "s:d,s:d,s:d}",
+                         "operation", stats->operation,
+                         "read_calls", stats->read_calls,
+                         "write_calls", stats->write_calls,
+                         "seek_calls", stats->seek_calls,
+                         "passphrase_calls", stats->passphrase_calls,
+                         "progress_calls", stats->progress_calls,
+                         "edit_calls", stats->edit_calls,
+                         "bytes_read", stats->bytes_read,
+                         "bytes_written", stats->bytes_written,
+                         "total_time", stats->total_time,
+                         "callback_time", stats->callback_time,
+                         "gil_wait_time", stats->gil_wait_time);
+}
@@ -0,0 +1,411 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+    pygpgme - a Python wrapper for the gpgme library
+    Copyright (C) 2006  James Henstridge
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "pygpgme.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* A StreamIter runs an operation in a helper thread, connected to the
+ * iterator by a pipe in each direction.  Each call to next() feeds input
+ * chunks into one pipe until output is available from the other, so only
+ * the pipe buffers are held in memory and output is returned as soon as
+ * the engine produces it.  The helper thread only runs gpgme, so it
+ * never needs the GIL except for passphrase and progress callbacks. */
+
+/* the most output returned by one next() call, unless the context has
+ * a larger write_buffer_size */
+#define STREAM_CHUNK_SIZE (64 * 1024)
+
+typedef struct {
+    PyObject_HEAD
+    PyGpgmeContext *ctx;
+    PyGpgmeStreamOp op;
+    gpgme_key_t *recp;
+    PyObject *py_recp;
+    int flags;
+    /* the input chunk iterator, NULL once exhausted */
+    PyObject *input;
+    /* the part of the current input chunk not yet written */
+    Py_buffer pending;
+    int have_pending;
+    Py_ssize_t pending_offset;
+    /* our ends of the pipes, or -1 once closed */
+    int in_fd;
+    int out_fd;
+    /* the engine's ends of the pipes, closed by the helper thread */
+    int engine_in_fd;
+    int engine_out_fd;
+    gpgme_data_t in;
+    gpgme_data_t out;
+    pthread_t thread;
+    int running;
+    /* set while a thread is in next(), which releases the GIL */
+    int busy;
+    gpgme_error_t err;
+    Py_ssize_t chunk_size;
+} PyGpgmeStream;
+
+static void *
+stream_thread(void *arg)
+{
+    PyGpgmeStream *self = arg;
+    gpgme_error_t err = GPG_ERR_NO_ERROR;
+
+    switch (self->op) {
+    case PYGPGME_STREAM_ENCRYPT:
+        pygpgme_op_begin(self->ctx, "encrypt_iter");
+        err = gpgme_op_encrypt(self->ctx->ctx, self->recp, self->flags,
+                               self->in, self->out);
+        break;
+    case PYGPGME_STREAM_DECRYPT:
+        pygpgme_op_begin(self->ctx, "decrypt_iter");
+        err = gpgme_op_decrypt(self->ctx->ctx, self->in, self->out);
+        break;
+    }
+    err = pygpgme_op_end(self->ctx, err);
+    pygpgme_context_unhold(self->ctx);
+
+    gpgme_data_release(self->in);
+    gpgme_data_release(self->out);
+    self->in = self->out = NULL;
+    /* closing the write end lets the iterator see the end of output */
+    close(self->engine_in_fd);
+    close(self->engine_out_fd);
+    self->engine_in_fd = self->engine_out_fd = -1;
+
+    self->err = err;
+    return NULL;
+}
+
+static void
+stream_release_pending(PyGpgmeStream *self)
+{
+    if (self->have_pending)
+        PyBuffer_Release(&self->pending);
+    self->have_pending = 0;
+    self->pending_offset = 0;
+}
+
+/* stop feeding input, so the engine sees end of file */
+static void
+stream_close_input(PyGpgmeStream *self)
+{
+    stream_release_pending(self);
+    Py_CLEAR(self->input);
+    if (self->in_fd >= 0)
+        close(self->in_fd);
+    self->in_fd = -1;
+}
+
+/* close our ends of the pipes and wait for the helper thread.  Closing
+ * the output pipe first makes an unfinished operation fail rather than
+ * block. */
+static void
+stream_finish(PyGpgmeStream *self)
+{
+    stream_close_input(self);
+    if (self->out_fd >= 0)
+        close(self->out_fd);
+    self->out_fd = -1;
+
+    if (self->running) {
+        Py_BEGIN_ALLOW_THREADS;
+        pthread_join(self->thread, NULL);
+        Py_END_ALLOW_THREADS;
+        self->running = 0;
+    }
+}
+
+static void
+pygpgme_stream_dealloc(PyGpgmeStream *self)
+{
+    stream_finish(self);
+    if (self->in)
+        gpgme_data_release(self->in);
+    if (self->out)
+        gpgme_data_release(self->out);
+    if (self->engine_in_fd >= 0)
+        close(self->engine_in_fd);
+    if (self->engine_out_fd >= 0)
+        close(self->engine_out_fd);
+    pygpgme_recipients_free(self->recp, self->py_recp);
+    Py_XDECREF(self->ctx);
+    PyObject_Del(self);
+}
+
+static PyObject *
+pygpgme_stream_iter(PyGpgmeStream *self)
+{
+    Py_INCREF(self);
+    return (PyObject *)self;
+}
+
+/* make sure there is a pending input chunk, unless the input is
+ * exhausted.  Returns -1 if the input iterator raised. */
+static int
+stream_next_input(PyGpgmeStream *self)
+{
+    PyObject *item;
+    int ret;
+
+    while (self->input != NULL && !self->have_pending) {
+        item = PyIter_Next(self->input);
+        if (item == NULL) {
+            if (PyErr_Occurred())
+                return -1;
+            stream_close_input(self);
+            break;
+        }
+        ret = PyArg_Parse(item, "s*", &self->pending);
+        Py_DECREF(item);
+        if (!ret)
+            return -1;
+        self->have_pending = 1;
+        self->pending_offset = 0;
+        /* skip empty chunks */
+        if (self->pending.len == 0)
+            stream_release_pending(self);
+    }
+    return 0;
+}
+
+static PyObject *
+stream_end(PyGpgmeStream *self)
+{
+    stream_finish(self);
+    if (pygpgme_check_error(self->err)) {
+        if (self->op == PYGPGME_STREAM_ENCRYPT)
+            pygpgme_decode_encrypt_result(self->ctx);
+        else
+            pygpgme_decode_decrypt_result(self->ctx);
+        self->err = GPG_ERR_NO_ERROR;
+        return NULL;
+    }
+    PyErr_SetNone(PyExc_StopIteration);
+    return NULL;
+}
+
+static PyObject *
+stream_next(PyGpgmeStream *self)
+{
+    struct pollfd fds[2];
+    PyObject *chunk;
+    ssize_t nread, nwritten;
+    int nfds, ret;
+
+    for (;;) {
+        if (self->out_fd < 0) {
+            PyErr_SetNone(PyExc_StopIteration);
+            return NULL;
+        }
+        if (stream_next_input(self) < 0) {
+            stream_finish(self);
+            return NULL;
+        }
+
+        fds[0].fd = self->out_fd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        nfds = 1;
+        if (self->in_fd >= 0) {
+            fds[1].fd = self->in_fd;
+            fds[1].events = POLLOUT;
+            fds[1].revents = 0;
+            nfds = 2;
+        }
+
+        Py_BEGIN_ALLOW_THREADS;
+        ret = poll(fds, nfds, -1);
+        Py_END_ALLOW_THREADS;
+        if (ret < 0) {
+            if (errno == EINTR) {
+                if (PyErr_CheckSignals() < 0) {
+                    stream_finish(self);
+                    return NULL;
+                }
+                continue;
+            }
+            PyErr_SetFromErrno(PyExc_OSError);
+            stream_finish(self);
+            return NULL;
+        }
+
+        if (nfds == 2 && fds[1].revents != 0) {
+            Py_BEGIN_ALLOW_THREADS;
+            nwritten = write(self->in_fd,
+                             (char *)self->pending.buf + self->pending_offset,
+                             self->pending.len - self->pending_offset);
+            Py_END_ALLOW_THREADS;
+            if (nwritten >= 0) {
+                self->pending_offset += nwritten;
+                if (self->pending_offset == self->pending.len)
+                    stream_release_pending(self);
+            } else if (errno == EPIPE) {
+                /* the engine has stopped reading: its result will say
+                 * why once the output is drained */
+                stream_close_input(self);
+            } else if (errno != EAGAIN && errno != EINTR) {
+                PyErr_SetFromErrno(PyExc_OSError);
+                stream_finish(self);
+                return NULL;
+            }
+        }
+
+        if (fds[0].revents != 0) {
+            chunk = PyString_FromStringAndSize(NULL, self->chunk_size);
+            if (chunk == NULL) {
+                stream_finish(self);
+                return NULL;
+            }
+            Py_BEGIN_ALLOW_THREADS;
+            nread = read(self->out_fd, PyString_AS_STRING(chunk),
+                         self->chunk_size);
+            Py_END_ALLOW_THREADS;
+            if (nread > 0) {
+                if (nread != self->chunk_size &&
+                    _PyString_Resize(&chunk, nread) < 0) {
+                    stream_finish(self);
+                    return NULL;
+                }
+                return chunk;
+            }
+            Py_DECREF(chunk);
+            if (nread == 0)
+                return stream_end(self);
+            if (errno != EAGAIN && errno != EINTR) {
+                PyErr_SetFromErrno(PyExc_OSError);
+                stream_finish(self);
+                return NULL;
+            }
+        }
+    }
+}
+
+static PyObject *
+pygpgme_stream_next(PyGpgmeStream *self)
+{
+    PyObject *ret;
+
+    /* the pending chunk and the helper thread are only used by one
+     * thread at a time */
+    if (self->busy) {
+        PyErr_SetString(PyExc_ValueError, "StreamIter already executing");
+        return NULL;
+    }
+    self->busy = 1;
+    ret = stream_next(self);
+    self->busy = 0;
+    return ret;
+}
+
+PyTypeObject PyGpgmeStream_Type = {
+    PyObject_HEAD_INIT(NULL)
+    0,
+    "gpgme.StreamIter",
+    sizeof(PyGpgmeStream),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_init = pygpgme_no_constructor,
+    .tp_dealloc = (destructor)pygpgme_stream_dealloc,
+    .tp_iter = (getiterfunc)pygpgme_stream_iter,
+    .tp_iternext = (iternextfunc)pygpgme_stream_next,
+};
+
+/* start op on ctx, reading from the chunks iterable.  The stream takes
+ * ownership of recp and the py_recp reference, even on failure. */
+PyObject *
+pygpgme_stream_new(PyGpgmeContext *ctx, PyGpgmeStreamOp op,
+                   gpgme_key_t *recp, PyObject *py_recp, int flags,
+                   PyObject *chunks)
+{
+    PyGpgmeStream *self;
+    int in_pipe[2], out_pipe[2];
+
+    self = PyObject_New(PyGpgmeStream, &PyGpgmeStream_Type);
+    if (self == NULL) {
+        pygpgme_recipients_free(recp, py_recp);
+        return NULL;
+    }
+    Py_INCREF(ctx);
+    self->ctx = ctx;
+    self->op = op;
+    self->recp = recp;
+    self->py_recp = py_recp;
+    self->flags = flags;
+    self->input = NULL;
+    self->have_pending = 0;
+    self->pending_offset = 0;
+    self->in_fd = self->out_fd = -1;
+    self->engine_in_fd = self->engine_out_fd = -1;
+    self->in = self->out = NULL;
+    self->running = 0;
+    self->busy = 0;
+    self->err = GPG_ERR_NO_ERROR;
+    self->chunk_size = ctx->write_buffer_size > 0 ?
+        ctx->write_buffer_size : STREAM_CHUNK_SIZE;
+
+    self->input = PyObject_GetIter(chunks);
+    if (self->input == NULL)
+        goto error;
+
+    if (pipe(in_pipe) < 0) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        goto error;
+    }
+    self->engine_in_fd = in_pipe[0];
+    self->in_fd = in_pipe[1];
+    if (pipe(out_pipe) < 0) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        goto error;
+    }
+    self->out_fd = out_pipe[0];
+    self->engine_out_fd = out_pipe[1];
+
+    /* our ends are only used after poll() says they are ready */
+    fcntl(self->in_fd, F_SETFL, fcntl(self->in_fd, F_GETFL) | O_NONBLOCK);
+    fcntl(self->out_fd, F_SETFL, fcntl(self->out_fd, F_GETFL) | O_NONBLOCK);
+    fcntl(self->in_fd, F_SETFD, FD_CLOEXEC);
+    fcntl(self->out_fd, F_SETFD, FD_CLOEXEC);
+
+    if (pygpgme_check_error(gpgme_data_new_from_fd(&self->in,
+                                                   self->engine_in_fd)))
+        goto error;
+    if (pygpgme_check_error(gpgme_data_new_from_fd(&self->out,
+                                                   self->engine_out_fd)))
+        goto error;
+
+    /* passphrase and progress callbacks are made from the helper thread */
+    PyEval_InitThreads();
+    /* the helper thread releases the context once the operation is done */
+    pygpgme_context_hold(self->ctx, 0);
+    errno = pthread_create(&self->thread, NULL, stream_thread, self);
+    if (errno != 0) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        pygpgme_context_unhold(self->ctx);
+        goto error;
+    }
+    self->running = 1;
+    return (PyObject *)self;
+
+ error:
+    Py_DECREF(self);
+    return NULL;
+}
@@ -0,0 +1,322 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+    pygpgme - a Python wrapper for the gpgme library
+    Copyright (C) 2006  James Henstridge
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "pygpgme.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+/* Synchronous operations block inside gpgme's own event loop, which
+ * can't be interrupted from Python.  While an operation runs, its
+ * context is watched by a helper thread that cancels it with
+ * gpgme_cancel_async() once its deadline passes.  gpgme notices the
+ * cancellation the next time its loop wakes, which is at least once a
+ * second.
+ *
+ * Operations running in the main thread on a context with catch_signals
+ * set are also cancelled when SIGINT or SIGTERM arrives and Python has a
+ * handler for it: the handler is chained from one that wakes the helper
+ * thread, and the cancellation error is replaced by whatever the Python
+ * handler raises once the operation returns.  Other operations without
+ * a deadline leave the signal handlers alone and don't need the helper
+ * thread. */
+
+static pthread_mutex_t watchdog_lock = PTHREAD_MUTEX_INITIALIZER;
+/* the watched contexts, protected by watchdog_lock */
+static PyGpgmeContext *watched = NULL;
+static int watchdog_started = 0;
+static int wakeup_pipe[2] = { -1, -1 };
+static pthread_t main_thread;
+
+static const int watched_signals[] = { SIGINT, SIGTERM };
+#define N_WATCHED_SIGNALS \
+    (int)(sizeof(watched_signals) / sizeof(watched_signals[0]))
+/* only used by the main thread */
+static int signal_depth = 0;
+static int signal_hooked[N_WATCHED_SIGNALS];
+static struct sigaction signal_saved[N_WATCHED_SIGNALS];
+
+void
+pygpgme_watchdog_init(void)
+{
+    main_thread = pthread_self();
+}
+
+static void
+watchdog_wake(char reason)
+{
+    ssize_t ret;
+
+    /* a full pipe already has a wakeup pending */
+    ret = write(wakeup_pipe[1], &reason, 1);
+    (void)ret;
+}
+
+static void
+watchdog_signal(int signum)
+{
+    int saved_errno = errno, i;
+
+    watchdog_wake('s');
+    for (i = 0; i < N_WATCHED_SIGNALS; i++)
+        if (watched_signals[i] == signum)
+            signal_saved[i].sa_handler(signum);
+    errno = saved_errno;
+}
+
+/* wake the watchdog from signals that have a handler installed */
+static void
+watchdog_hook_signals(void)
+{
+    struct sigaction action;
+    int i;
+
+    if (signal_depth++ > 0)
+        return;
+    for (i = 0; i < N_WATCHED_SIGNALS; i++) {
+        signal_hooked[i] = 0;
+        if (sigaction(watched_signals[i], NULL, &action) < 0 ||
+            (action.sa_flags & SA_SIGINFO) ||
+            action.sa_handler == SIG_DFL || action.sa_handler == SIG_IGN)
+            continue;
+        signal_saved[i] = action;
+        action.sa_handler = watchdog_signal;
+        if (sigaction(watched_signals[i], &action, NULL) == 0)
+            signal_hooked[i] = 1;
+    }
+}
+
+/* put back the handlers that were hooked, unless a new one has been
+ * installed since */
+static void
+watchdog_unhook_signals(void)
+{
+    struct sigaction action;
+    int i;
+
+    if (--signal_depth > 0)
+        return;
+    for (i = 0; i < N_WATCHED_SIGNALS; i++)
+        if (signal_hooked[i] &&
+            sigaction(watched_signals[i], NULL, &action) == 0 &&
+            action.sa_handler == watchdog_signal)
+            sigaction(watched_signals[i], &signal_saved[i], NULL);
+}
+
+static void *
+watchdog_thread(void *arg)
+{
+    struct pollfd pfd;
+    PyGpgmeContext *ctx;
+    double now, timeout;
+    char buf[64];
+    ssize_t n, i;
+    int interrupt;
+
+    pfd.fd = wakeup_pipe[0];
+    pfd.events = POLLIN;
+    for (;;) {
+        pthread_mutex_lock(&watchdog_lock);
+        now = pygpgme_now();
+        timeout = -1;
+        for (ctx = watched; ctx != NULL; ctx = ctx->watch_next) {
+            if (ctx->deadline == 0 || ctx->expired)
+                continue;
+            if (ctx->deadline <= now) {
+                ctx->expired = 1;
+                gpgme_cancel_async(ctx->ctx);
+            } else if (timeout < 0 || ctx->deadline - now < timeout)
+                timeout = ctx->deadline - now;
+        }
+        pthread_mutex_unlock(&watchdog_lock);
+
+        /* round up, so the deadline has passed when poll() returns */
+        if (poll(&pfd, 1, timeout < 0 ? -1 : (int)(timeout * 1000) + 1) <= 0)
+            continue;
+
+        interrupt = 0;
+        while ((n = read(wakeup_pipe[0], buf, sizeof(buf))) > 0)
+            for (i = 0; i < n; i++)
+                if (buf[i] == 's')
+                    interrupt = 1;
+        if (!interrupt)
+            continue;
+        pthread_mutex_lock(&watchdog_lock);
+        for (ctx = watched; ctx != NULL; ctx = ctx->watch_next) {
+            if (ctx->interruptible) {
+                ctx->cancelled = 1;
+                gpgme_cancel_async(ctx->ctx);
+            }
+        }
+        pthread_mutex_unlock(&watchdog_lock);
+    }
+    return NULL;
+}
+
+/* the helper thread doesn't survive fork() */
+static void
+watchdog_atfork_child(void)
+{
+    pthread_mutex_init(&watchdog_lock, NULL);
+    watched = NULL;
+    watchdog_started = 0;
+    if (wakeup_pipe[0] >= 0) {
+        close(wakeup_pipe[0]);
+        close(wakeup_pipe[1]);
+    }
+    wakeup_pipe[0] = wakeup_pipe[1] = -1;
+}
+
+/* start the helper thread if it isn't running.  Called with the lock
+ * held; returns -1 if it can't be started. */
+static int
+watchdog_start(void)
+{
+    static int atfork_registered = 0;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int i, ret;
+
+    if (watchdog_started)
+        return 0;
+    if (pipe(wakeup_pipe) < 0) {
+        wakeup_pipe[0] = wakeup_pipe[1] = -1;
+        return -1;
+    }
+    for (i = 0; i < 2; i++) {
+        fcntl(wakeup_pipe[i], F_SETFL,
+              fcntl(wakeup_pipe[i], F_GETFL) | O_NONBLOCK);
+        fcntl(wakeup_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+    if (!atfork_registered) {
+        pthread_atfork(NULL, NULL, watchdog_atfork_child);
+        atfork_registered = 1;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    ret = pthread_create(&thread, &attr, watchdog_thread, NULL);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        close(wakeup_pipe[0]);
+        close(wakeup_pipe[1]);
+        wakeup_pipe[0] = wakeup_pipe[1] = -1;
+        return -1;
+    }
+    watchdog_started = 1;
+    return 0;
+}
+
+/* mark ctx as running an operation, so that cancel() can reach it from
+ * other threads, and watch it if it has a deadline or catches signals
+ * in the main thread.  deadline is on the pygpgme_now() clock, or 0 for
+ * none.  Called without the GIL. */
+void
+pygpgme_watchdog_arm(PyGpgmeContext *ctx, double deadline)
+{
+    int interruptible = ctx->catch_signals &&
+        pthread_equal(pthread_self(), main_thread);
+
+    pthread_mutex_lock(&watchdog_lock);
+    ctx->running = 1;
+    ctx->cancelled = 0;
+    ctx->watched = 0;
+    if ((deadline == 0 && !interruptible) || watchdog_start() < 0) {
+        pthread_mutex_unlock(&watchdog_lock);
+        return;
+    }
+    ctx->deadline = deadline;
+    ctx->interruptible = interruptible;
+    ctx->expired = 0;
+    ctx->watch_prev = NULL;
+    ctx->watch_next = watched;
+    if (watched != NULL)
+        watched->watch_prev = ctx;
+    watched = ctx;
+    ctx->watched = 1;
+    pthread_mutex_unlock(&watchdog_lock);
+
+    if (deadline != 0)
+        watchdog_wake('a');
+    if (interruptible)
+        watchdog_hook_signals();
+}
+
+/* the operation has finished; returns whether its deadline passed */
+int
+pygpgme_watchdog_disarm(PyGpgmeContext *ctx)
+{
+    int expired = 0;
+
+    if (ctx->watched && ctx->interruptible)
+        watchdog_unhook_signals();
+
+    pthread_mutex_lock(&watchdog_lock);
+    ctx->running = 0;
+    if (ctx->watched) {
+        if (ctx->watch_prev != NULL)
+            ctx->watch_prev->watch_next = ctx->watch_next;
+        else
+            watched = ctx->watch_next;
+        if (ctx->watch_next != NULL)
+            ctx->watch_next->watch_prev = ctx->watch_prev;
+        ctx->watch_prev = ctx->watch_next = NULL;
+        ctx->watched = 0;
+        expired = ctx->expired;
+    }
+    pthread_mutex_unlock(&watchdog_lock);
+    return expired;
+}
+
+/* GPG_ERR_TIMEOUT if the deadline of the operation ctx is running has
+ * passed, GPG_ERR_CANCELED if it has been cancelled, or 0.  Lets a
+ * batch of jobs run as one operation stop after the current job. */
+gpgme_error_t
+pygpgme_watchdog_status(PyGpgmeContext *ctx)
+{
+    gpgme_error_t err = GPG_ERR_NO_ERROR;
+
+    pthread_mutex_lock(&watchdog_lock);
+    if (ctx->watched && ctx->expired)
+        err = gpgme_error(GPG_ERR_TIMEOUT);
+    else if (ctx->cancelled)
+        err = gpgme_error(GPG_ERR_CANCELED);
+    pthread_mutex_unlock(&watchdog_lock);
+    return err;
+}
+
+/* cancel the operation ctx is running, if any, returning whether there
+ * was one.  Safe to call from any thread. */
+int
+pygpgme_watchdog_cancel(PyGpgmeContext *ctx)
+{
+    int cancelled = 0;
+
+    pthread_mutex_lock(&watchdog_lock);
+    if (ctx->running) {
+        ctx->cancelled = 1;
+        gpgme_cancel_async(ctx->ctx);
+        cancelled = 1;
+    }
+    pthread_mutex_unlock(&watchdog_lock);
+    return cancelled;
+}
@@ -22,19 +22,100 @@
 
 #include <Python.h>
 #include <gpgme.h>
+#include <pthread.h>
 
 #define HIDDEN __attribute__((visibility("hidden")))
 
-typedef struct {
+/* output passed to Python write() methods is collected into chunks of
+ * this size by default.  Buffering is off unless asked for, so output
+ * reaches file objects as soon as the engine writes it. */
+#define PYGPGME_DEFAULT_WRITE_BUFFER_SIZE 0
+
+/* counters for the callbacks made during one context operation */
+typedef struct _PyGpgmeOpStats PyGpgmeOpStats;
+struct _PyGpgmeOpStats {
+    const char *operation;
+    int valid;
+    unsigned long read_calls;
+    unsigned long write_calls;
+    unsigned long seek_calls;
+    unsigned long passphrase_calls;
+    unsigned long progress_calls;
+    unsigned long edit_calls;
+    unsigned long long bytes_read;
+    unsigned long long bytes_written;
+    /* seconds */
+    double start;
+    double total_time;
+    double callback_time;
+    double gil_wait_time;
+    /* the operation this one was started from, if any */
+    PyGpgmeOpStats *outer;
+};
+
+typedef struct _PyGpgmeOperation PyGpgmeOperation;
+
+typedef struct _PyGpgmeContext PyGpgmeContext;
+struct _PyGpgmeContext {
     PyObject_HEAD
     gpgme_ctx_t ctx;
-} PyGpgmeContext;
+    Py_ssize_t write_buffer_size;
+    int collect_stats;
+    PyGpgmeOpStats stats;
+    /* the event loop driving started operations, or NULL */
+    PyObject *io_handler;
+    /* the started operation that hasn't finished yet, not owned */
+    PyGpgmeOperation *op;
+    /* seconds each operation may take, or 0 for no limit */
+    double timeout;
+    /* whether SIGINT and SIGTERM cancel operations in the main thread */
+    int catch_signals;
+    /* the state of the running operation, protected by the watchdog's
+     * lock; see pygpgme-watchdog.c */
+    int running;
+    int watched;
+    int interruptible;
+    int expired;
+    int cancelled;
+    double deadline;
+    PyGpgmeContext *watch_prev, *watch_next;
+    /* keeps threads from running operations on the context at the same
+     * time; see pygpgme_context_acquire() */
+    pthread_mutex_t lock;
+    pthread_cond_t idle;
+    pthread_t owner;
+    int depth;
+    /* set while an operation, stream or iterator holds the context, with
+     * the thread that started it and whether that thread may still use
+     * the context */
+    int held;
+    int held_reentrant;
+    pthread_t holder;
+    /* in affinity mode, a threading.local holding the context of each
+     * thread using this one, so it is freed when the thread exits, and
+     * weak references to them by thread id; otherwise NULL */
+    PyObject *local;
+    PyObject *children;
+    PyObject *weakreflist;
+    /* bumped whenever the context is configured; a child records the
+     * value it was last configured from */
+    unsigned long generation;
+    /* the gpgme.KeyCache looked up keys are kept in, or NULL */
+    PyObject *key_cache;
+};
 
 typedef struct {
     PyObject_HEAD
     gpgme_key_t key;
 } PyGpgmeKey;
 
+typedef struct {
+    PyObject_HEAD
+    /* NULL terminated, holding a reference to each key */
+    gpgme_key_t *keys;
+    int length;
+} PyGpgmeRecipientSet;
+
 typedef struct {
     PyObject_HEAD
     gpgme_subkey_t subkey;
@@ -95,14 +176,164 @@ typedef struct {
     PyObject *imports;
 } PyGpgmeImportResult;
 
+typedef struct _PyGpgmeKeyQueue PyGpgmeKeyQueue;
+
 typedef struct {
     PyObject_HEAD
     PyGpgmeContext *ctx;
+    /* whether the iterator still holds the context */
+    int locked;
+    /* set while a thread is listing keys for the iterator */
+    int busy;
+    /* whether secret keys are listed, for the context's key cache */
+    int secret;
+    /* the keys listed ahead by a helper thread, or NULL */
+    PyGpgmeKeyQueue *queue;
+    /* the error that ended the listing, not yet raised */
+    gpgme_error_t err;
 } PyGpgmeKeyIter;
 
+typedef struct _PyGpgmeReadAhead PyGpgmeReadAhead;
+
+typedef struct {
+    PyObject_HEAD
+    gpgme_data_t data;
+    Py_ssize_t size_hint;
+    /* owned by data, NULL unless reading ahead */
+    PyGpgmeReadAhead *read_ahead;
+    /* the file object, file descriptor or gpgme.MappedFile wrapped,
+     * kept alive so that a descriptor data reads isn't closed under it */
+    PyObject *source;
+} PyGpgmeData;
+
+typedef struct {
+    PyObject_HEAD
+    void *data;
+    Py_ssize_t size;
+    int fd;
+    PyObject *fallback;
+} PyGpgmeMappedFile;
+
+/* the operations a gpgme.StreamIter can run */
+typedef enum {
+    PYGPGME_STREAM_ENCRYPT,
+    PYGPGME_STREAM_DECRYPT
+} PyGpgmeStreamOp;
+
+typedef enum {
+    PYGPGME_OP_ENCRYPT,
+    PYGPGME_OP_DECRYPT,
+    PYGPGME_OP_SIGN,
+    PYGPGME_OP_VERIFY,
+    PYGPGME_OP_IMPORT,
+    PYGPGME_OP_KEYLIST
+} PyGpgmeOpType;
+
+#define PYGPGME_OPERATION_MAX_DATA 3
+
+struct _PyGpgmeOperation {
+    PyObject_HEAD
+    PyGpgmeContext *ctx;
+    PyGpgmeOpType type;
+    int started;
+    int done;
+    /* whether the operation holds the context until it finishes */
+    int locked;
+    gpgme_key_t *recp;
+    PyObject *py_recp;
+    /* data objects used by the operation, released once it finishes */
+    int ndata;
+    gpgme_data_t data[PYGPGME_OPERATION_MAX_DATA];
+    PyObject *py_data[PYGPGME_OPERATION_MAX_DATA];
+    int output[PYGPGME_OPERATION_MAX_DATA];
+    /* keys received so far by a keylist operation */
+    PyObject *keys;
+    /* the result, or the exception raised by the operation */
+    PyObject *result;
+    PyObject *exc_type;
+    PyObject *exc_value;
+    PyObject *exc_traceback;
+    PyObject *callbacks;
+};
+
+typedef struct {
+    PyObject_HEAD
+    /* operations that haven't finished, and finished ones not yet
+     * returned by wait() */
+    PyObject *pending;
+    PyObject *ready;
+} PyGpgmeMultiplexer;
+
+/* the operations run by the batch methods and gpgme.Executor */
+typedef enum {
+    PYGPGME_BATCH_ENCRYPT,
+    PYGPGME_BATCH_DECRYPT,
+    PYGPGME_BATCH_DECRYPT_VERIFY,
+    PYGPGME_BATCH_VERIFY,
+    PYGPGME_BATCH_SIGN
+} PyGpgmeBatchOp;
+
+/* the priority classes of gpgme.Executor jobs, most urgent first */
+enum {
+    PYGPGME_PRIORITY_INTERACTIVE,
+    PYGPGME_PRIORITY_NORMAL,
+    PYGPGME_PRIORITY_BULK,
+    PYGPGME_N_PRIORITIES
+};
+
+/* the bits of the flags column of Context.keylist_table() */
+enum {
+    PYGPGME_KEY_FLAG_REVOKED = 1 << 0,
+    PYGPGME_KEY_FLAG_EXPIRED = 1 << 1,
+    PYGPGME_KEY_FLAG_DISABLED = 1 << 2,
+    PYGPGME_KEY_FLAG_INVALID = 1 << 3,
+    PYGPGME_KEY_FLAG_CAN_ENCRYPT = 1 << 4,
+    PYGPGME_KEY_FLAG_CAN_SIGN = 1 << 5,
+    PYGPGME_KEY_FLAG_CAN_CERTIFY = 1 << 6,
+    PYGPGME_KEY_FLAG_SECRET = 1 << 7
+};
+
+typedef struct {
+    char *fpr;
+    gpgme_error_t reason;
+} PyGpgmeBatchInvalidKey;
+
+/* the parts of a gpgme_signature_t returned for verifying jobs */
+typedef struct {
+    char *fpr;
+    gpgme_sigsum_t summary;
+    gpgme_error_t status;
+    unsigned long timestamp;
+    gpgme_validity_t validity;
+} PyGpgmeBatchSignature;
+
+/* one operation on in-memory inputs, which can be run without the GIL */
+typedef struct {
+    PyGpgmeBatchOp op;
+    /* encrypt flags or signature mode */
+    int flags;
+    /* recipients; py_recp is only set on the job owning the array */
+    gpgme_key_t *recp;
+    PyObject *py_recp;
+    Py_buffer input;
+    int have_input;
+    /* the signed text for a detached signature */
+    Py_buffer signed_text;
+    int have_signed_text;
+    char *output;
+    size_t output_len;
+    gpgme_error_t err;
+    PyGpgmeBatchInvalidKey *invalid;
+    int ninvalid;
+    PyGpgmeBatchSignature *sigs;
+    int nsigs;
+} PyGpgmeBatchJob;
+
 extern HIDDEN PyObject *pygpgme_error;
 extern HIDDEN PyTypeObject PyGpgmeContext_Type;
 extern HIDDEN PyTypeObject PyGpgmeKey_Type;
+extern HIDDEN PyTypeObject PyGpgmeKeyCache_Type;
+extern HIDDEN PyTypeObject PyGpgmeRecipientSet_Type;
 extern HIDDEN PyTypeObject PyGpgmeSubkey_Type;
 extern HIDDEN PyTypeObject PyGpgmeUserId_Type;
 extern HIDDEN PyTypeObject PyGpgmeKeySig_Type;
@@ -110,6 +341,16 @@ extern HIDDEN PyTypeObject PyGpgmeNewSignature_Type;
 extern HIDDEN PyTypeObject PyGpgmeSignature_Type;
 extern HIDDEN PyTypeObject PyGpgmeImportResult_Type;
 extern HIDDEN PyTypeObject PyGpgmeKeyIter_Type;
+extern HIDDEN PyTypeObject PyGpgmeMappedFile_Type;
+extern HIDDEN PyTypeObject PyGpgmeData_Type;
+extern HIDDEN PyTypeObject PyGpgmeStream_Type;
+extern HIDDEN PyTypeObject PyGpgmeOperation_Type;
+extern HIDDEN PyTypeObject PyGpgmeIOWatch_Type;
+extern HIDDEN PyTypeObject PyGpgmeMultiplexer_Type;
+extern HIDDEN PyTypeObject PyGpgmeContextPool_Type;
+extern HIDDEN PyTypeObject PyGpgmeContextLease_Type;
+extern HIDDEN PyTypeObject PyGpgmeExecutor_Type;
+extern HIDDEN PyTypeObject PyGpgmeFuture_Type;
 
 HIDDEN int           pygpgme_check_error    (gpgme_error_t err);
 HIDDEN PyObject     *pygpgme_error_object   (gpgme_error_t err);
@@ -118,10 +359,106 @@ HIDDEN int           pygpgme_no_constructor (PyObject *self, PyObject *args,
                                              PyObject *kwargs);
 
 HIDDEN int           pygpgme_data_new       (gpgme_data_t *dh, PyObject *fp);
+HIDDEN int           pygpgme_data_new_output(gpgme_data_t *dh, PyObject *fp,
+                                             Py_ssize_t write_buffer_size);
+HIDDEN void          pygpgme_data_release   (gpgme_data_t dh, PyObject *fp);
+HIDDEN gpgme_error_t pygpgme_data_flush     (gpgme_data_t dh);
+HIDDEN PyObject     *pygpgme_data_release_and_get_string (gpgme_data_t dh);
+HIDDEN int           pygpgme_data_new_read_ahead (gpgme_data_t *dh,
+                                                  PyObject *fp, int nbuffers,
+                                                  Py_ssize_t buffer_size,
+                                                  PyGpgmeReadAhead **read_ahead);
+HIDDEN PyObject     *pygpgme_read_ahead_stats (PyGpgmeReadAhead *ra);
+
+/* the statistics of the operation running in this thread, or NULL when
+ * they aren't being collected */
+HIDDEN extern __thread PyGpgmeOpStats *pygpgme_op_stats;
+#define PYGPGME_STATS_ADD(field, n) \
+    do { if (pygpgme_op_stats) pygpgme_op_stats->field += (n); } while (0)
+
+HIDDEN double        pygpgme_now            (void);
+HIDDEN int           pygpgme_context_acquire (PyGpgmeContext *self);
+HIDDEN void          pygpgme_context_release (PyGpgmeContext *self);
+HIDDEN void          pygpgme_context_acquire_held (PyGpgmeContext *self);
+HIDDEN void          pygpgme_context_hold   (PyGpgmeContext *self,
+                                             int reentrant);
+HIDDEN void          pygpgme_context_unhold (PyGpgmeContext *self);
+
+HIDDEN void          pygpgme_watchdog_init  (void);
+HIDDEN void          pygpgme_watchdog_arm   (PyGpgmeContext *ctx,
+                                             double deadline);
+HIDDEN int           pygpgme_watchdog_disarm (PyGpgmeContext *ctx);
+HIDDEN gpgme_error_t pygpgme_watchdog_status (PyGpgmeContext *ctx);
+HIDDEN int           pygpgme_watchdog_cancel (PyGpgmeContext *ctx);
+HIDDEN void          pygpgme_op_begin       (PyGpgmeContext *self,
+                                             const char *operation);
+HIDDEN gpgme_error_t pygpgme_op_end         (PyGpgmeContext *self,
+                                             gpgme_error_t err);
+HIDDEN PyGILState_STATE pygpgme_callback_enter (double *start);
+HIDDEN void          pygpgme_callback_leave (PyGILState_STATE state,
+                                             double start);
+HIDDEN PyObject     *pygpgme_op_stats_dict  (PyGpgmeOpStats *stats);
+HIDDEN PyObject     *pygpgme_mappedfile_fallback (PyObject *obj);
 HIDDEN PyObject     *pygpgme_key_new        (gpgme_key_t key);
+HIDDEN gpgme_key_t   pygpgme_keycache_lookup (PyGpgmeContext *ctx,
+                                              const char *fpr, int secret);
+HIDDEN void          pygpgme_keycache_insert (PyGpgmeContext *ctx,
+                                              gpgme_key_t key, int secret);
+HIDDEN void          pygpgme_keycache_invalidate (PyGpgmeContext *ctx);
+HIDDEN int           pygpgme_keyiter_prefetch (PyGpgmeKeyIter *self,
+                                               Py_ssize_t size);
 HIDDEN PyObject     *pygpgme_newsiglist_new (gpgme_new_signature_t siglist);
 HIDDEN PyObject     *pygpgme_siglist_new    (gpgme_signature_t siglist);
 HIDDEN PyObject     *pygpgme_import_result  (gpgme_ctx_t ctx);
+HIDDEN int           pygpgme_recipients     (PyObject *py_recp,
+                                             gpgme_key_t **recp,
+                                             PyObject **py_keys);
+HIDDEN void          pygpgme_recipients_free (gpgme_key_t *recp,
+                                              PyObject *py_keys);
+HIDDEN void          pygpgme_decode_encrypt_result (PyGpgmeContext *self);
+HIDDEN void          pygpgme_decode_decrypt_result (PyGpgmeContext *self);
+HIDDEN PyObject     *pygpgme_decode_sign_result (PyGpgmeContext *self,
+                                                 gpgme_error_t err);
+HIDDEN PyObject     *pygpgme_decode_verify_result (PyGpgmeContext *self,
+                                                   gpgme_error_t err);
+HIDDEN int           pygpgme_batch_get_buffer (PyObject *obj,
+                                               Py_buffer *view,
+                                               int *have_view);
+HIDDEN void          pygpgme_batch_run      (gpgme_ctx_t ctx,
+                                             PyGpgmeBatchJob *job);
+HIDDEN PyObject     *pygpgme_batch_result   (PyGpgmeBatchJob *job);
+HIDDEN void          pygpgme_batch_job_clear (PyGpgmeBatchJob *job);
+HIDDEN PyObject     *pygpgme_encrypt_many   (PyGpgmeContext *self,
+                                             PyObject *py_jobs, int flags);
+HIDDEN PyObject     *pygpgme_decrypt_many   (PyGpgmeContext *self,
+                                             PyObject *py_ciphers,
+                                             int verify);
+HIDDEN PyObject     *pygpgme_verify_many    (PyGpgmeContext *self,
+                                             PyObject *py_jobs);
+HIDDEN PyObject     *pygpgme_keylist_table  (PyGpgmeContext *self,
+                                             PyObject *py_pattern,
+                                             int secret_only,
+                                             PyObject *py_fields);
+HIDDEN PyObject     *pygpgme_stream_new     (PyGpgmeContext *ctx,
+                                             PyGpgmeStreamOp op,
+                                             gpgme_key_t *recp,
+                                             PyObject *py_recp, int flags,
+                                             PyObject *chunks);
+
+HIDDEN PyGpgmeOperation *pygpgme_operation_new (PyGpgmeContext *ctx,
+                                                PyGpgmeOpType type);
+HIDDEN int           pygpgme_operation_add_data (PyGpgmeOperation *op,
+                                                 gpgme_data_t data,
+                                                 PyObject *py_data,
+                                                 int output);
+HIDDEN PyObject     *pygpgme_operation_started (PyGpgmeOperation *op,
+                                                gpgme_error_t err);
+HIDDEN void          pygpgme_operation_finish (PyGpgmeOperation *op,
+                                               gpgme_error_t err);
+HIDDEN void          pygpgme_operation_complete (PyGpgmeOperation *op,
+                                                 gpgme_error_t err);
+HIDDEN int           pygpgme_set_io_handler (PyGpgmeContext *ctx,
+                                             PyObject *handler);
 
 HIDDEN PyObject     *pygpgme_make_constants (PyObject *self, PyObject *args);
 